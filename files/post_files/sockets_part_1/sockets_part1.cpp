@@ -18,6 +18,9 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #include <sys/socket.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <sys/ioctl.h>
 
 /**
  * Includes used for dumping addrinfo struct 
@@ -29,7 +32,21 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 namespace
 {
     const char HOST[] = "fizz.buzz";
-    const size_t BUFFER_SIZE = 1024;
+    const size_t MIN_BUFFER_SIZE = 16 * 1024;
+    const size_t MAX_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    /**
+     * Grow the buffer to hold everything already queued on the socket
+     * so it can be drained with a single recv
+     */
+    void fit_buffer(int connection, std::vector<char> & buffer)
+    {
+        int queued = 0;
+        if (ioctl(connection, FIONREAD, &queued) == 0 && static_cast<size_t>(queued) > buffer.size())
+        {
+            buffer.resize(std::min(static_cast<size_t>(queued), MAX_BUFFER_SIZE));
+        }
+    }
 
     std::string dump_hex(unsigned char * data, size_t length)
     {
@@ -159,14 +176,15 @@ int main(int argc, char** argv)
     std::string http_query = "GET / HTTP/1.1\r\n"    \
         "Host: " + std::string(HOST) + "\r\n\r\n";
 
-    char buffer[BUFFER_SIZE];
+    std::vector<char> buffer(MIN_BUFFER_SIZE);
     
     send(connection, http_query.c_str(), http_query.size(), 0);
-    for (ssize_t read_size = recv(connection, buffer, BUFFER_SIZE, 0);
-         read_size > 0;
-         read_size = recv(connection, buffer, BUFFER_SIZE, 0))
+    for (ssize_t read_size = 1; read_size > 0;)
     {
-        std::cout << std::string(buffer, read_size);
+        fit_buffer(connection, buffer);
+        read_size = recv(connection, buffer.data(), buffer.size(), 0);
+        if (read_size > 0)
+            std::cout.write(buffer.data(), read_size);
     }
 
     close(connection);
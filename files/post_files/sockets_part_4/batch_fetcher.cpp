@@ -0,0 +1,604 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "batch_fetcher.h"
+#include "bulk_resolver.h"
+#include "http_response_decoder.h"
+#include "ssl_socket.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t NO_REQUEST = SIZE_MAX;
+    const int MAX_EVENTS = 64;
+    const std::chrono::milliseconds EVENT_WAIT(100);
+
+    /**
+     * A keep-alive connection may have been closed by the server while
+     * it sat idle, so a request that failed before any response arrived
+     * on a reused connection is retried once on a new connection
+     */
+    const size_t MAX_STALE_RETRIES = 1;
+
+    struct url_parts
+    {
+        bool secure;
+        std::string host;
+        std::string port;
+        std::string authority; ///< host[:port] as written, for the Host header
+        std::string path;
+    };
+
+    /**
+     * Split an http:// or https:// URL into the pieces a request needs
+     *
+     * @return false if the URL isn't one we can fetch
+     */
+    bool parse_url(const std::string & url, url_parts & parts)
+    {
+        size_t scheme_end = url.find("://");
+        if (scheme_end == std::string::npos)
+        {
+            return false;
+        }
+        std::string scheme = url.substr(0, scheme_end);
+        std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+        if (scheme != "http" && scheme != "https")
+        {
+            return false;
+        }
+        parts.secure = scheme == "https";
+
+        size_t authority_start = scheme_end + 3;
+        size_t path_start = url.find_first_of("/?#", authority_start);
+        parts.authority = url.substr(authority_start, path_start == std::string::npos ? std::string::npos : path_start - authority_start);
+        if (parts.authority.empty())
+        {
+            return false;
+        }
+
+        std::string port_part;
+        if (parts.authority[0] == '[') // IPv6 literal
+        {
+            size_t close = parts.authority.find(']');
+            if (close == std::string::npos)
+            {
+                return false;
+            }
+            parts.host = parts.authority.substr(1, close - 1);
+            port_part = parts.authority.substr(close + 1);
+        } else {
+            size_t colon = parts.authority.find(':');
+            parts.host = parts.authority.substr(0, colon);
+            port_part = colon == std::string::npos ? "" : parts.authority.substr(colon);
+        }
+        if (!port_part.empty() && (port_part[0] != ':' || port_part.size() < 2))
+        {
+            return false;
+        }
+        parts.port = port_part.empty() ? (parts.secure ? "443" : "80") : port_part.substr(1);
+
+        parts.path = path_start == std::string::npos ? "/" : url.substr(path_start);
+        parts.path = parts.path.substr(0, parts.path.find('#')); // Fragments stay on the client
+        if (parts.path.empty() || parts.path[0] != '/')
+        {
+            parts.path = "/" + parts.path;
+        }
+        return true;
+    }
+
+    std::string format_address(const resolved_address & address)
+    {
+        char text[INET6_ADDRSTRLEN] = {0};
+        inet_ntop(address.family, address.bytes, text, sizeof(text));
+        return text;
+    }
+
+    std::string lowercase_header(const http_response_decoder & decoder, const char* name)
+    {
+        std::string value = decoder.get_header(name);
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        return value;
+    }
+
+    /**
+     * Responses with neither a length nor chunked coding end when the
+     * server closes the connection
+     */
+    bool ends_at_close(const http_response_decoder & decoder)
+    {
+        return decoder.has_headers() && decoder.get_header("Content-Length").empty()
+            && lowercase_header(decoder, "Transfer-Encoding").find("chunked") == std::string::npos;
+    }
+
+    struct connection_state
+    {
+        std::unique_ptr<ssl_socket> socket;
+        std::string host_key;
+        size_t request;
+        bool reused;
+        bool received_any;
+        std::unique_ptr<http_response_decoder> decoder;
+        std::chrono::steady_clock::time_point last_progress;
+    };
+
+    struct host_queue
+    {
+        std::deque<size_t> pending;
+        size_t open;
+    };
+
+    /**
+     * The state of one batch_fetcher::run call
+     */
+    class fetch_loop
+    {
+      public:
+        fetch_loop(const std::vector<std::string> & urls, const batch_fetcher::result_handler & _handler,
+                   size_t _max_connections, size_t _max_per_host, bool _verify_peer, std::chrono::milliseconds _timeout):
+            handler(_handler),
+            max_connections(_max_connections),
+            max_per_host(_max_per_host),
+            verify_peer(_verify_peer),
+            timeout(_timeout),
+            epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+            results(urls.size()),
+            targets(urls.size()),
+            finished(urls.size(), false),
+            retries(urls.size(), 0),
+            next_result(0)
+        {
+            if (epoll_fd < 0)
+            {
+                throw ssl_socket_exception("Unable to create epoll instance: " + std::string(strerror(errno)));
+            }
+            for (size_t i = 0; i < urls.size(); ++i)
+            {
+                results[i].url = urls[i];
+                results[i].status = 0;
+                if (!parse_url(urls[i], targets[i]))
+                {
+                    results[i].error = "Unsupported URL";
+                    continue;
+                }
+                std::string key = (targets[i].secure ? "https://" : "http://") + targets[i].host + ":" + targets[i].port;
+                if (hosts.find(key) == hosts.end())
+                {
+                    host_order.push_back(key);
+                    hosts[key].open = 0;
+                }
+                hosts[key].pending.push_back(i);
+            }
+        }
+        ~fetch_loop()
+        {
+            close(epoll_fd);
+        }
+        fetch_loop(fetch_loop const&) = delete;
+        fetch_loop& operator=(fetch_loop const&) = delete;
+
+        void run()
+        {
+            for (size_t i = 0; i < results.size(); ++i)
+            {
+                if (!results[i].error.empty())
+                    complete(i);
+            }
+
+            struct epoll_event events[MAX_EVENTS];
+            resolve_hosts();
+            dispatch();
+            while (!connections.empty())
+            {
+                int count = epoll_wait(epoll_fd, events, MAX_EVENTS, EVENT_WAIT.count());
+                if (count < 0 && errno != EINTR)
+                {
+                    throw ssl_socket_exception("Error waiting for events: " + std::string(strerror(errno)));
+                }
+                for (int i = 0; i < count; ++i)
+                {
+                    auto found = connections.find(events[i].data.fd);
+                    if (found == connections.end())
+                        continue;
+                    connection_state & connection = *found->second;
+                    if (connection.socket->is_connecting() || connection.socket->is_handshaking())
+                        on_connecting(connection, events[i].data.fd);
+                    else
+                        on_readable(connection);
+                }
+                expire_stalled();
+                dispatch();
+            }
+        }
+
+      private:
+        /**
+         * Resolve every host once, all at the same time, so the event
+         * loop never waits on DNS
+         */
+        void resolve_hosts()
+        {
+            std::vector<std::string> names;
+            for (size_t i = 0; i < targets.size(); ++i)
+            {
+                if (results[i].error.empty())
+                    names.push_back(targets[i].host);
+            }
+            for (resolve_result & result : bulk_resolver().resolve(names))
+            {
+                std::string name = result.name;
+                resolved[name] = std::move(result);
+            }
+        }
+
+        /**
+         * Open connections for hosts with waiting URLs, one per host
+         * per round so hosts share the global limit fairly
+         */
+        void dispatch()
+        {
+            for (bool opened = true; opened; )
+            {
+                opened = false;
+                for (const std::string & key : host_order)
+                {
+                    host_queue & host = hosts[key];
+                    if (host.pending.empty() || host.open >= max_per_host || connections.size() >= max_connections)
+                    {
+                        continue;
+                    }
+                    size_t index = host.pending.front();
+                    host.pending.pop_front();
+                    opened = open_connection(key, index) || opened;
+                }
+            }
+        }
+
+        /**
+         * Start connecting for a URL. The connection and the TLS
+         * handshake are driven by on_connecting, the request goes out
+         * once they are done.
+         */
+        bool open_connection(const std::string & key, size_t index)
+        {
+            const url_parts & target = targets[index];
+            const resolve_result & address = resolved[target.host];
+            if (address.addresses.empty())
+            {
+                results[index].error = "Error getting address info: "
+                    + std::string(address.error != 0 ? gai_strerror(address.error) : "No usable address");
+                complete(index);
+                return false;
+            }
+
+            std::unique_ptr<connection_state> state(new connection_state());
+            try
+            {
+                state->socket.reset(new ssl_socket(format_address(address.addresses.front()), target.port));
+                state->socket->set_verify_peer(verify_peer).set_server_name(target.host).start_connect();
+            } catch (const ssl_socket_exception & e) {
+                results[index].error = e.to_string();
+                complete(index);
+                return false;
+            }
+
+            int fd = state->socket->get_descriptor();
+            struct epoll_event event = {0};
+            event.events = EPOLLOUT;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+            {
+                results[index].error = "Unable to watch socket: " + std::string(strerror(errno));
+                complete(index);
+                return false;
+            }
+
+            state->host_key = key;
+            state->request = index;
+            state->reused = false;
+            state->received_any = false;
+            state->last_progress = std::chrono::steady_clock::now();
+            connections[fd] = std::move(state);
+            ++hosts[key].open;
+            return true;
+        }
+
+        /**
+         * Step the connect and then the TLS handshake of a new
+         * connection, and send its first request once both are done
+         *
+         * @param fd the descriptor the connection is registered under
+         */
+        void on_connecting(connection_state & connection, int fd)
+        {
+            ssl_socket & socket = *connection.socket;
+            uint32_t events = EPOLLIN | EPOLLRDHUP;
+            try
+            {
+                if (socket.is_connecting())
+                {
+                    if (!socket.continue_connect())
+                    {
+                        watch(connection, fd, EPOLLOUT);
+                        return;
+                    }
+                    if (targets[connection.request].secure)
+                        socket.start_secure();
+                }
+                if (socket.is_handshaking() && !socket.continue_secure())
+                {
+                    watch(connection, fd, socket.get_handshake_events() == POLLOUT ? EPOLLOUT : EPOLLIN);
+                    return;
+                }
+                watch(connection, fd, events);
+            } catch (const ssl_socket_exception & e) {
+                request_failed(connection, e.to_string());
+                return;
+            }
+            start_request(connection, connection.request);
+        }
+
+        /**
+         * Point the connection's epoll registration at its current
+         * descriptor and events. A connect that moved on to the next
+         * address has a new descriptor, the old one left epoll when it
+         * was closed.
+         *
+         * @throw ssl_socket_exception if epoll refuses the descriptor
+         */
+        void watch(connection_state & connection, int previous_fd, uint32_t events)
+        {
+            int fd = connection.socket->get_descriptor();
+            if (fd != previous_fd)
+            {
+                auto entry = connections.find(previous_fd);
+                std::unique_ptr<connection_state> moved = std::move(entry->second);
+                connections.erase(entry);
+                connections[fd] = std::move(moved);
+            }
+            struct epoll_event event = {0};
+            event.events = events;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0
+                && (errno != ENOENT || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0))
+            {
+                throw ssl_socket_exception("Unable to watch socket: " + std::string(strerror(errno)));
+            }
+        }
+
+        void start_request(connection_state & connection, size_t index)
+        {
+            const url_parts & target = targets[index];
+            connection.request = index;
+            connection.received_any = false;
+            connection.last_progress = std::chrono::steady_clock::now();
+            std::string & body = results[index].body;
+            connection.decoder.reset(new http_response_decoder([&body](const char* data, size_t length) {
+                        body.append(data, length);
+                    }));
+            try
+            {
+                connection.socket->write("GET " + target.path + " HTTP/1.1\r\n"
+                                         "Host: " + target.authority + "\r\n"
+                                         "Accept-Encoding: gzip\r\n\r\n");
+            } catch (const ssl_socket_exception & e) {
+                request_failed(connection, e.to_string());
+            }
+        }
+
+        void on_readable(connection_state & connection)
+        {
+            while (true)
+            {
+                size_t length = 0;
+                try
+                {
+                    length = connection.socket->read(buffer);
+                    if (length > 0 && connection.request != NO_REQUEST)
+                    {
+                        connection.received_any = true;
+                        connection.last_progress = std::chrono::steady_clock::now();
+                        connection.decoder->feed(buffer.data(), length);
+                    }
+                } catch (const ssl_socket_exception & e) {
+                    request_failed(connection, e.to_string());
+                    return;
+                }
+
+                if (connection.request == NO_REQUEST)
+                {
+                    close_connection(connection); // Nothing should arrive between requests
+                    return;
+                }
+                if (connection.decoder->is_complete() || (!connection.socket->is_connected() && ends_at_close(*connection.decoder)))
+                {
+                    request_done(connection);
+                    return;
+                }
+                if (!connection.socket->is_connected())
+                {
+                    request_failed(connection, "Connection closed before the response was complete");
+                    return;
+                }
+                if (length == 0)
+                {
+                    return; // Drained, wait for the next event
+                }
+            }
+        }
+
+        void request_done(connection_state & connection)
+        {
+            size_t index = connection.request;
+            results[index].status = connection.decoder->get_status();
+            bool keep_alive = connection.socket->is_connected()
+                && lowercase_header(*connection.decoder, "Connection").find("close") == std::string::npos;
+            connection.request = NO_REQUEST;
+            connection.decoder.reset();
+            complete(index);
+
+            host_queue & host = hosts[connection.host_key];
+            if (keep_alive && !host.pending.empty())
+            {
+                size_t next = host.pending.front();
+                host.pending.pop_front();
+                connection.reused = true;
+                start_request(connection, next);
+            } else {
+                close_connection(connection);
+            }
+        }
+
+        void request_failed(connection_state & connection, const std::string & error)
+        {
+            size_t index = connection.request;
+            bool stale = connection.reused && !connection.received_any;
+            std::string key = connection.host_key;
+            close_connection(connection);
+            if (index == NO_REQUEST)
+            {
+                return;
+            }
+
+            if (stale && retries[index] < MAX_STALE_RETRIES)
+            {
+                ++retries[index];
+                results[index].body.clear();
+                hosts[key].pending.push_front(index);
+            } else {
+                results[index].error = error;
+                complete(index);
+            }
+        }
+
+        void expire_stalled()
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            std::vector<connection_state*> stalled;
+            for (auto & entry : connections)
+            {
+                if (entry.second->request != NO_REQUEST && now - entry.second->last_progress > timeout)
+                    stalled.push_back(entry.second.get());
+            }
+            for (connection_state* connection : stalled)
+            {
+                request_failed(*connection, "Timed out waiting for the server");
+            }
+        }
+
+        /**
+         * Destroys the connection, references to it are invalid afterwards
+         */
+        void close_connection(connection_state & connection)
+        {
+            int fd = connection.socket->get_descriptor();
+            --hosts[connection.host_key].open;
+            if (fd >= 0)
+            {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            }
+            // A socket the peer closed has already given up its descriptor
+            for (auto entry = connections.begin(); entry != connections.end(); ++entry)
+            {
+                if (entry->second.get() == &connection)
+                {
+                    connections.erase(entry);
+                    break;
+                }
+            }
+        }
+
+        /**
+         * Mark a URL finished and hand out every result that is now
+         * next in input order
+         */
+        void complete(size_t index)
+        {
+            finished[index] = true;
+            for (; next_result < results.size() && finished[next_result]; ++next_result)
+            {
+                handler(results[next_result]);
+                std::string().swap(results[next_result].body);
+            }
+        }
+
+        const batch_fetcher::result_handler & handler;
+        size_t max_connections;
+        size_t max_per_host;
+        bool verify_peer;
+        std::chrono::milliseconds timeout;
+        int epoll_fd;
+        std::vector<fetch_result> results;
+        std::vector<url_parts> targets;
+        std::vector<bool> finished;
+        std::vector<size_t> retries;
+        size_t next_result;
+        std::map<std::string, host_queue> hosts;
+        std::vector<std::string> host_order;
+        std::unordered_map<int, std::unique_ptr<connection_state>> connections;
+        std::unordered_map<std::string, resolve_result> resolved;
+        std::vector<char> buffer;
+    };
+}
+
+batch_fetcher::batch_fetcher():
+    max_connections(32),
+    max_per_host(4),
+    verify_peer(true),
+    timeout(30000)
+{
+
+}
+
+batch_fetcher& batch_fetcher::set_max_connections(size_t count)
+{
+    max_connections = std::max<size_t>(count, 1);
+    return *this;
+}
+
+batch_fetcher& batch_fetcher::set_max_per_host(size_t count)
+{
+    max_per_host = std::max<size_t>(count, 1);
+    return *this;
+}
+
+batch_fetcher& batch_fetcher::set_verify_peer(bool enabled)
+{
+    verify_peer = enabled;
+    return *this;
+}
+
+batch_fetcher& batch_fetcher::set_timeout(std::chrono::milliseconds _timeout)
+{
+    timeout = _timeout;
+    return *this;
+}
+
+void batch_fetcher::run(const std::vector<std::string> & urls, const result_handler & handler)
+{
+    fetch_loop loop(urls, handler, max_connections, max_per_host, verify_peer, timeout);
+    loop.run();
+}
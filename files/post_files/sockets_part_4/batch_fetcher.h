@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * The outcome of fetching one URL
+ */
+struct fetch_result
+{
+    std::string url;
+    int status; ///< HTTP status, 0 if the request failed
+    std::string body; ///< Decoded body
+    std::string error; ///< Why the request failed, empty on success
+};
+
+/**
+ * Fetches a list of http:// and https:// URLs concurrently on a single
+ * epoll loop. Connections are kept alive and reused for further URLs
+ * on the same host, with limits on the number of connections per host
+ * and overall. Every host is resolved once before the loop starts, and
+ * connecting and the TLS handshake are stepped by the loop, so a slow
+ * or unreachable host only holds up its own URLs until the timeout.
+ * Results are handed out in the order of the input list,
+ * so responses that finish early are held in memory until every URL
+ * before them is done.
+ */
+class batch_fetcher
+{
+  public:
+    typedef std::function<void(const fetch_result & result)> result_handler;
+
+    batch_fetcher();
+
+    /**
+     * Set the most connections open at once (32 by default)
+     *
+     * @return a reference to itself
+     */
+    batch_fetcher& set_max_connections(size_t count);
+
+    /**
+     * Set the most connections open to one host at once (4 by default)
+     *
+     * @return a reference to itself
+     */
+    batch_fetcher& set_max_per_host(size_t count);
+
+    /**
+     * Enable or disable peer certificate verification for https URLs
+     * (on by default)
+     *
+     * @return a reference to itself
+     */
+    batch_fetcher& set_verify_peer(bool enabled = true);
+
+    /**
+     * Set how long a request may go without any progress before it
+     * fails (30 seconds by default)
+     *
+     * @return a reference to itself
+     */
+    batch_fetcher& set_timeout(std::chrono::milliseconds timeout);
+
+    /**
+     * Fetch every URL. A URL that fails is reported through its result
+     * rather than stopping the batch.
+     *
+     * @param urls the URLs to fetch
+     * @param handler called once per URL, in the order of urls
+     *
+     * @throw ssl_socket_exception if the event loop can't be created,
+     * or whatever handler throws
+     */
+    void run(const std::vector<std::string> & urls, const result_handler & handler);
+
+  private:
+    size_t max_connections;
+    size_t max_per_host;
+    bool verify_peer;
+    std::chrono::milliseconds timeout;
+};
@@ -0,0 +1,254 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "batch_fetcher.h"
+#include "bench_common.h"
+#include "ssl_socket.h"
+
+/**
+ * Runs batch_fetcher against local servers with an offline URL list,
+ * checking that every body arrives intact and in list order and that
+ * no host ever sees more connections than allowed. Usage:
+ *
+ *   bench_batch [urls] [--hosts N] [--delay MILLISECONDS]
+ *
+ * Each "host" is a TLS server on its own loopback port that waits
+ * --delay (2ms by default) before answering, to stand in for server
+ * think time. Every fifth response is chunked, every seventh follows
+ * a 103 Early Hints that the client has to skip, and every fiftieth
+ * closes the connection so reconnects get exercised too. One more
+ * host accepts connections but never answers the handshake, its URL
+ * has to time out without holding up the others.
+ */
+namespace
+{
+    const size_t MAX_HOSTS = 16;
+    const size_t BODY_REPEAT = 32;
+    const std::chrono::milliseconds SILENT_TIMEOUT(1000);
+
+    struct limits
+    {
+        size_t connections;
+        size_t per_host;
+    };
+
+    /**
+     * Connection counts kept in memory shared with the server children
+     */
+    struct connection_counters
+    {
+        std::atomic<int> open[MAX_HOSTS];
+        std::atomic<int> peak[MAX_HOSTS];
+    };
+
+    std::string expected_body(size_t item)
+    {
+        std::string line = "item " + std::to_string(item) + "\n";
+        std::string body;
+        for (size_t i = 0; i < BODY_REPEAT; ++i)
+            body += line;
+        return body;
+    }
+
+    bool send_all(SSL* ssl, const std::string & data)
+    {
+        for (size_t sent = 0; sent < data.size(); )
+        {
+            int written = SSL_write(ssl, data.data() + sent, data.size() - sent);
+            if (written <= 0)
+                return false;
+            sent += written;
+        }
+        return true;
+    }
+
+    /**
+     * Answer requests until the client hangs up or a response closes
+     * the connection. A closing connection stops counting as open
+     * before its last response goes out, since the client may connect
+     * again as soon as it has read it.
+     */
+    void serve_connection(SSL* ssl, std::chrono::milliseconds delay, std::atomic<int> & open)
+    {
+        std::string request;
+        char buffer[4096];
+        while (true)
+        {
+            size_t end = request.find("\r\n\r\n");
+            if (end == std::string::npos)
+            {
+                int read_size = SSL_read(ssl, buffer, sizeof(buffer));
+                if (read_size <= 0)
+                {
+                    --open;
+                    return;
+                }
+                request.append(buffer, read_size);
+                continue;
+            }
+            size_t item_start = request.find("/item/");
+            size_t item = item_start < end ? strtoul(request.c_str() + item_start + 6, nullptr, 10) : 0;
+            request.erase(0, end + 4);
+
+            std::this_thread::sleep_for(delay);
+            std::string body = expected_body(item);
+            bool close_after = item % 50 == 49;
+            std::string response;
+            if (item % 7 == 6)
+                response += "HTTP/1.1 103 Early Hints\r\nLink: </style.css>; rel=preload\r\n\r\n";
+            response += "HTTP/1.1 200 OK\r\n";
+            if (close_after)
+                response += "Connection: close\r\n";
+            if (item % 5 == 4)
+            {
+                size_t half = body.size() / 2;
+                char size_line[32];
+                response += "Transfer-Encoding: chunked\r\n\r\n";
+                snprintf(size_line, sizeof(size_line), "%zx\r\n", half);
+                response += size_line + body.substr(0, half) + "\r\n";
+                snprintf(size_line, sizeof(size_line), "%zx\r\n", body.size() - half);
+                response += size_line + body.substr(half) + "\r\n0\r\n\r\n";
+            } else {
+                response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+            }
+            if (close_after)
+            {
+                --open;
+                send_all(ssl, response);
+                return;
+            }
+            if (!send_all(ssl, response))
+            {
+                --open;
+                return;
+            }
+        }
+    }
+
+    void run_server(int listener, size_t host, connection_counters* counters, std::chrono::milliseconds delay)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        while (true)
+        {
+            int connection = bench::accept_connection(listener);
+            std::thread([=]() {
+                    int open = ++counters->open[host];
+                    for (int peak = counters->peak[host]; open > peak && !counters->peak[host].compare_exchange_weak(peak, open); )
+                        ;
+                    SSL* ssl = SSL_new(context);
+                    SSL_set_fd(ssl, connection);
+                    if (SSL_accept(ssl) == 1)
+                        serve_connection(ssl, delay, counters->open[host]);
+                    else
+                        --counters->open[host];
+                    SSL_shutdown(ssl);
+                    SSL_free(ssl);
+                    close(connection);
+                }).detach();
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t url_count = 3000;
+    size_t host_count = 3;
+    std::chrono::milliseconds delay(2);
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--hosts") == 0 && i + 1 < argc)
+            host_count = std::min<size_t>(std::stoul(argv[++i]), MAX_HOSTS);
+        else if (strcmp(argv[i], "--delay") == 0 && i + 1 < argc)
+            delay = std::chrono::milliseconds(std::stoul(argv[++i]));
+        else
+            url_count = std::stoul(argv[i]);
+    }
+
+    try
+    {
+        void* shared = mmap(nullptr, sizeof(connection_counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (shared == MAP_FAILED)
+        {
+            throw ssl_socket_exception("Unable to map shared counters");
+        }
+        connection_counters* counters = new (shared) connection_counters();
+
+        std::vector<std::string> ports;
+        std::vector<std::unique_ptr<bench::child_process>> servers;
+        for (size_t host = 0; host < host_count; ++host)
+        {
+            int listener = bench::listen_on_loopback();
+            ports.push_back(bench::bound_port(listener));
+            servers.emplace_back(new bench::child_process([=]() { run_server(listener, host, counters, delay); }));
+            close(listener);
+        }
+
+        // The kernel completes the TCP handshake for connections nobody accepts
+        int silent = bench::listen_on_loopback();
+
+        // Interleave hosts the way a real list would, plus URLs that can't be fetched
+        std::vector<std::string> urls;
+        for (size_t item = 0; item < url_count; ++item)
+        {
+            if (item == url_count / 2)
+                urls.push_back("https://127.0.0.1:" + bench::bound_port(silent) + "/silent");
+            urls.push_back("https://127.0.0.1:" + ports[(item * 7 + item / 3) % host_count] + "/item/" + std::to_string(item));
+        }
+        urls.push_back("ftp://127.0.0.1/unsupported");
+
+        const limits runs[] = {{1, 1}, {4, 1}, {8, 2}, {32, 4}, {64, 16}};
+        std::cout << "connections\tper_host\turls/s\tin_order\tpeak_per_host\n";
+        for (const limits & run : runs)
+        {
+            for (size_t host = 0; host < host_count; ++host)
+                counters->peak[host] = 0;
+
+            size_t next = 0;
+            bool in_order = true;
+            batch_fetcher fetcher;
+            fetcher.set_max_connections(run.connections).set_max_per_host(run.per_host).set_verify_peer(false)
+                .set_timeout(SILENT_TIMEOUT);
+            bench::clock::time_point start = bench::clock::now();
+            fetcher.run(urls, [&](const fetch_result & result) {
+                    size_t item = next > url_count / 2 ? next - 1 : next;
+                    bool expected_failure = next == url_count / 2 || next == url_count + 1;
+                    in_order = in_order && result.url == urls[next]
+                        && (expected_failure ? !result.error.empty() : result.status == 200 && result.body == expected_body(item));
+                    ++next;
+                });
+            double seconds = bench::seconds_since(start);
+
+            int peak = 0;
+            for (size_t host = 0; host < host_count; ++host)
+                peak = std::max(peak, counters->peak[host].load());
+            std::cout << run.connections << '\t' << run.per_host << '\t' << url_count / seconds << '\t'
+                      << (in_order && next == urls.size() ? "yes" : "NO") << '\t' << peak << '\n';
+        }
+        close(silent);
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
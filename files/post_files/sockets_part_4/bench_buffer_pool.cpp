@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "bench_common.h"
+#include "buffer_pool.h"
+#include "socket_set.h"
+#include "ssl_socket.h"
+
+/**
+ * Reads from many mostly idle connections with three buffer
+ * strategies. Usage:
+ *
+ *   bench_buffer_pool [count] [--seconds N] [--per-ms N] [--message BYTES]
+ *
+ * count (10000) plain connections are opened to a server that sends
+ * a --message (2048) byte message to --per-ms (20) random connections
+ * every millisecond. Each strategy then reads for --seconds (3) in its
+ * own process: a dedicated vector per connection, a new vector for
+ * every read, or a buffer from buffer_pool given back after each read.
+ * Reports reads per second, heap allocations per read (counted in
+ * operator new), buffer memory held at the end and RSS growth.
+ */
+namespace
+{
+    std::atomic<uint64_t> allocation_count(0);
+}
+
+void* operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* allocation = std::malloc(size != 0 ? size : 1);
+    if (allocation == nullptr)
+        throw std::bad_alloc();
+    return allocation;
+}
+
+void operator delete(void* allocation) noexcept
+{
+    std::free(allocation);
+}
+
+namespace
+{
+    enum class strategy
+    {
+        dedicated,
+        per_read,
+        pooled
+    };
+
+    const char* strategy_name(strategy mode)
+    {
+        switch (mode)
+        {
+          case strategy::dedicated:
+            return "dedicated";
+          case strategy::per_read:
+            return "per_read";
+          default:
+            return "pooled";
+        }
+    }
+
+    /**
+     * Accept every connection and keep sending messages to random ones
+     */
+    void run_sender(int listener, size_t per_tick, size_t message_size)
+    {
+        std::vector<int> connections;
+        std::vector<char> message(message_size, 'm');
+        std::mt19937 random(1);
+        while (true)
+        {
+            for (int client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK); client >= 0; client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK))
+                connections.push_back(client);
+            for (size_t i = 0; i < per_tick && !connections.empty(); ++i)
+                send(connections[random() % connections.size()], message.data(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            usleep(1000);
+        }
+    }
+
+    void measure(socket_set & sockets, strategy mode, double seconds)
+    {
+        std::vector<std::vector<char>> dedicated(mode == strategy::dedicated ? sockets.size() : 0);
+        size_t baseline = bench::resident_set_size();
+        uint64_t allocations = allocation_count.load();
+        uint64_t reads = 0;
+        uint64_t received = 0;
+
+        bench::clock::time_point start = bench::clock::now();
+        while (bench::seconds_since(start) < seconds)
+        {
+            sockets.poll(std::chrono::milliseconds(10));
+            sockets.for_each_ready([&](size_t index, short) {
+                    size_t length = 0;
+                    if (mode == strategy::dedicated)
+                    {
+                        length = sockets[index].read(dedicated[index]);
+                    } else if (mode == strategy::per_read) {
+                        std::vector<char> buffer;
+                        length = sockets[index].read(buffer);
+                    } else {
+                        buffer_pool::buffer buffer;
+                        length = sockets[index].read(buffer);
+                    }
+                    reads += length > 0;
+                    received += length;
+                });
+        }
+        double elapsed = bench::seconds_since(start);
+        allocations = allocation_count.load() - allocations;
+
+        size_t held = 0;
+        for (const std::vector<char> & buffer : dedicated)
+            held += buffer.capacity();
+        for (const buffer_pool::statistics & stats : buffer_pool::get_statistics())
+            held += stats.bytes_reserved;
+
+        std::cout << strategy_name(mode) << '\t'
+                  << reads / elapsed << '\t'
+                  << received / 1048576.0 / elapsed << '\t'
+                  << static_cast<double>(allocations) / std::max<uint64_t>(reads, 1) << '\t'
+                  << held / 1024 << '\t'
+                  << (bench::resident_set_size() - baseline) / 1024 << '\n';
+        if (mode == strategy::pooled)
+        {
+            for (const buffer_pool::statistics & stats : buffer_pool::get_statistics())
+            {
+                std::cout << "  " << stats.buffer_size / 1024 << "KB class: " << stats.in_use << " in use, "
+                          << stats.cached << " cached, " << stats.free << " free, " << stats.slabs << " slabs, "
+                          << stats.acquisitions << " acquisitions\n";
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = 10000;
+    double seconds = 3;
+    size_t per_tick = 20;
+    size_t message_size = 2048;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = std::stod(argv[++i]);
+        else if (strcmp(argv[i], "--per-ms") == 0 && i + 1 < argc)
+            per_tick = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--message") == 0 && i + 1 < argc)
+            message_size = std::stoul(argv[++i]);
+        else
+            count = std::stoul(argv[i]);
+    }
+
+    try
+    {
+        size_t file_limit = bench::raise_file_limit();
+        if (file_limit < count + 64)
+        {
+            std::cerr << "Open file limit of " << file_limit << " is too low for " << count << " connections\n";
+            return 1;
+        }
+
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, per_tick, message_size]() { run_sender(listener, per_tick, message_size); });
+        close(listener);
+
+        socket_set sockets;
+        for (size_t i = 0; i < count; ++i)
+        {
+            ssl_socket s("127.0.0.1", port);
+            s.connect();
+            sockets.add(std::move(s));
+        }
+
+        std::cout << count << " connections, " << per_tick << " messages of " << message_size << " bytes per ms\n";
+        std::cout << "strategy\treads/s\tMB/s\tallocations/read\tbuffers_held_KB\trss_growth_KB\n";
+        for (strategy mode : {strategy::dedicated, strategy::per_read, strategy::pooled})
+        {
+            // Each strategy gets a fresh address space, the connections are shared
+            std::cout.flush();
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                measure(sockets, mode, seconds);
+                std::cout.flush();
+                _exit(0);
+            }
+            waitpid(pid, nullptr, 0);
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <unistd.h>
+#include "bench_common.h"
+#include "cpu_features.h"
+#include "ssl_socket.h"
+
+/**
+ * Measures client side encrypt and decrypt throughput and CPU cost
+ * per negotiated cipher suite over loopback. Usage:
+ *
+ *   bench_ciphers [megabytes]
+ *
+ * The server only allows one suite per connection so every suite is
+ * negotiated in turn. The client first writes the payload (encrypt)
+ * and then reads the same amount back (decrypt). Only the client's CPU
+ * time is counted, the server runs in its own process.
+ */
+namespace
+{
+    struct suite
+    {
+        const char* name;
+        bool tls13;
+    };
+
+    const suite SUITES[] = {
+        {"TLS_AES_128_GCM_SHA256", true},
+        {"TLS_AES_256_GCM_SHA384", true},
+        {"TLS_CHACHA20_POLY1305_SHA256", true},
+        {"ECDHE-ECDSA-AES128-GCM-SHA256", false},
+        {"ECDHE-ECDSA-AES256-GCM-SHA384", false},
+        {"ECDHE-ECDSA-CHACHA20-POLY1305", false},
+    };
+    const size_t BUFFER_SIZE = 64 * 1024;
+
+    double process_cpu_seconds()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+    }
+
+    void run_server(int listener, size_t payload_size)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        std::vector<char> buffer(BUFFER_SIZE, 'x');
+        for (const suite & current : SUITES)
+        {
+            int connection = bench::accept_connection(listener);
+            SSL* ssl = SSL_new(context);
+            if (current.tls13)
+            {
+                SSL_set_ciphersuites(ssl, current.name);
+            } else {
+                SSL_set_max_proto_version(ssl, TLS1_2_VERSION);
+                SSL_set_cipher_list(ssl, current.name);
+            }
+            SSL_set_fd(ssl, connection);
+            if (SSL_accept(ssl) != 1)
+            {
+                throw ssl_socket_exception(std::string("Server handshake failed for ") + current.name);
+            }
+
+            for (size_t received = 0; received < payload_size; )
+            {
+                int read_size = SSL_read(ssl, buffer.data(), buffer.size());
+                if (read_size <= 0)
+                {
+                    throw ssl_socket_exception("Server read failed");
+                }
+                received += read_size;
+            }
+            for (size_t sent = 0; sent < payload_size; )
+            {
+                int write_size = SSL_write(ssl, buffer.data(), std::min(buffer.size(), payload_size - sent));
+                if (write_size <= 0)
+                {
+                    throw ssl_socket_exception("Server write failed");
+                }
+                sent += write_size;
+            }
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+            close(connection);
+        }
+        SSL_CTX_free(context);
+    }
+
+    void report(const char* direction, size_t bytes, double wall_seconds, double cpu_seconds)
+    {
+        double gigabytes = bytes / (1024.0 * 1024 * 1024);
+        std::cout << '\t' << direction << ' ' << bytes / wall_seconds / (1024 * 1024) << " MB/s, "
+                  << cpu_seconds / gigabytes << " CPU s/GB\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t payload_size = (argc > 1 ? std::stoul(argv[1]) : 256) * 1024 * 1024;
+
+    const cpu_features & features = cpu_features::get();
+    std::cout << "aes " << features.aes << ", pclmul " << features.pclmul << ", avx2 " << features.avx2
+              << ", automatic policy prefers " << (features.fast_aes_gcm() ? "AES-GCM" : "ChaCha20-Poly1305") << '\n';
+
+    try
+    {
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, payload_size]() { run_server(listener, payload_size); });
+        close(listener);
+
+        std::vector<uint8_t> payload(payload_size, 'x');
+        std::vector<char> buffer(BUFFER_SIZE);
+        for (size_t i = 0; i < sizeof(SUITES) / sizeof(SUITES[0]); ++i)
+        {
+            ssl_socket s("127.0.0.1", port);
+            s.set_cipher_policy(cipher_policy::openssl_default).set_verify_peer(false).connect().make_secure();
+            std::cout << s.get_cipher() << '\n';
+
+            bench::clock::time_point start = bench::clock::now();
+            double cpu_start = process_cpu_seconds();
+            s.write(payload.data(), payload.size());
+            report("encrypt", payload_size, bench::seconds_since(start), process_cpu_seconds() - cpu_start);
+
+            start = bench::clock::now();
+            cpu_start = process_cpu_seconds();
+            for (size_t received = 0; received < payload_size && s.is_connected(); )
+            {
+                size_t length = s.read(buffer.data(), buffer.size());
+                if (length == 0)
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                received += length;
+            }
+            report("decrypt", payload_size, bench::seconds_since(start), process_cpu_seconds() - cpu_start);
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
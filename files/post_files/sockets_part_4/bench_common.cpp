@@ -0,0 +1,498 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "bench_common.h"
+#include "ssl_socket.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+double bench::seconds_since(clock::time_point start)
+{
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+size_t bench::resident_set_size()
+{
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status == nullptr)
+        return 0;
+
+    char line[256];
+    size_t kilobytes = 0;
+    while (fgets(line, sizeof(line), status) != nullptr)
+    {
+        if (strncmp(line, "VmRSS:", 6) == 0)
+        {
+            kilobytes = strtoull(line + 6, nullptr, 10);
+            break;
+        }
+    }
+    fclose(status);
+    return kilobytes * 1024;
+}
+
+size_t bench::raise_file_limit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return 0;
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    return limit.rlim_cur;
+}
+
+int bench::listen_on_loopback(uint16_t port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0)
+    {
+        throw ssl_socket_exception("Unable to open socket: " + std::string(strerror(errno)));
+    }
+
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0)
+    {
+        std::string error = "Unable to listen: " + std::string(strerror(errno));
+        close(listener);
+        throw ssl_socket_exception(error);
+    }
+    return listener;
+}
+
+int bench::listen_on_unix(const std::string & path)
+{
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        throw ssl_socket_exception("Invalid Unix domain socket address: " + path);
+    }
+    memcpy(address.sun_path, path.data(), path.size());
+    socklen_t address_length = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+    if (path[0] == '@')
+    {
+        address.sun_path[0] = '\0';
+        address_length = offsetof(struct sockaddr_un, sun_path) + path.size();
+    } else {
+        unlink(path.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0)
+    {
+        throw ssl_socket_exception("Unable to open socket: " + std::string(strerror(errno)));
+    }
+    if (bind(listener, (struct sockaddr*)&address, address_length) < 0 || listen(listener, SOMAXCONN) < 0)
+    {
+        std::string error = "Unable to listen: " + std::string(strerror(errno));
+        close(listener);
+        throw ssl_socket_exception(error);
+    }
+    return listener;
+}
+
+int bench::accept_connection(int listener)
+{
+    struct pollfd descriptor = {0};
+    descriptor.fd = listener;
+    descriptor.events = POLLIN;
+    while (true)
+    {
+        int connection = accept4(listener, nullptr, nullptr, 0);
+        if (connection >= 0)
+            return connection;
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            throw ssl_socket_exception("Unable to accept: " + std::string(strerror(errno)));
+        }
+        poll(&descriptor, 1, -1);
+    }
+}
+
+namespace
+{
+    const size_t BULK_BLOCK_SIZE = 64 * 1024;
+
+    /**
+     * The first byte of a TLS handshake record
+     */
+    const unsigned char TLS_HANDSHAKE = 0x16;
+
+    bool read_exactly(const bench::command_stream & stream, char* data, size_t length)
+    {
+        for (size_t received = 0; received < length; )
+        {
+            ssize_t read_size = stream.read(data + received, length - received);
+            if (read_size <= 0)
+                return false;
+            received += read_size;
+        }
+        return true;
+    }
+
+    bool write_all(const bench::command_stream & stream, const char* data, size_t length)
+    {
+        for (size_t sent = 0; sent < length; )
+        {
+            ssize_t write_size = stream.write(data + sent, length - sent);
+            if (write_size <= 0)
+                return false;
+            sent += write_size;
+        }
+        return true;
+    }
+}
+
+void bench::serve_command(const command_stream & stream, size_t message_size)
+{
+    char command;
+    if (!read_exactly(stream, &command, 1))
+        return;
+
+    if (command == ECHO_COMMAND)
+    {
+        std::vector<char> message(message_size);
+        while (read_exactly(stream, message.data(), message_size) && write_all(stream, message.data(), message_size))
+        {
+        }
+    } else if (command == BULK_COMMAND) {
+        uint64_t remaining;
+        if (!read_exactly(stream, reinterpret_cast<char*>(&remaining), sizeof(remaining)))
+            return;
+        std::vector<char> block(BULK_BLOCK_SIZE, 'x');
+        while (remaining > 0)
+        {
+            size_t length = std::min<uint64_t>(remaining, block.size());
+            if (!write_all(stream, block.data(), length))
+                return;
+            remaining -= length;
+        }
+    } else if (command == UPLOAD_COMMAND) {
+        uint64_t remaining;
+        if (!read_exactly(stream, reinterpret_cast<char*>(&remaining), sizeof(remaining)))
+            return;
+        std::vector<char> block(BULK_BLOCK_SIZE);
+        while (remaining > 0)
+        {
+            size_t length = std::min<uint64_t>(remaining, block.size());
+            if (!read_exactly(stream, block.data(), length))
+                return;
+            remaining -= length;
+        }
+        write_all(stream, &command, 1);
+    }
+}
+
+void bench::serve_commands(int connection, SSL_CTX* context, size_t message_size)
+{
+    int no_delay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    unsigned char first = 0;
+    if (recv(connection, &first, 1, MSG_PEEK) == 1 && first == TLS_HANDSHAKE)
+    {
+        SSL* ssl = SSL_new(context);
+        SSL_set_fd(ssl, connection);
+        if (SSL_accept(ssl) == 1)
+        {
+            command_stream stream = {
+                [ssl](char* data, size_t length) -> ssize_t { return SSL_read(ssl, data, length); },
+                [ssl](const char* data, size_t length) -> ssize_t { return SSL_write(ssl, data, length); }
+            };
+            serve_command(stream, message_size);
+            // The bulk client may read past the end, a clean close
+            // keeps OpenSSL from reporting an error
+            SSL_shutdown(ssl);
+        }
+        SSL_free(ssl);
+    } else {
+        command_stream stream = {
+            [connection](char* data, size_t length) { return ::read(connection, data, length); },
+            [connection](const char* data, size_t length) { return ::write(connection, data, length); }
+        };
+        serve_command(stream, message_size);
+    }
+    close(connection);
+}
+
+std::string bench::bound_port(int listener)
+{
+    struct sockaddr_in address = {0};
+    socklen_t length = sizeof(address);
+    getsockname(listener, (struct sockaddr*)&address, &length);
+    return std::to_string(ntohs(address.sin_port));
+}
+
+namespace
+{
+    std::string get_openssl_error()
+    {
+        return std::string(ERR_error_string(ERR_get_error(), nullptr));
+    }
+
+    EVP_PKEY* generate_key()
+    {
+        SSL_load_error_strings();
+        SSL_library_init();
+
+        EVP_PKEY* key = nullptr;
+        EVP_PKEY_CTX* key_context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        if (key_context == nullptr
+            || EVP_PKEY_keygen_init(key_context) <= 0
+            || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_context, NID_X9_62_prime256v1) <= 0
+            || EVP_PKEY_keygen(key_context, &key) <= 0)
+        {
+            EVP_PKEY_CTX_free(key_context);
+            throw ssl_socket_exception("Unable to generate key " + get_openssl_error());
+        }
+        EVP_PKEY_CTX_free(key_context);
+        return key;
+    }
+
+    void add_extension(X509* certificate, X509* issuer, int nid, const char* value)
+    {
+        X509V3_CTX context;
+        X509V3_set_ctx(&context, issuer, certificate, nullptr, nullptr, 0);
+        X509_EXTENSION* extension = X509V3_EXT_conf_nid(nullptr, &context, nid, value);
+        if (extension != nullptr)
+        {
+            X509_add_ext(certificate, extension, -1);
+            X509_EXTENSION_free(extension);
+        }
+    }
+
+    /**
+     * Create a certificate for key with the given common name, signed
+     * by issuer_key. A null issuer makes it self-signed.
+     */
+    X509* make_certificate(EVP_PKEY* key, const char* common_name, X509* issuer, EVP_PKEY* issuer_key, bool authority)
+    {
+        static long serial = 1;
+        X509* certificate = X509_new();
+        X509_set_version(certificate, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(certificate), serial++);
+        X509_gmtime_adj(X509_get_notBefore(certificate), -60);
+        X509_gmtime_adj(X509_get_notAfter(certificate), 60 * 60 * 24);
+        X509_set_pubkey(certificate, key);
+        X509_NAME* name = X509_get_subject_name(certificate);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)common_name, -1, -1, 0);
+        X509_set_issuer_name(certificate, issuer == nullptr ? name : X509_get_subject_name(issuer));
+
+        X509* extension_issuer = issuer == nullptr ? certificate : issuer;
+        if (authority)
+        {
+            add_extension(certificate, extension_issuer, NID_basic_constraints, "critical,CA:TRUE");
+            add_extension(certificate, extension_issuer, NID_key_usage, "critical,keyCertSign,cRLSign");
+        } else {
+            add_extension(certificate, extension_issuer, NID_subject_alt_name, ("DNS:" + std::string(common_name)).c_str());
+        }
+
+        if (X509_sign(certificate, issuer_key == nullptr ? key : issuer_key, EVP_sha256()) == 0)
+        {
+            X509_free(certificate);
+            throw ssl_socket_exception("Unable to sign certificate " + get_openssl_error());
+        }
+        return certificate;
+    }
+
+    SSL_CTX* make_context(X509* certificate, EVP_PKEY* key)
+    {
+        SSL_CTX* context = SSL_CTX_new(SSLv23_server_method());
+        if (context == nullptr
+            || SSL_CTX_use_certificate(context, certificate) != 1
+            || SSL_CTX_use_PrivateKey(context, key) != 1)
+        {
+            SSL_CTX_free(context);
+            throw ssl_socket_exception("Unable to create server context " + get_openssl_error());
+        }
+        return context;
+    }
+}
+
+SSL_CTX* bench::make_server_context()
+{
+    EVP_PKEY* key = generate_key();
+    X509* certificate = make_certificate(key, "localhost", nullptr, nullptr, false);
+    SSL_CTX* context = make_context(certificate, key);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+    return context;
+}
+
+bench::test_authority::test_authority():
+    key(generate_key()),
+    certificate(make_certificate(key, "ssl_socket test CA", nullptr, nullptr, true))
+{
+
+}
+
+bench::test_authority::~test_authority()
+{
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+}
+
+SSL_CTX* bench::test_authority::make_server_context(const std::string & hostname) const
+{
+    EVP_PKEY* leaf_key = generate_key();
+    X509* leaf = make_certificate(leaf_key, hostname.c_str(), certificate, key, false);
+    SSL_CTX* context = make_context(leaf, leaf_key);
+    X509_free(leaf);
+    EVP_PKEY_free(leaf_key);
+    return context;
+}
+
+void bench::test_authority::write_certificate(const std::string & path) const
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr || PEM_write_X509(file, certificate) != 1)
+    {
+        if (file != nullptr)
+            fclose(file);
+        throw ssl_socket_exception("Unable to write " + path + ": " + std::string(strerror(errno)));
+    }
+    fclose(file);
+}
+
+bench::netem_scope::netem_scope(const std::string & arguments):
+    applied(false)
+{
+    if (arguments.empty())
+        return;
+
+    std::string command = "tc qdisc replace dev lo root netem " + arguments;
+    if (system(command.c_str()) != 0)
+    {
+        throw ssl_socket_exception("Unable to apply netem (needs root and sch_netem): " + command);
+    }
+    applied = true;
+}
+
+bench::netem_scope::~netem_scope()
+{
+    if (applied && system("tc qdisc del dev lo root") != 0)
+    {
+        fprintf(stderr, "Unable to remove netem from lo\n");
+    }
+}
+
+bench::child_process::child_process(const std::function<void()> & body):
+    pid(fork())
+{
+    if (pid < 0)
+    {
+        throw ssl_socket_exception("Unable to fork: " + std::string(strerror(errno)));
+    }
+    if (pid == 0)
+    {
+        // Clients hang up mid-write all the time, that's not a reason for the server to die
+        signal(SIGPIPE, SIG_IGN);
+        try
+        {
+            body();
+        } catch (const ssl_socket_exception & e) {
+            fprintf(stderr, "%s\n", e.to_string().c_str());
+            _exit(1);
+        }
+        _exit(0);
+    }
+}
+
+bench::child_process::~child_process()
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+void bench::serve_idle(const std::vector<int> & listeners)
+{
+    SSL_CTX* context = make_server_context();
+    int poller = epoll_create1(0);
+    for (int listener : listeners)
+    {
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.fd = listener;
+        epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+    }
+
+    std::vector<struct epoll_event> events(1024);
+    std::vector<SSL*> connections;
+    char discard[1024];
+    while (true)
+    {
+        int ready = epoll_wait(poller, events.data(), events.size(), -1);
+        for (int i = 0; i < ready; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd < (int)connections.size() && connections[fd] != nullptr)
+            {
+                SSL* ssl = connections[fd];
+                int result = SSL_is_init_finished(ssl) ? SSL_read(ssl, discard, sizeof(discard)) : SSL_do_handshake(ssl);
+                int error = result > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl, result);
+                if (error != SSL_ERROR_NONE && error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+                {
+                    SSL_free(ssl);
+                    close(fd);
+                    connections[fd] = nullptr;
+                }
+                continue;
+            }
+
+            for (int client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK); client >= 0; client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK))
+            {
+                if (client >= (int)connections.size())
+                    connections.resize(client + 1, nullptr);
+                SSL* ssl = SSL_new(context);
+                SSL_set_fd(ssl, client);
+                SSL_set_accept_state(ssl);
+                connections[client] = ssl;
+
+                struct epoll_event event = {0};
+                event.events = EPOLLIN;
+                event.data.fd = client;
+                epoll_ctl(poller, EPOLL_CTL_ADD, client, &event);
+            }
+        }
+    }
+}
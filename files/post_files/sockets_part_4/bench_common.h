@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <chrono>
+#include <cinttypes>
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+/**
+ * Helpers shared by the benchmark programs. Every benchmark runs
+ * against a server on the loopback interface so results don't depend
+ * on fizz.buzz or the network in between.
+ */
+namespace bench
+{
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     * Seconds elapsed since start
+     */
+    double seconds_since(clock::time_point start);
+
+    /**
+     * Resident set size of the current process in bytes, as reported
+     * by /proc/self/status
+     */
+    size_t resident_set_size();
+
+    /**
+     * Raise the open file limit to the hard limit so benchmarks can
+     * hold many connections open
+     *
+     * @return the new soft limit
+     */
+    size_t raise_file_limit();
+
+    /**
+     * Open a non-blocking listening TCP socket on 127.0.0.1
+     *
+     * @param port the port to listen on, 0 picks any free port
+     *
+     * @return the listening file descriptor
+     * @throw ssl_socket_exception if the socket can not be opened
+     */
+    int listen_on_loopback(uint16_t port = 0);
+
+    /**
+     * Open a non-blocking listening Unix domain stream socket. Any
+     * stale socket file at the path is removed first.
+     *
+     * @param path the socket path, or a name in the abstract namespace
+     * if it starts with '@'
+     *
+     * @return the listening file descriptor
+     * @throw ssl_socket_exception if the socket can not be opened
+     */
+    int listen_on_unix(const std::string & path);
+
+    /**
+     * Wait for and accept a connection on a non-blocking listener
+     *
+     * @return a blocking file descriptor for the new connection
+     * @throw ssl_socket_exception if accept fails
+     */
+    int accept_connection(int listener);
+
+    /**
+     * First bytes of the requests serve_commands understands: 'e' is
+     * followed by messages to echo back, 'b' by a native 8 byte count
+     * of bytes for the server to send before it hangs up, 'u' by a
+     * count and then that many bytes for the server to read, which it
+     * acknowledges with a single 'u'
+     */
+    const char ECHO_COMMAND = 'e';
+    const char BULK_COMMAND = 'b';
+    const char UPLOAD_COMMAND = 'u';
+
+    /**
+     * The two halves of an established connection, returning what
+     * read(2) and write(2) would
+     */
+    struct command_stream
+    {
+        std::function<ssize_t(char*, size_t)> read;
+        std::function<ssize_t(const char*, size_t)> write;
+    };
+
+    /**
+     * Serve one request (see ECHO_COMMAND) on an established stream
+     *
+     * @param message_size the size of each echoed message
+     */
+    void serve_command(const command_stream & stream, size_t message_size);
+
+    /**
+     * Serve one request with serve_command on an accepted connection, then
+     * close it. Connections starting with a TLS handshake are served
+     * over TLS with context, others in plain text.
+     *
+     * @param message_size the size of each echoed message
+     */
+    void serve_commands(int connection, SSL_CTX* context, size_t message_size);
+
+    /**
+     * Accept TLS connections on every listener, complete the
+     * handshake and then leave them idle until we are killed
+     */
+    void serve_idle(const std::vector<int> & listeners);
+
+    /**
+     * Get the port a listening socket is bound to, as the string
+     * ssl_socket expects
+     */
+    std::string bound_port(int listener);
+
+    /**
+     * Create a server side SSL context with a freshly generated
+     * self-signed certificate for "localhost". Clients have to skip
+     * verification to connect to it.
+     *
+     * @throw ssl_socket_exception if key or certificate generation fails
+     */
+    SSL_CTX* make_server_context();
+
+    /**
+     * A throwaway certificate authority for benchmarks that verify
+     * the server. Create it before forking the server so both sides
+     * share the same CA.
+     */
+    class test_authority
+    {
+      public:
+        /**
+         * @throw ssl_socket_exception if key or certificate generation fails
+         */
+        test_authority();
+        ~test_authority();
+        test_authority(test_authority const&) = delete;
+        test_authority& operator=(test_authority const&) = delete;
+
+        /**
+         * Create a server side SSL context with a certificate for
+         * hostname issued by this authority
+         *
+         * @throw ssl_socket_exception if key or certificate generation fails
+         */
+        SSL_CTX* make_server_context(const std::string & hostname = "localhost") const;
+
+        /**
+         * Write the authority's certificate as PEM, for
+         * certificate_verifier::use_ca_file
+         *
+         * @throw ssl_socket_exception if the file can not be written
+         */
+        void write_certificate(const std::string & path) const;
+
+      private:
+        EVP_PKEY* key;
+        X509* certificate;
+    };
+
+    /**
+     * Emulate a slower link on the loopback interface with tc netem
+     * for as long as this object lives. Requires root, an empty
+     * netem argument string leaves the interface alone.
+     */
+    class netem_scope
+    {
+      public:
+        /**
+         * @param arguments netem options (ex: "delay 25ms loss 0.1%")
+         */
+        explicit netem_scope(const std::string & arguments);
+        ~netem_scope();
+        netem_scope(netem_scope const&) = delete;
+        netem_scope& operator=(netem_scope const&) = delete;
+
+      private:
+        bool applied;
+    };
+
+    /**
+     * A forked child process which is terminated when this object is
+     * destroyed. Running servers in a child keeps their memory and
+     * CPU time out of the client's measurements.
+     */
+    class child_process
+    {
+      public:
+        /**
+         * Fork and run body in the child, the child exits when body
+         * returns
+         */
+        explicit child_process(const std::function<void()> & body);
+        ~child_process();
+        child_process(child_process const&) = delete;
+        child_process& operator=(child_process const&) = delete;
+
+        pid_t get_pid() const { return pid; }
+
+      private:
+        pid_t pid;
+    };
+}
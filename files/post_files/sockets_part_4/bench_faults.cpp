@@ -0,0 +1,371 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "bench_common.h"
+#include "fault_injection.h"
+#include "ssl_socket.h"
+
+/**
+ * Runs ssl_socket against a server that injects one kind of fault at
+ * a time, in plain text and over TLS. Usage:
+ *
+ *   bench_faults [round trips] [--bulk MEGABYTES] [--only SCENARIO]
+ *                [--fault NAME SCRIPT [--expect-failure PHASE]]
+ *
+ * Every scenario times connect and make_secure, echoes small messages
+ * (p50 in microseconds), downloads and uploads in bulk (MB/s). Around
+ * that it counts the reads that came back empty, the time spent
+ * waiting in wait_readable and the client CPU time, which together
+ * show whether a fault makes the client stall or spin. --fault adds a
+ * scenario of your own, see fault_plan for the script.
+ *
+ * Each scenario names the phase it expects to fail, if any, and every
+ * phase gives up at a deadline instead of hanging. The exit status is
+ * 1 if any phase failed or passed unexpectedly, so a fault the client
+ * newly mishandles is caught. --expect-failure sets the failing phase
+ * of the --fault before it.
+ */
+namespace
+{
+    const size_t MESSAGE_SIZE = 64;
+    const size_t UPLOAD_BLOCK_SIZE = 64 * 1024;
+    const std::chrono::seconds PHASE_TIMEOUT(30);
+
+    struct scenario
+    {
+        std::string name;
+        std::string script;
+        std::string failing_phase; ///< The phase the fault must break, empty if none
+    };
+
+    std::vector<scenario> default_scenarios()
+    {
+        return {
+            {"baseline", "", ""},
+            {"partial_writes", "write_chunk=1399", ""},
+            {"one_byte_reads", "read_chunk=1", ""},
+            {"eagain_storm", "write_chunk=64,write_gap_us=20", ""},
+            {"slow_handshake", "handshake_chunk=16,handshake_gap_us=1000,record_size=512", ""},
+            {"delayed_accept", "accept_delay_ms=200", ""},
+            {"reset_mid_stream", "reset_after=1048576", "download"},
+            {"tiny_window", "receive_window=4096,read_gap_us=100", ""}
+        };
+    }
+
+    /**
+     * What the client went through across every phase of a scenario
+     */
+    struct client_counters
+    {
+        size_t empty_reads;
+        double stall_seconds;
+    };
+
+    double cpu_seconds()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    /**
+     * Wait briefly for the socket to be ready for events
+     *
+     * @throw ssl_socket_exception if the phase ran past its deadline
+     */
+    void wait_for(ssl_socket & s, short events, bench::clock::time_point deadline)
+    {
+        if (bench::clock::now() > deadline)
+            throw ssl_socket_exception("Timed out");
+        struct pollfd descriptor = {0};
+        descriptor.fd = s.get_descriptor();
+        descriptor.events = events;
+        poll(&descriptor, 1, 100);
+    }
+
+    /**
+     * Write all of data, the way write does but giving up at the
+     * deadline
+     *
+     * @throw ssl_socket_exception if the server hangs up or the phase
+     * runs past its deadline
+     */
+    void write_all(ssl_socket & s, const void* data, size_t length, bench::clock::time_point deadline)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t written = 0; written < length; )
+        {
+            size_t sent = s.write_some(bytes + written, length - written);
+            written += sent;
+            if (sent > 0)
+                continue;
+            if (!s.is_connected())
+                throw ssl_socket_exception("Server hung up");
+            wait_for(s, POLLOUT, deadline);
+        }
+    }
+
+    /**
+     * Read up to length bytes, waiting for them if nothing is there
+     *
+     * @throw ssl_socket_exception if the server hangs up or the phase
+     * runs past its deadline
+     */
+    size_t read_some(ssl_socket & s, char* data, size_t length, client_counters & counters, bench::clock::time_point deadline)
+    {
+        while (true)
+        {
+            size_t read_size = s.read(data, length);
+            if (read_size > 0)
+                return read_size;
+            if (!s.is_connected())
+                throw ssl_socket_exception("Server hung up");
+            if (bench::clock::now() > deadline)
+                throw ssl_socket_exception("Timed out");
+
+            ++counters.empty_reads;
+            bench::clock::time_point start = bench::clock::now();
+            s.wait_readable(std::chrono::seconds(1));
+            counters.stall_seconds += bench::seconds_since(start);
+        }
+    }
+
+    void read_exactly(ssl_socket & s, char* data, size_t length, client_counters & counters, bench::clock::time_point deadline)
+    {
+        for (size_t received = 0; received < length; )
+        {
+            received += read_some(s, data + received, length - received, counters, deadline);
+        }
+    }
+
+    /**
+     * The results of one scenario, negative where a phase never ran
+     */
+    struct scenario_result
+    {
+        double connect_ms;
+        double secure_ms;
+        double echo_p50_us;
+        double download_rate;
+        double upload_rate;
+        client_counters counters;
+        double cpu_ms;
+        std::string failed_phase; ///< The phases that failed, comma separated
+        std::string outcome;
+    };
+
+    void open_socket(ssl_socket & s, bool secure, scenario_result & result, bench::clock::time_point deadline)
+    {
+        bench::clock::time_point start = bench::clock::now();
+        s.set_verify_peer(false).start_connect();
+        while (!s.continue_connect())
+            wait_for(s, POLLOUT, deadline);
+        if (result.connect_ms < 0)
+            result.connect_ms = bench::seconds_since(start) * 1e3;
+        if (secure)
+        {
+            start = bench::clock::now();
+            s.start_secure();
+            while (!s.continue_secure())
+                wait_for(s, s.get_handshake_events(), deadline);
+            if (result.secure_ms < 0)
+                result.secure_ms = bench::seconds_since(start) * 1e3;
+        }
+    }
+
+    void measure_echo(const std::string & port, bool secure, size_t round_trips, scenario_result & result)
+    {
+        bench::clock::time_point deadline = bench::clock::now() + PHASE_TIMEOUT;
+        ssl_socket s("127.0.0.1", port);
+        open_socket(s, secure, result, deadline);
+        write_all(s, &bench::ECHO_COMMAND, 1, deadline);
+
+        std::vector<char> request(MESSAGE_SIZE, 'r');
+        std::vector<char> response(MESSAGE_SIZE);
+        std::vector<double> latencies;
+        for (size_t i = 0; i < round_trips; ++i)
+        {
+            bench::clock::time_point start = bench::clock::now();
+            write_all(s, request.data(), request.size(), deadline);
+            read_exactly(s, response.data(), response.size(), result.counters, deadline);
+            latencies.push_back(bench::seconds_since(start) * 1e6);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        result.echo_p50_us = latencies[latencies.size() / 2];
+    }
+
+    void measure_download(const std::string & port, bool secure, uint64_t bulk_size, scenario_result & result)
+    {
+        bench::clock::time_point deadline = bench::clock::now() + PHASE_TIMEOUT;
+        ssl_socket s("127.0.0.1", port);
+        open_socket(s, secure, result, deadline);
+
+        std::string command(1, bench::BULK_COMMAND);
+        command.append(reinterpret_cast<const char*>(&bulk_size), sizeof(bulk_size));
+        bench::clock::time_point start = bench::clock::now();
+        write_all(s, command.data(), command.size(), deadline);
+
+        std::vector<char> buffer(UPLOAD_BLOCK_SIZE);
+        for (uint64_t received = 0; received < bulk_size; )
+        {
+            received += read_some(s, buffer.data(), buffer.size(), result.counters, deadline);
+        }
+        result.download_rate = bulk_size / 1048576.0 / bench::seconds_since(start);
+    }
+
+    void measure_upload(const std::string & port, bool secure, uint64_t bulk_size, scenario_result & result)
+    {
+        bench::clock::time_point deadline = bench::clock::now() + PHASE_TIMEOUT;
+        ssl_socket s("127.0.0.1", port);
+        open_socket(s, secure, result, deadline);
+
+        std::string command(1, bench::UPLOAD_COMMAND);
+        command.append(reinterpret_cast<const char*>(&bulk_size), sizeof(bulk_size));
+        std::vector<uint8_t> block(UPLOAD_BLOCK_SIZE, 'u');
+        bench::clock::time_point start = bench::clock::now();
+        write_all(s, command.data(), command.size(), deadline);
+        for (uint64_t remaining = bulk_size; remaining > 0; )
+        {
+            size_t length = std::min<uint64_t>(remaining, block.size());
+            write_all(s, block.data(), length, deadline);
+            remaining -= length;
+        }
+        char acknowledgement;
+        read_exactly(s, &acknowledgement, 1, result.counters, deadline);
+        result.upload_rate = bulk_size / 1048576.0 / bench::seconds_since(start);
+    }
+
+    /**
+     * Run every phase against a fresh server for the scenario. A phase
+     * that fails is noted in the outcome and the rest still run.
+     */
+    scenario_result run_scenario(const bench::fault_plan & plan, bool secure, size_t round_trips, uint64_t bulk_size)
+    {
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, &plan]() {
+                bench::serve_faults(listener, bench::make_server_context(), plan, MESSAGE_SIZE);
+            });
+        close(listener);
+
+        scenario_result result = {-1, -1, -1, -1, -1, {0, 0}, 0, "", ""};
+        double cpu_start = cpu_seconds();
+        std::vector<std::pair<const char*, std::function<void()> > > phases = {
+            {"echo", [&]() { measure_echo(port, secure, round_trips, result); }},
+            {"download", [&]() { measure_download(port, secure, bulk_size, result); }},
+            {"upload", [&]() { measure_upload(port, secure, bulk_size, result); }}
+        };
+        for (auto & phase : phases)
+        {
+            try
+            {
+                phase.second();
+            } catch (const ssl_socket_exception & e) {
+                result.failed_phase += std::string(result.failed_phase.empty() ? "" : ",") + phase.first;
+                result.outcome += std::string(result.outcome.empty() ? "" : "; ") + phase.first + ": " + e.to_string();
+            }
+        }
+        result.cpu_ms = (cpu_seconds() - cpu_start) * 1e3;
+        if (result.outcome.empty())
+            result.outcome = "ok";
+        return result;
+    }
+
+    std::string format(double value)
+    {
+        if (value < 0)
+            return "-";
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(value < 10 ? 2 : 1) << value;
+        return out.str();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t round_trips = 200;
+    uint64_t bulk_size = 4 * 1048576ULL;
+    std::string only;
+    std::vector<scenario> scenarios = default_scenarios();
+    size_t default_count = scenarios.size();
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--bulk") == 0 && i + 1 < argc)
+            bulk_size = std::stoull(argv[++i]) * 1048576ULL;
+        else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc)
+            only = argv[++i];
+        else if (strcmp(argv[i], "--fault") == 0 && i + 2 < argc)
+        {
+            scenarios.push_back({argv[i + 1], argv[i + 2], ""});
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--expect-failure") == 0 && i + 1 < argc && scenarios.size() > default_count)
+            scenarios.back().failing_phase = argv[++i];
+        else
+            round_trips = std::stoul(argv[i]);
+    }
+
+    // Reset connections must show up as errors, not kill the client
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t unexpected = 0;
+    try
+    {
+        std::cout << "scenario\ttls\tconnect_ms\tsecure_ms\techo_p50_us\tdown_MB/s\tup_MB/s\tempty_reads\tstall_ms\tcpu_ms\texpected\toutcome\n";
+        for (const scenario & current : scenarios)
+        {
+            if (!only.empty() && current.name != only)
+                continue;
+            bench::fault_plan plan = bench::fault_plan::parse(current.script);
+            for (bool secure : {false, true})
+            {
+                scenario_result result = run_scenario(plan, secure, round_trips, bulk_size);
+                bool expected = result.failed_phase == current.failing_phase;
+                unexpected += expected ? 0 : 1;
+                std::cout << current.name << '\t' << (secure ? "yes" : "no") << '\t'
+                          << format(result.connect_ms) << '\t'
+                          << format(result.secure_ms) << '\t'
+                          << format(result.echo_p50_us) << '\t'
+                          << format(result.download_rate) << '\t'
+                          << format(result.upload_rate) << '\t'
+                          << result.counters.empty_reads << '\t'
+                          << format(result.counters.stall_seconds * 1e3) << '\t'
+                          << format(result.cpu_ms) << '\t'
+                          << (expected ? "yes" : "NO") << '\t'
+                          << result.outcome << std::endl;
+            }
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    if (unexpected > 0)
+    {
+        std::cerr << unexpected << " run(s) did not end as their scenario expects\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "bench_common.h"
+#include "http_response_decoder.h"
+#include "ssl_socket.h"
+#include "threaded_sink.h"
+
+/**
+ * Measures end to end throughput of downloading a gzipped log over
+ * TLS and decompressing it. Usage:
+ *
+ *   bench_gzip [megabytes] [--repeat N]
+ *
+ * Each mode is timed from sending the request until the last
+ * decompressed byte has been written to /dev/null:
+ *
+ *   inline     decompress on the thread reading the socket
+ *   pipelined  decompress on a second thread while reading continues
+ *   zcat       pipe the compressed body through zcat, as main did before
+ *
+ * Throughput is reported in megabytes of decompressed output.
+ */
+namespace
+{
+    const size_t BUFFER_SIZE = 16 * 1024;
+
+    /**
+     * Something that compresses like a real access log: repetitive
+     * structure with a few varying fields per line
+     */
+    std::string make_log(size_t size)
+    {
+        static const char* const PATHS[] = {"/", "/index.html", "/posts/sockets_part_4", "/static/style.css", "/favicon.ico"};
+        static const char* const AGENTS[] = {"Mozilla/5.0 (X11; Linux x86_64)", "curl/7.38.0", "Wget/1.16"};
+        std::string log;
+        log.reserve(size + 256);
+        char line[256];
+        for (uint32_t i = 0; log.size() < size; ++i)
+        {
+            uint32_t mix = i * 2654435761u;
+            int length = snprintf(line, sizeof(line),
+                                  "10.%u.%u.%u - - [21/Dec/2014:%02u:%02u:%02u +0000] \"GET %s HTTP/1.1\" %u %u \"-\" \"%s\"\n",
+                                  (mix >> 8) & 0xff, (mix >> 16) & 0xff, mix >> 24,
+                                  (i / 3600) % 24, (i / 60) % 60, i % 60,
+                                  PATHS[mix % 5], mix % 7 == 0 ? 404 : 200, 200 + mix % 50000,
+                                  AGENTS[(mix >> 4) % 3]);
+            log.append(line, length);
+        }
+        log.resize(size);
+        return log;
+    }
+
+    std::string gzip(const std::string & data)
+    {
+        z_stream stream = z_stream();
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            throw ssl_socket_exception("Unable to initialize zlib");
+        }
+        std::string compressed(deflateBound(&stream, data.size()), '\0');
+        stream.next_in = (Bytef*)data.data();
+        stream.avail_in = data.size();
+        stream.next_out = (Bytef*)&compressed[0];
+        stream.avail_out = compressed.size();
+        if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+        {
+            throw ssl_socket_exception("Unable to compress the test log");
+        }
+        compressed.resize(stream.total_out);
+        deflateEnd(&stream);
+        return compressed;
+    }
+
+    void run_server(int listener, const std::string & body, size_t requests)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        std::string response = "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Encoding: gzip\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        char request[4096];
+        for (size_t i = 0; i < requests; ++i)
+        {
+            int connection = bench::accept_connection(listener);
+            SSL* ssl = SSL_new(context);
+            SSL_set_fd(ssl, connection);
+            if (SSL_accept(ssl) == 1 && SSL_read(ssl, request, sizeof(request)) > 0)
+            {
+                for (size_t sent = 0; sent < response.size(); )
+                {
+                    int written = SSL_write(ssl, response.data() + sent, response.size() - sent);
+                    if (written <= 0)
+                        break;
+                    sent += written;
+                }
+                SSL_shutdown(ssl);
+            }
+            SSL_free(ssl);
+            close(connection);
+        }
+        SSL_CTX_free(context);
+    }
+
+    /**
+     * Request the log and pass every block read to consume until the
+     * framing decoder sees the end of the response
+     */
+    double fetch(const std::string & port, const std::function<void(const char*, size_t)> & consume)
+    {
+        ssl_socket s("127.0.0.1", port);
+        s.set_verify_peer(false).connect().make_secure();
+        http_response_decoder framing([](const char*, size_t) {}, false);
+        char buffer[BUFFER_SIZE];
+
+        bench::clock::time_point start = bench::clock::now();
+        s.write("GET /access.log HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: gzip\r\n\r\n");
+        while (s.is_connected() && !framing.is_complete())
+        {
+            size_t length = s.read(buffer, BUFFER_SIZE);
+            if (length == 0)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            framing.feed(buffer, length);
+            consume(buffer, length);
+        }
+        return bench::seconds_since(start);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = 64;
+    size_t repeat = 3;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--repeat" && i + 1 < argc)
+            repeat = std::stoul(argv[++i]);
+        else
+            megabytes = std::stoul(argv[i]);
+    }
+
+    try
+    {
+        std::string log = make_log(megabytes * 1024 * 1024);
+        std::string compressed = gzip(log);
+        std::cerr << "log " << log.size() << " bytes, gzipped " << compressed.size() << " bytes\n";
+
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, &compressed, repeat]() { run_server(listener, compressed, repeat * 3); });
+        close(listener);
+
+        int null_fd = open("/dev/null", O_WRONLY);
+        auto write_null = [null_fd](const char* data, size_t length) {
+            if (::write(null_fd, data, length) < 0)
+                throw ssl_socket_exception("Unable to write to /dev/null");
+        };
+
+        std::cout << "mode\tMB/s\n";
+        double seconds = 0;
+        for (size_t i = 0; i < repeat; ++i)
+        {
+            http_response_decoder decoder(write_null);
+            seconds += fetch(port, [&decoder](const char* data, size_t length) { decoder.feed(data, length); });
+        }
+        std::cout << "inline\t" << megabytes * repeat / seconds << '\n';
+
+        seconds = 0;
+        for (size_t i = 0; i < repeat; ++i)
+        {
+            http_response_decoder decoder(write_null);
+            threaded_sink pipeline([&decoder](const char* data, size_t length) { decoder.feed(data, length); });
+            bench::clock::time_point start = bench::clock::now();
+            fetch(port, [&pipeline](const char* data, size_t length) { pipeline.write(data, length); });
+            pipeline.finish();
+            seconds += bench::seconds_since(start);
+        }
+        std::cout << "pipelined\t" << megabytes * repeat / seconds << '\n';
+
+        seconds = 0;
+        for (size_t i = 0; i < repeat; ++i)
+        {
+            FILE* zcat = popen("zcat > /dev/null", "w");
+            if (zcat == nullptr)
+            {
+                throw ssl_socket_exception("Unable to start zcat");
+            }
+            http_response_decoder decoder([zcat](const char* data, size_t length) { fwrite(data, 1, length, zcat); }, false);
+            bench::clock::time_point start = bench::clock::now();
+            fetch(port, [&decoder](const char* data, size_t length) { decoder.feed(data, length); });
+            if (pclose(zcat) != 0)
+            {
+                throw ssl_socket_exception("zcat failed");
+            }
+            seconds += bench::seconds_since(start);
+        }
+        std::cout << "zcat\t" << megabytes * repeat / seconds << '\n';
+        close(null_fd);
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,360 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "certificate_verifier.h"
+#include "handshake_pool.h"
+#include "ssl_socket.h"
+
+/**
+ * Measures how a reconnect storm disturbs established connections
+ * served by the same single threaded event loop. Usage:
+ *
+ *   bench_handshakes [handshakes] [--concurrent N] [--echo N]
+ *                    [--interval MICROSECONDS] [--threads N]
+ *
+ * --echo connections (16) each send a small message every --interval
+ * (2000us) and time the reply. Meanwhile the loop runs the given number
+ * of verified handshakes (1000), --concurrent (64) at a time, either
+ * inline on the loop thread or on a handshake_pool with --threads
+ * workers (one per CPU). The idle row runs the echo traffic alone for
+ * as long as the inline storm took. Reported are the reply latency
+ * percentiles in microseconds and the longest and total time the loop
+ * itself spent inside start_secure and continue_secure.
+ */
+namespace
+{
+    const size_t MESSAGE_SIZE = 64;
+
+    /**
+     * An established connection sending paced messages
+     */
+    struct echo_connection
+    {
+        ssl_socket socket;
+        bench::clock::time_point sent;
+        bench::clock::time_point next_send;
+        size_t received;
+        bool waiting;
+    };
+
+    void run_server(int listener, const bench::test_authority & authority)
+    {
+        SSL_CTX* context = authority.make_server_context("localhost");
+        while (true)
+        {
+            int connection = bench::accept_connection(listener);
+            std::thread([connection, context]() {
+                    bench::serve_commands(connection, context, MESSAGE_SIZE);
+                }).detach();
+        }
+    }
+
+    double percentile(const std::vector<double> & sorted, double fraction)
+    {
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        return sorted[index];
+    }
+
+    struct storm_result
+    {
+        double seconds;
+        std::vector<double> latencies;
+        double longest_step_us;
+        double step_ms;
+        size_t failures;
+    };
+
+    class storm
+    {
+      public:
+        storm(const std::string & _port, handshake_pool* _pool, size_t _total, size_t _concurrent):
+            port(_port),
+            pool(_pool),
+            total(_total),
+            concurrent(_concurrent),
+            started(0),
+            finished(0),
+            failures(0),
+            longest_step(0),
+            step_time(0)
+        {}
+
+        bool is_done() const { return finished == total; }
+
+        /**
+         * Open connections until concurrent handshakes are under way
+         */
+        void fill()
+        {
+            while (started < total && active.size() < concurrent)
+            {
+                ++started;
+                ssl_socket s("127.0.0.1", port);
+                s.set_verify_peer(true).set_server_name("localhost").set_handshake_pool(pool).connect();
+                timed([&s]() { s.start_secure(); });
+                active.push_back(std::move(s));
+            }
+        }
+
+        void add_descriptors(std::vector<struct pollfd> & descriptors) const
+        {
+            for (const ssl_socket & s : active)
+            {
+                struct pollfd descriptor = {s.get_descriptor(), s.get_handshake_events(), 0};
+                descriptors.push_back(descriptor);
+            }
+        }
+
+        /**
+         * Move every handshake along whose socket or pool step is ready,
+         * descriptors starts with the ones add_descriptors put there
+         */
+        void advance(const struct pollfd* descriptors)
+        {
+            for (size_t i = active.size(); i-- > 0; )
+            {
+                ssl_socket & s = active[i];
+                if (s.get_handshake_events() != 0 && descriptors[i].revents == 0)
+                    continue;
+                bool done = false;
+                try
+                {
+                    timed([&s, &done]() { done = s.continue_secure(); });
+                } catch (const ssl_socket_exception & e) {
+                    if (failures++ == 0)
+                        std::cerr << e.to_string() << '\n';
+                    done = true;
+                }
+                if (done)
+                {
+                    ++finished;
+                    std::swap(active[i], active.back());
+                    active.pop_back();
+                }
+            }
+        }
+
+        size_t get_failures() const { return failures; }
+        double get_longest_step() const { return longest_step; }
+        double get_step_time() const { return step_time; }
+
+      private:
+        template <typename body_type>
+        void timed(const body_type & body)
+        {
+            bench::clock::time_point start = bench::clock::now();
+            body();
+            double elapsed = bench::seconds_since(start);
+            longest_step = std::max(longest_step, elapsed);
+            step_time += elapsed;
+        }
+
+        std::string port;
+        handshake_pool* pool;
+        size_t total;
+        size_t concurrent;
+        size_t started;
+        size_t finished;
+        size_t failures;
+        double longest_step;
+        double step_time;
+        std::vector<ssl_socket> active;
+    };
+
+    /**
+     * Run the echo traffic until the storm is over, or for duration
+     * if there is no storm
+     */
+    storm_result run_loop(std::vector<echo_connection> & echoes, storm* reconnects, handshake_pool* pool, std::chrono::microseconds interval, double duration)
+    {
+        std::vector<char> request(MESSAGE_SIZE, 'r');
+        std::vector<char> response(MESSAGE_SIZE);
+        std::vector<double> latencies;
+        std::vector<struct pollfd> descriptors;
+        bench::clock::time_point start = bench::clock::now();
+        for (echo_connection & echo : echoes)
+        {
+            echo.next_send = start;
+            echo.waiting = false;
+        }
+
+        while (reconnects != nullptr ? !reconnects->is_done() : bench::seconds_since(start) < duration)
+        {
+            bench::clock::time_point now = bench::clock::now();
+            bench::clock::time_point wake = now + std::chrono::milliseconds(100);
+            for (echo_connection & echo : echoes)
+            {
+                if (!echo.waiting && echo.next_send <= now)
+                {
+                    echo.sent = now;
+                    echo.received = 0;
+                    echo.waiting = true;
+                    echo.socket.write(reinterpret_cast<uint8_t*>(request.data()), request.size());
+                }
+                if (!echo.waiting)
+                    wake = std::min(wake, echo.next_send);
+            }
+
+            descriptors.clear();
+            if (reconnects != nullptr)
+            {
+                reconnects->fill();
+                reconnects->add_descriptors(descriptors);
+            }
+            size_t echo_start = descriptors.size();
+            for (echo_connection & echo : echoes)
+            {
+                struct pollfd descriptor = {echo.socket.get_descriptor(), static_cast<short>(echo.waiting ? POLLIN : 0), 0};
+                descriptors.push_back(descriptor);
+            }
+            if (pool != nullptr)
+            {
+                struct pollfd descriptor = {pool->get_descriptor(), POLLIN, 0};
+                descriptors.push_back(descriptor);
+            }
+
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now + std::chrono::microseconds(999));
+            poll(descriptors.data(), descriptors.size(), std::max<long>(0, timeout.count()));
+            if (pool != nullptr)
+                pool->clear_notifications();
+
+            for (size_t i = 0; i < echoes.size(); ++i)
+            {
+                echo_connection & echo = echoes[i];
+                if (!echo.waiting || descriptors[echo_start + i].revents == 0)
+                    continue;
+                echo.received += echo.socket.read(response.data(), MESSAGE_SIZE - echo.received);
+                if (echo.received == MESSAGE_SIZE)
+                {
+                    bench::clock::time_point now = bench::clock::now();
+                    latencies.push_back(std::chrono::duration<double, std::micro>(now - echo.sent).count());
+                    echo.waiting = false;
+                    echo.next_send = echo.sent + interval;
+                } else if (!echo.socket.is_connected()) {
+                    throw ssl_socket_exception("Echo server hung up");
+                }
+            }
+            if (reconnects != nullptr)
+                reconnects->advance(descriptors.data());
+        }
+
+        storm_result result = {bench::seconds_since(start), latencies, 0, 0, 0};
+        std::sort(result.latencies.begin(), result.latencies.end());
+        if (reconnects != nullptr)
+        {
+            result.longest_step_us = reconnects->get_longest_step() * 1e6;
+            result.step_ms = reconnects->get_step_time() * 1e3;
+            result.failures = reconnects->get_failures();
+        }
+        return result;
+    }
+
+    void report(const std::string & mode, size_t handshakes, const storm_result & result)
+    {
+        std::cout << mode << '\t' << handshakes << '\t'
+                  << result.seconds << '\t'
+                  << handshakes / result.seconds << '\t'
+                  << result.latencies.size() << '\t'
+                  << percentile(result.latencies, 0.5) << '\t'
+                  << percentile(result.latencies, 0.99) << '\t'
+                  << result.latencies.back() << '\t'
+                  << result.longest_step_us << '\t'
+                  << result.step_ms << '\t'
+                  << result.failures << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t handshakes = 1000;
+    size_t concurrent = 64;
+    size_t echo_count = 16;
+    size_t threads = 0;
+    std::chrono::microseconds interval(2000);
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--concurrent") == 0 && i + 1 < argc)
+            concurrent = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--echo") == 0 && i + 1 < argc)
+            echo_count = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+            interval = std::chrono::microseconds(std::stoul(argv[++i]));
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = std::stoul(argv[++i]);
+        else
+            handshakes = std::stoul(argv[i]);
+    }
+
+    // Storm connections are closed while the server may still write
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        bench::raise_file_limit();
+        bench::test_authority authority;
+        char ca_path[] = "/tmp/bench_handshakes_ca_XXXXXX";
+        int ca_file = mkstemp(ca_path);
+        if (ca_file < 0)
+        {
+            throw ssl_socket_exception("Unable to create a temporary file for the CA");
+        }
+        close(ca_file);
+        authority.write_certificate(ca_path);
+        certificate_verifier::use_ca_file(ca_path);
+        // Every handshake verifies the chain in full
+        certificate_verifier::set_cache_lifetime(std::chrono::seconds(0));
+
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, &authority]() { run_server(listener, authority); });
+        close(listener);
+
+        std::vector<echo_connection> echoes;
+        for (size_t i = 0; i < echo_count; ++i)
+        {
+            ssl_socket s("127.0.0.1", port);
+            s.set_server_name("localhost").connect().make_secure().write(std::string(1, bench::ECHO_COMMAND));
+            echoes.push_back({std::move(s), bench::clock::time_point(), bench::clock::time_point(), 0, false});
+        }
+
+        handshake_pool pool(threads);
+        std::cout << "mode\thandshakes\tseconds\thandshakes/s\treplies\tp50_us\tp99_us\tmax_us\tlongest_step_us\tloop_handshake_ms\tfailures\n";
+
+        storm inline_storm(port, nullptr, handshakes, concurrent);
+        storm_result inline_result = run_loop(echoes, &inline_storm, nullptr, interval, 0);
+
+        report("idle", 0, run_loop(echoes, nullptr, nullptr, interval, inline_result.seconds));
+        report("inline", handshakes, inline_result);
+
+        storm pooled_storm(port, &pool, handshakes, concurrent);
+        report("pool/" + std::to_string(pool.get_threads()), handshakes, run_loop(echoes, &pooled_storm, &pool, interval, 0));
+
+        unlink(ca_path);
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include "bench_common.h"
+#include "crypto_pool.h"
+#include "ssl_socket.h"
+
+/**
+ * Measures the resident memory per idle TLS connection. Usage:
+ *
+ *   bench_idle [--no-idle-mode] [--no-pool] [count ...]
+ *
+ * The counts default to 10000 and 100000. Connections are spread
+ * over several listening ports so we don't run out of ephemeral
+ * ports on the loopback interface.
+ */
+namespace
+{
+    const size_t CONNECTIONS_PER_PORT = 25000;
+}
+
+int main(int argc, char** argv)
+{
+    bool idle_mode = true;
+    bool pool = true;
+    std::vector<size_t> checkpoints;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--no-idle-mode") == 0)
+            idle_mode = false;
+        else if (strcmp(argv[i], "--no-pool") == 0)
+            pool = false;
+        else
+            checkpoints.push_back(std::stoul(argv[i]));
+    }
+    if (checkpoints.empty())
+        checkpoints = {10000, 100000};
+
+    // The pool has to go in before anything touches OpenSSL
+    if (pool && !crypto_pool::install())
+    {
+        std::cerr << "Unable to install the OpenSSL memory pool\n";
+        return 1;
+    }
+
+    try
+    {
+        size_t file_limit = bench::raise_file_limit();
+        size_t total = checkpoints.back();
+        if (file_limit < total + 64)
+        {
+            std::cerr << "Open file limit of " << file_limit << " is too low for " << total << " connections\n";
+            return 1;
+        }
+
+        std::vector<int> listeners;
+        std::vector<std::string> ports;
+        for (size_t i = 0; i * CONNECTIONS_PER_PORT < total; ++i)
+        {
+            listeners.push_back(bench::listen_on_loopback());
+            ports.push_back(bench::bound_port(listeners.back()));
+        }
+        bench::child_process server([&listeners]() { bench::serve_idle(listeners); });
+        for (int listener : listeners)
+            close(listener);
+
+        std::cout << "idle mode: " << (idle_mode ? "on" : "off") << ", pool: " << (pool ? "on" : "off") << '\n';
+        std::vector<std::unique_ptr<ssl_socket>> sockets;
+        sockets.reserve(total);
+        size_t baseline = bench::resident_set_size();
+        bench::clock::time_point start = bench::clock::now();
+        for (size_t checkpoint : checkpoints)
+        {
+            while (sockets.size() < checkpoint)
+            {
+                std::unique_ptr<ssl_socket> s(new ssl_socket("127.0.0.1", ports[sockets.size() / CONNECTIONS_PER_PORT]));
+                s->set_idle_mode(idle_mode).set_verify_peer(false).connect().make_secure();
+                sockets.push_back(std::move(s));
+            }
+
+            size_t rss = bench::resident_set_size();
+            std::cout << checkpoint << " connections: "
+                      << (rss - baseline) / checkpoint << " bytes RSS per connection, "
+                      << rss / (1024 * 1024) << " MB total, "
+                      << bench::seconds_since(start) << " s elapsed";
+            if (pool)
+            {
+                crypto_pool::statistics stats = crypto_pool::get_statistics();
+                std::cout << ", pool " << stats.bytes_in_use / checkpoint << " bytes in use per connection";
+            }
+            std::cout << '\n';
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "ssl_socket.h"
+
+/**
+ * Measures small request round trips over loopback TLS with each way
+ * of waiting for the response. Usage:
+ *
+ *   bench_latency [round trips] [--message BYTES]
+ *
+ * The modes are the 200ms sleep main used to do (only a few round
+ * trips, it is that slow), blocking in poll, spinning for 20us and
+ * 200us before blocking, and spinning with kernel busy polling
+ * requested as well. Percentiles are in microseconds.
+ */
+namespace
+{
+    const size_t SLEEP_ROUND_TRIPS = 10;
+
+    struct wait_mode
+    {
+        const char* name;
+        bool sleep;
+        std::chrono::microseconds spin;
+        bool kernel_busy_poll;
+    };
+
+    void run_echo_server(int listener, size_t message_size)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        std::vector<char> message(message_size);
+        while (true)
+        {
+            int connection = bench::accept_connection(listener);
+            int no_delay = 1;
+            setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+            SSL* ssl = SSL_new(context);
+            SSL_set_fd(ssl, connection);
+            if (SSL_accept(ssl) == 1)
+            {
+                bool open = true;
+                while (open)
+                {
+                    for (size_t received = 0; received < message_size && open; )
+                    {
+                        int read_size = SSL_read(ssl, message.data() + received, message_size - received);
+                        open = read_size > 0;
+                        received += open ? read_size : 0;
+                    }
+                    open = open && SSL_write(ssl, message.data(), message_size) > 0;
+                }
+            }
+            SSL_free(ssl);
+            close(connection);
+        }
+    }
+
+    double percentile(const std::vector<double> & sorted, double fraction)
+    {
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        return sorted[index];
+    }
+
+    void run_mode(const std::string & port, const wait_mode & mode, size_t round_trips, size_t message_size)
+    {
+        ssl_socket s("127.0.0.1", port);
+        s.set_spin_wait(mode.spin).set_kernel_busy_poll(mode.kernel_busy_poll).set_verify_peer(false).connect().make_secure();
+
+        std::vector<uint8_t> request(message_size, 'r');
+        std::vector<char> response(message_size);
+        std::vector<double> latencies;
+        latencies.reserve(round_trips);
+        for (size_t i = 0; i < round_trips; ++i)
+        {
+            bench::clock::time_point start = bench::clock::now();
+            s.write(request.data(), request.size());
+            for (size_t received = 0; received < message_size; )
+            {
+                size_t length = s.read(response.data() + received, message_size - received);
+                if (length > 0)
+                {
+                    received += length;
+                } else if (!s.is_connected()) {
+                    throw ssl_socket_exception("Server hung up");
+                } else if (mode.sleep) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                } else {
+                    s.wait_readable(std::chrono::seconds(1));
+                }
+            }
+            latencies.push_back(bench::seconds_since(start) * 1e6);
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << mode.name << '\t' << round_trips << '\t'
+                  << percentile(latencies, 0.5) << '\t'
+                  << percentile(latencies, 0.99) << '\t'
+                  << percentile(latencies, 0.999) << '\n';
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t round_trips = 100000;
+    size_t message_size = 64;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--message") == 0 && i + 1 < argc)
+            message_size = std::stoul(argv[++i]);
+        else
+            round_trips = std::stoul(argv[i]);
+    }
+
+    try
+    {
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, message_size]() { run_echo_server(listener, message_size); });
+        close(listener);
+
+        const wait_mode modes[] = {
+            {"sleep", true, std::chrono::microseconds(0), false},
+            {"block", false, std::chrono::microseconds(0), false},
+            {"spin20", false, std::chrono::microseconds(20), false},
+            {"spin200", false, std::chrono::microseconds(200), false},
+            {"busypoll", false, std::chrono::microseconds(200), true}
+        };
+        std::cout << "mode\ttrips\tp50_us\tp99_us\tp999_us\n";
+        for (const wait_mode & mode : modes)
+        {
+            run_mode(port, mode, mode.sleep ? SLEEP_ROUND_TRIPS : round_trips, message_size);
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "output_sink.h"
+#include "ssl_socket.h"
+
+/**
+ * Compares output_sink with the old way main printed each read,
+ * std::cout << std::string(buffer, length) per 1KB. Usage:
+ *
+ *   bench_output [megabytes] [--file PATH]
+ *
+ * Data is handed over in 1KB pieces, the size main used to read, and
+ * written to /dev/null, to a pipe drained by a child process and to a
+ * file (a temporary file unless --file is given).
+ */
+namespace
+{
+    const size_t PIECE_SIZE = 1024;
+
+    /**
+     * Feed megabytes of data to write in PIECE_SIZE pieces
+     *
+     * @return MB/s
+     */
+    double run(size_t megabytes, const std::function<void(const char*, size_t)> & write, const std::function<void()> & finish)
+    {
+        std::vector<char> piece(PIECE_SIZE, 'x');
+        size_t pieces = megabytes * 1024 * 1024 / PIECE_SIZE;
+        bench::clock::time_point start = bench::clock::now();
+        for (size_t i = 0; i < pieces; ++i)
+        {
+            write(piece.data(), piece.size());
+        }
+        finish();
+        return megabytes / bench::seconds_since(start);
+    }
+
+    /**
+     * The old code, with stdout pointed at target for the duration
+     */
+    double run_iostream(size_t megabytes, int target)
+    {
+        std::cout.flush();
+        int saved_stdout = dup(STDOUT_FILENO);
+        dup2(target, STDOUT_FILENO);
+        double rate = run(megabytes,
+                          [](const char* data, size_t length) { std::cout << std::string(data, length); },
+                          []() { std::cout.flush(); });
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        return rate;
+    }
+
+    double run_sink(size_t megabytes, output_sink & sink)
+    {
+        return run(megabytes,
+                   [&sink](const char* data, size_t length) { sink.write(data, length); },
+                   [&sink]() { sink.flush(); });
+    }
+
+    void report(const char* target, const char* method, double rate)
+    {
+        std::cerr << target << '\t' << method << '\t' << rate << '\n';
+    }
+
+    /**
+     * Start a child that reads and discards everything written to the
+     * returned pipe
+     */
+    int open_drained_pipe(std::unique_ptr<bench::child_process> & reader)
+    {
+        int ends[2];
+        if (pipe(ends) < 0)
+        {
+            throw ssl_socket_exception("Unable to create a pipe: " + std::string(strerror(errno)));
+        }
+        fcntl(ends[1], F_SETPIPE_SZ, 1024 * 1024);
+        int read_end = ends[0];
+        int write_end = ends[1];
+        reader.reset(new bench::child_process([read_end, write_end]() {
+                    close(write_end);
+                    std::vector<char> buffer(1024 * 1024);
+                    while (read(read_end, buffer.data(), buffer.size()) > 0)
+                        ;
+                }));
+        close(read_end);
+        return write_end;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = 1024;
+    std::string file_path;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+            file_path = argv[++i];
+        else
+            megabytes = std::stoul(argv[i]);
+    }
+
+    try
+    {
+        // Results go to stderr, stdout is redirected during the runs
+        std::cerr << "target\tmethod\tMB/s\n";
+
+        int null_fd = open("/dev/null", O_WRONLY);
+        report("/dev/null", "iostream", run_iostream(megabytes, null_fd));
+        {
+            output_sink sink(null_fd);
+            report("/dev/null", sink.get_method(), run_sink(megabytes, sink));
+        }
+        close(null_fd);
+
+        for (int method = 0; method < 3; ++method)
+        {
+            std::unique_ptr<bench::child_process> reader;
+            int pipe_fd = open_drained_pipe(reader);
+            if (method == 0)
+            {
+                report("pipe", "iostream", run_iostream(megabytes, pipe_fd));
+            } else {
+                output_sink sink(pipe_fd);
+                sink.set_vmsplice(method == 2);
+                report("pipe", sink.get_method(), run_sink(megabytes, sink));
+            }
+            close(pipe_fd);
+        }
+
+        if (file_path.empty())
+        {
+            char temporary_path[] = "/var/tmp/bench_output_XXXXXX";
+            int temporary_file = mkstemp(temporary_path);
+            if (temporary_file < 0)
+            {
+                throw ssl_socket_exception("Unable to create a temporary file");
+            }
+            close(temporary_file);
+            file_path = temporary_path;
+        }
+        for (int method = 0; method < 3; ++method)
+        {
+            if (method == 0)
+            {
+                int file_fd = open(file_path.c_str(), O_WRONLY | O_TRUNC);
+                report("file", "iostream", run_iostream(megabytes, file_fd));
+                close(file_fd);
+            } else {
+                output_sink sink(file_path, method == 2);
+                report("file", sink.get_method(), run_sink(megabytes, sink));
+            }
+        }
+        unlink(file_path.c_str());
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
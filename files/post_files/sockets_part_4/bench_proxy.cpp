@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "forwarding_proxy.h"
+#include "ssl_socket.h"
+
+/**
+ * Measures what forwarding_proxy costs on loopback. Usage:
+ *
+ *   bench_proxy [round trips] [--message BYTES] [--bulk MEGABYTES]
+ *
+ * Each route gets a small message echo test, reported as round trip
+ * percentiles in microseconds, and a bulk download through it in MB/s.
+ * The direct routes connect to the server without a proxy, the others
+ * go through a proxy in its own process accepting plain text and
+ * forwarding in plain text or over TLS. Whether the kernel took over
+ * TLS (so the ktls route splices) is printed first.
+ */
+namespace
+{
+    struct route
+    {
+        const char* name;
+        bool proxied;
+        bool secure; // TLS to the server, from the client or the proxy
+        bool splice;
+        bool kernel_tls;
+    };
+
+    void run_server(int listener, size_t message_size)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        while (true)
+        {
+            bench::serve_commands(bench::accept_connection(listener), context, message_size);
+        }
+    }
+
+    double percentile(const std::vector<double> & sorted, double fraction)
+    {
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        return sorted[index];
+    }
+
+    /**
+     * Read exactly length bytes, waiting as needed
+     *
+     * @throw ssl_socket_exception if the server hangs up first
+     */
+    void read_exactly(ssl_socket & s, char* data, size_t length)
+    {
+        for (size_t received = 0; received < length; )
+        {
+            size_t read_size = s.read(data + received, length - received);
+            if (read_size > 0)
+            {
+                received += read_size;
+            } else if (!s.is_connected()) {
+                throw ssl_socket_exception("Server hung up");
+            } else {
+                s.wait_readable(std::chrono::seconds(1));
+            }
+        }
+    }
+
+    void open_socket(ssl_socket & s, bool secure)
+    {
+        s.set_verify_peer(false).connect();
+        if (secure)
+            s.make_secure();
+    }
+
+    std::vector<double> measure_round_trips(const std::string & port, bool secure, size_t round_trips, size_t message_size)
+    {
+        ssl_socket s("127.0.0.1", port);
+        open_socket(s, secure);
+        s.write(std::string(1, bench::ECHO_COMMAND));
+
+        std::vector<uint8_t> request(message_size, 'r');
+        std::vector<char> response(message_size);
+        std::vector<double> latencies;
+        latencies.reserve(round_trips);
+        for (size_t i = 0; i < round_trips; ++i)
+        {
+            bench::clock::time_point start = bench::clock::now();
+            s.write(request.data(), request.size());
+            read_exactly(s, response.data(), message_size);
+            latencies.push_back(bench::seconds_since(start) * 1e6);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    }
+
+    double measure_throughput(const std::string & port, bool secure, uint64_t bulk_size)
+    {
+        ssl_socket s("127.0.0.1", port);
+        open_socket(s, secure);
+
+        std::string command(1, bench::BULK_COMMAND);
+        command.append(reinterpret_cast<const char*>(&bulk_size), sizeof(bulk_size));
+        bench::clock::time_point start = bench::clock::now();
+        s.write(command);
+
+        std::vector<char> buffer;
+        uint64_t received = 0;
+        while (received < bulk_size)
+        {
+            size_t length = s.read(buffer);
+            if (length > 0)
+            {
+                received += length;
+            } else if (!s.is_connected()) {
+                throw ssl_socket_exception("Server hung up");
+            } else {
+                s.wait_readable(std::chrono::seconds(1));
+            }
+        }
+        return received / 1048576.0 / bench::seconds_since(start);
+    }
+
+    /**
+     * Check whether a TLS connection to the server ends up with kTLS
+     */
+    void report_kernel_tls(const std::string & port)
+    {
+        ssl_socket s("127.0.0.1", port);
+        s.set_kernel_tls().set_verify_peer(false).connect().make_secure();
+        std::cout << "kTLS send " << (s.has_kernel_tls_send() ? "yes" : "no")
+                  << ", receive " << (s.has_kernel_tls_receive() ? "yes" : "no") << '\n';
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t round_trips = 50000;
+    size_t message_size = 64;
+    uint64_t bulk_size = 1024 * 1048576ULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--message") == 0 && i + 1 < argc)
+            message_size = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--bulk") == 0 && i + 1 < argc)
+            bulk_size = std::stoull(argv[++i]) * 1048576ULL;
+        else
+            round_trips = std::stoul(argv[i]);
+    }
+
+    // The server hangs up after bulk transfers, so the close_notify
+    // sent when the client disconnects may hit a closed socket
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        int server_listener = bench::listen_on_loopback();
+        std::string server_port = bench::bound_port(server_listener);
+        bench::child_process server([server_listener, message_size]() { run_server(server_listener, message_size); });
+        close(server_listener);
+
+        report_kernel_tls(server_port);
+
+        const route routes[] = {
+            {"direct", false, false, false, false},
+            {"splice", true, false, true, false},
+            {"copy", true, false, false, false},
+            {"direct-tls", false, true, false, false},
+            {"tls-copy", true, true, false, false},
+            {"tls-ktls", true, true, true, true}
+        };
+        std::cout << "route\ttrips\tp50_us\tp99_us\tMB/s\n";
+        for (const route & current : routes)
+        {
+            std::string port = server_port;
+            std::unique_ptr<bench::child_process> proxy_process;
+            if (current.proxied)
+            {
+                int listener = bench::listen_on_loopback();
+                port = bench::bound_port(listener);
+                forwarding_proxy proxy("127.0.0.1", server_port);
+                proxy.set_secure(current.secure).set_verify_peer(false).set_splice(current.splice).set_kernel_tls(current.kernel_tls);
+                proxy_process.reset(new bench::child_process([&proxy, listener]() { proxy.serve(listener); }));
+                close(listener);
+            }
+
+            // Only the direct TLS route speaks TLS from the client
+            bool client_secure = current.secure && !current.proxied;
+            std::vector<double> latencies = measure_round_trips(port, client_secure, round_trips, message_size);
+            double throughput = measure_throughput(port, client_secure, bulk_size);
+            std::cout << current.name << '\t' << round_trips << '\t'
+                      << percentile(latencies, 0.5) << '\t'
+                      << percentile(latencies, 0.99) << '\t'
+                      << throughput << std::endl;
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,252 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "bench_common.h"
+#include "range_download.h"
+#include "ssl_socket.h"
+
+/**
+ * Compares downloading one file over a single connection with
+ * parallel range downloads over several. Usage:
+ *
+ *   bench_range [megabytes] [--rate MB/s] [--fail-every N] [--netem "delay 25ms"]
+ *
+ * The local server throttles every connection to --rate (20MB/s by
+ * default) to stand in for the per flow limit of a long path, or
+ * netem can be used to add real latency. With --fail-every the
+ * server cuts every Nth response off half way to exercise the
+ * retries. Each downloaded file is compared against the original, and
+ * a download the server answers with an error page must leave no file
+ * behind.
+ */
+namespace
+{
+    const size_t SLICE_SIZE = 16 * 1024;
+    const uint64_t RANGE_SIZE = 4 * 1024 * 1024;
+    const size_t CONNECTION_COUNTS[] = {1, 2, 4, 8, 16};
+
+    struct server_options
+    {
+        double bytes_per_second;
+        size_t fail_every;
+    };
+
+    std::vector<char> make_payload(size_t size)
+    {
+        std::vector<char> payload(size);
+        uint32_t state = 1;
+        for (char & byte : payload)
+        {
+            state = state * 1103515245 + 12345;
+            byte = state >> 24;
+        }
+        return payload;
+    }
+
+    bool send_all(SSL* ssl, const char* data, size_t length)
+    {
+        while (length > 0)
+        {
+            int written = SSL_write(ssl, data, length);
+            if (written <= 0)
+                return false;
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    /**
+     * Serve keep-alive HEAD and GET requests on one connection. Ranges
+     * are supported on every path except /plain and /broken, and GET
+     * requests for /broken get a 500 error page.
+     */
+    void serve_connection(SSL* ssl, const std::vector<char> & payload, const server_options & options, std::atomic<size_t> & responses)
+    {
+        std::string request;
+        char buffer[4096];
+        while (true)
+        {
+            size_t end = request.find("\r\n\r\n");
+            if (end == std::string::npos)
+            {
+                int read_size = SSL_read(ssl, buffer, sizeof(buffer));
+                if (read_size <= 0)
+                    return;
+                request.append(buffer, read_size);
+                continue;
+            }
+            std::string headers = request.substr(0, end);
+            request.erase(0, end + 4);
+
+            bool head = headers.compare(0, 5, "HEAD ") == 0;
+            bool broken = headers.find(" /broken ") != std::string::npos;
+            bool ranges = headers.find(" /plain ") == std::string::npos && !broken;
+            if (broken && !head)
+            {
+                std::string error_page = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 14\r\n\r\nserver failed\n";
+                if (!send_all(ssl, error_page.data(), error_page.size()))
+                    return;
+                continue;
+            }
+            uint64_t start = 0;
+            uint64_t last = payload.size() - 1;
+            size_t range_header = headers.find("\r\nRange: bytes=");
+            bool partial = ranges && !head && range_header != std::string::npos;
+            if (partial)
+            {
+                char* dash = nullptr;
+                start = strtoull(headers.c_str() + range_header + 15, &dash, 10);
+                last = std::min<uint64_t>(strtoull(dash + 1, nullptr, 10), payload.size() - 1);
+            }
+
+            std::string response = partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+            response += "Content-Length: " + std::to_string(last - start + 1) + "\r\n";
+            if (ranges)
+                response += "Accept-Ranges: bytes\r\n";
+            if (partial)
+                response += "Content-Range: bytes " + std::to_string(start) + "-" + std::to_string(last) + "/" + std::to_string(payload.size()) + "\r\n";
+            response += "\r\n";
+            if (!send_all(ssl, response.data(), response.size()) || head)
+            {
+                if (head)
+                    continue;
+                return;
+            }
+
+            uint64_t length = last - start + 1;
+            bool cut_short = options.fail_every > 0 && ++responses % options.fail_every == 0;
+            uint64_t limit = cut_short ? length / 2 : length;
+            bench::clock::time_point begin = bench::clock::now();
+            for (uint64_t sent = 0; sent < limit; )
+            {
+                size_t slice = std::min<uint64_t>(SLICE_SIZE, limit - sent);
+                if (!send_all(ssl, payload.data() + start + sent, slice))
+                    return;
+                sent += slice;
+                if (options.bytes_per_second > 0)
+                {
+                    std::this_thread::sleep_until(begin + std::chrono::duration_cast<bench::clock::duration>(
+                                                      std::chrono::duration<double>(sent / options.bytes_per_second)));
+                }
+            }
+            if (cut_short)
+                return;
+        }
+    }
+
+    void run_server(int listener, const std::vector<char> & payload, const server_options & options)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        std::atomic<size_t> responses(0);
+        while (true)
+        {
+            int connection = bench::accept_connection(listener);
+            std::thread([context, connection, &payload, &options, &responses]() {
+                    SSL* ssl = SSL_new(context);
+                    SSL_set_fd(ssl, connection);
+                    if (SSL_accept(ssl) == 1)
+                        serve_connection(ssl, payload, options, responses);
+                    SSL_free(ssl);
+                    close(connection);
+                }).detach();
+        }
+    }
+
+    bool matches(const std::string & path, const std::vector<char> & payload)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return contents == payload;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = 64;
+    server_options options = {20 * 1024 * 1024, 0};
+    std::string netem_arguments;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+            options.bytes_per_second = std::stod(argv[++i]) * 1024 * 1024;
+        else if (strcmp(argv[i], "--fail-every") == 0 && i + 1 < argc)
+            options.fail_every = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--netem") == 0 && i + 1 < argc)
+            netem_arguments = argv[++i];
+        else
+            megabytes = std::stoul(argv[i]);
+    }
+
+    try
+    {
+        bench::netem_scope netem(netem_arguments);
+        std::vector<char> payload = make_payload(megabytes * 1024 * 1024);
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, &payload, &options]() { run_server(listener, payload, options); });
+        close(listener);
+
+        char output_path[] = "/tmp/bench_range_XXXXXX";
+        int output_file = mkstemp(output_path);
+        if (output_file < 0)
+        {
+            throw ssl_socket_exception("Unable to create a temporary file for the download");
+        }
+        close(output_file);
+
+        std::cout << "mode\tconnections\tMB/s\tintact\n";
+        for (int ranged = 0; ranged < 2; ++ranged)
+        {
+            for (size_t connections : CONNECTION_COUNTS)
+            {
+                if (!ranged && connections > 1)
+                    break;
+                range_download download("127.0.0.1", port, ranged ? "/file" : "/plain");
+                download.set_connections(connections).set_range_size(RANGE_SIZE).set_verify_peer(false);
+                bench::clock::time_point start = bench::clock::now();
+                download.save(output_path);
+                double seconds = bench::seconds_since(start);
+                std::cout << (ranged ? "ranges" : "single") << '\t' << connections << '\t'
+                          << megabytes / seconds << '\t'
+                          << (matches(output_path, payload) ? "yes" : "NO") << '\n';
+            }
+        }
+
+        bool removed = false;
+        try
+        {
+            range_download broken("127.0.0.1", port, "/broken");
+            broken.set_max_attempts(2).set_verify_peer(false).save(output_path);
+        } catch (const ssl_socket_exception &) {
+            removed = access(output_path, F_OK) != 0;
+        }
+        std::cout << "failed download removed: " << (removed ? "yes" : "NO") << '\n';
+        unlink(output_path);
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
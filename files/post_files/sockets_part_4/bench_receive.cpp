@@ -0,0 +1,180 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <atomic>
+#include <cstdarg>
+#include <vector>
+#include <dlfcn.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "ssl_socket.h"
+
+/**
+ * Compares fixed 1KB reads with adaptive reads on loopback, counting
+ * the system calls the client makes to receive the data. Usage:
+ *
+ *   bench_receive [megabytes]
+ *
+ * The counts come from wrappers around read, recv, ioctl and poll in
+ * this program, which OpenSSL's socket BIO calls through as well.
+ */
+namespace
+{
+    const size_t FIXED_READ_SIZE = 1024;
+    const size_t SERVER_WRITE_SIZE = 64 * 1024;
+
+    std::atomic<size_t> read_calls(0);
+    std::atomic<size_t> other_calls(0);
+
+    template <typename function_type>
+    function_type next_symbol(const char* name)
+    {
+        return reinterpret_cast<function_type>(dlsym(RTLD_NEXT, name));
+    }
+
+    void run_server(int listener, const std::vector<bool> & trials, size_t bytes)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        std::vector<char> payload(SERVER_WRITE_SIZE, 'x');
+        for (bool secure : trials)
+        {
+            int connection = bench::accept_connection(listener);
+            SSL* ssl = nullptr;
+            if (secure)
+            {
+                ssl = SSL_new(context);
+                SSL_set_fd(ssl, connection);
+                if (SSL_accept(ssl) != 1)
+                {
+                    throw ssl_socket_exception("Server handshake failed");
+                }
+            }
+            for (size_t sent = 0; sent < bytes; )
+            {
+                size_t length = std::min(payload.size(), bytes - sent);
+                ssize_t written = secure ? SSL_write(ssl, payload.data(), length) : send(connection, payload.data(), length, 0);
+                if (written <= 0)
+                    break;
+                sent += written;
+            }
+            if (secure)
+            {
+                SSL_shutdown(ssl);
+                SSL_free(ssl);
+            }
+            close(connection);
+        }
+        SSL_CTX_free(context);
+    }
+
+    void run_client(const std::string & port, bool secure, bool adaptive, size_t bytes)
+    {
+        ssl_socket s("127.0.0.1", port);
+        s.set_adaptive_receive(adaptive).set_verify_peer(false).connect();
+        if (secure)
+        {
+            s.make_secure();
+        }
+
+        std::vector<char> buffer(FIXED_READ_SIZE);
+        read_calls = 0;
+        other_calls = 0;
+        bench::clock::time_point start = bench::clock::now();
+        for (size_t received = 0; received < bytes && s.is_connected(); )
+        {
+            size_t length = adaptive ? s.read(buffer) : s.read(buffer.data(), FIXED_READ_SIZE);
+            if (length == 0 && s.is_connected())
+            {
+                s.wait_readable(std::chrono::seconds(1));
+            }
+            received += length;
+        }
+        double seconds = bench::seconds_since(start);
+
+        double megabytes = bytes / (1024.0 * 1024.0);
+        std::cout << (secure ? "tls" : "plain") << '\t' << (adaptive ? "adaptive" : "1KB") << '\t'
+                  << megabytes / seconds << '\t'
+                  << read_calls / megabytes << '\t'
+                  << other_calls / megabytes << '\n';
+    }
+}
+
+/**
+ * Counting wrappers, each forwards to the C library's version
+ */
+extern "C"
+{
+    ssize_t read(int fd, void* buffer, size_t length)
+    {
+        static ssize_t (*real_read)(int, void*, size_t) = next_symbol<ssize_t (*)(int, void*, size_t)>("read");
+        ++read_calls;
+        return real_read(fd, buffer, length);
+    }
+
+    ssize_t recv(int fd, void* buffer, size_t length, int flags)
+    {
+        static ssize_t (*real_recv)(int, void*, size_t, int) = next_symbol<ssize_t (*)(int, void*, size_t, int)>("recv");
+        ++read_calls;
+        return real_recv(fd, buffer, length, flags);
+    }
+
+    int ioctl(int fd, unsigned long request, ...)
+    {
+        static int (*real_ioctl)(int, unsigned long, void*) = next_symbol<int (*)(int, unsigned long, void*)>("ioctl");
+        va_list arguments;
+        va_start(arguments, request);
+        void* argument = va_arg(arguments, void*);
+        va_end(arguments);
+        ++other_calls;
+        return real_ioctl(fd, request, argument);
+    }
+
+    int poll(struct pollfd* descriptors, nfds_t count, int timeout)
+    {
+        static int (*real_poll)(struct pollfd*, nfds_t, int) = next_symbol<int (*)(struct pollfd*, nfds_t, int)>("poll");
+        ++other_calls;
+        return real_poll(descriptors, count, timeout);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = argc > 1 ? std::stoul(argv[1]) : 256;
+    size_t bytes = megabytes * 1024 * 1024;
+
+    try
+    {
+        std::vector<bool> trials = {false, false, true, true};
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, &trials, bytes]() { run_server(listener, trials, bytes); });
+        close(listener);
+
+        std::cout << "socket\treads\tMB/s\treads/MB\tioctl+poll/MB\n";
+        for (bool secure : {false, true})
+        {
+            for (bool adaptive : {false, true})
+                run_client(port, secure, adaptive, bytes);
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
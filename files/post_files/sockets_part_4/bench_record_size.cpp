@@ -0,0 +1,157 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include "bench_common.h"
+#include "ssl_socket.h"
+
+/**
+ * Compares time to first byte and bulk throughput with fixed and
+ * dynamic TLS record sizes. Usage:
+ *
+ *   bench_record_size [--netem "delay 25ms"] [--repeat N]
+ *
+ * The client writes each payload in a single call right after the
+ * handshake. The server notes when it decrypts the first byte and
+ * when it has received everything, then reports both times back over
+ * the same connection. Both sides read the same monotonic clock so
+ * the times can be compared directly.
+ */
+namespace
+{
+    const size_t PAYLOAD_SIZES[] = {16 * 1024, 256 * 1024, 4 * 1024 * 1024, 64 * 1024 * 1024};
+
+    struct server_report
+    {
+        int64_t first_byte;
+        int64_t last_byte;
+    };
+
+    int64_t now_nanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(bench::clock::now().time_since_epoch()).count();
+    }
+
+    void run_sink_server(int listener, const std::vector<size_t> & trials)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        std::vector<char> buffer(64 * 1024);
+        for (size_t expected : trials)
+        {
+            int connection = bench::accept_connection(listener);
+            SSL* ssl = SSL_new(context);
+            SSL_set_fd(ssl, connection);
+            if (SSL_accept(ssl) != 1)
+            {
+                throw ssl_socket_exception("Server handshake failed");
+            }
+
+            server_report report = {0, 0};
+            for (size_t received = 0; received < expected; )
+            {
+                int read_size = SSL_read(ssl, buffer.data(), buffer.size());
+                if (read_size <= 0)
+                {
+                    throw ssl_socket_exception("Server read failed");
+                }
+                if (received == 0)
+                    report.first_byte = now_nanoseconds();
+                received += read_size;
+            }
+            report.last_byte = now_nanoseconds();
+            SSL_write(ssl, &report, sizeof(report));
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+            close(connection);
+        }
+        SSL_CTX_free(context);
+    }
+
+    server_report read_report(ssl_socket & s)
+    {
+        server_report report;
+        char* position = reinterpret_cast<char*>(&report);
+        for (size_t received = 0; received < sizeof(report) && s.is_connected(); )
+        {
+            size_t length = s.read(position + received, sizeof(report) - received);
+            if (length == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            received += length;
+        }
+        return report;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string netem_arguments;
+    size_t repeat = 5;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--netem") == 0 && i + 1 < argc)
+            netem_arguments = argv[++i];
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            repeat = std::stoul(argv[++i]);
+    }
+
+    try
+    {
+        bench::netem_scope netem(netem_arguments);
+        std::vector<size_t> trials; // Every size, once with fixed and once with dynamic records
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            for (size_t size : PAYLOAD_SIZES)
+                trials.insert(trials.end(), repeat, size);
+        }
+
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, &trials]() { run_sink_server(listener, trials); });
+        close(listener);
+
+        std::vector<uint8_t> payload(PAYLOAD_SIZES[sizeof(PAYLOAD_SIZES) / sizeof(PAYLOAD_SIZES[0]) - 1], 'x');
+        std::cout << "records\tbytes\tttfb_ms\tMB/s\n";
+        for (bool dynamic : {false, true})
+        {
+            for (size_t size : PAYLOAD_SIZES)
+            {
+                double total_ttfb = 0;
+                double total_seconds = 0;
+                for (size_t i = 0; i < repeat; ++i)
+                {
+                    ssl_socket s("127.0.0.1", port);
+                    s.set_dynamic_record_sizing(dynamic).set_verify_peer(false).connect().make_secure();
+                    int64_t start = now_nanoseconds();
+                    s.write(payload.data(), size);
+                    server_report report = read_report(s);
+                    total_ttfb += (report.first_byte - start) / 1e6;
+                    total_seconds += (report.last_byte - start) / 1e9;
+                }
+                std::cout << (dynamic ? "dynamic" : "fixed") << '\t' << size << '\t'
+                          << total_ttfb / repeat << '\t'
+                          << (size * repeat) / total_seconds / (1024 * 1024) << '\n';
+            }
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,338 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <vector>
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bench_common.h"
+#include "bulk_resolver.h"
+#include "ssl_socket.h"
+
+/**
+ * Resolves a generated fleet of host names through a stub DNS server
+ * on 127.0.0.1:53, so nothing leaves the machine. Usage:
+ *
+ *   bench_resolver [count] [--delay-ms N] [--concurrency N ...]
+ *
+ * /etc/resolv.conf has to point at 127.0.0.1 and binding port 53
+ * needs root. The stub answers A and AAAA queries for
+ * node-<i>.fleet.test after --delay-ms (2) to stand in for an upstream
+ * server, and NXDOMAIN for anything else. The list of count (5000)
+ * names repeats every tenth name and adds a few unknown names. Each
+ * concurrency level (1, 16, 64 and 256 by default) reports names per
+ * second, lookup latency percentiles and any wrong answers, followed
+ * by the cost of formatting the results compared with iostreams.
+ */
+namespace
+{
+    const uint16_t DNS_PORT = 53;
+    const uint16_t TYPE_A = 1;
+    const uint16_t TYPE_AAAA = 28;
+    const uint8_t NXDOMAIN = 3;
+    const size_t DNS_HEADER_SIZE = 12;
+    const unsigned int TTL = 60;
+
+    std::string host_name(unsigned int index)
+    {
+        return "node-" + std::to_string(index) + ".fleet.test";
+    }
+
+    resolved_address expected_address(int family, unsigned int index)
+    {
+        resolved_address address = {family, {0}};
+        if (family == AF_INET)
+        {
+            address.bytes[0] = 10;
+            address.bytes[1] = index >> 16;
+            address.bytes[2] = index >> 8;
+            address.bytes[3] = index;
+        } else {
+            address.bytes[0] = 0xfd;
+            address.bytes[13] = index >> 16;
+            address.bytes[14] = index >> 8;
+            address.bytes[15] = index;
+        }
+        return address;
+    }
+
+    /**
+     * Build the answer to a single question query, or return an empty
+     * string for anything that isn't one
+     */
+    std::string answer_query(const unsigned char* query, size_t length)
+    {
+        if (length < DNS_HEADER_SIZE || query[4] != 0 || query[5] != 1)
+            return std::string();
+
+        std::string name;
+        size_t position = DNS_HEADER_SIZE;
+        while (position < length && query[position] != 0)
+        {
+            size_t label_length = query[position];
+            if (label_length > 63 || position + 1 + label_length >= length)
+                return std::string();
+            name.append(reinterpret_cast<const char*>(query + position + 1), label_length);
+            name.push_back('.');
+            position += 1 + label_length;
+        }
+        position += 1;
+        if (position + 4 > length)
+            return std::string();
+        uint16_t type = query[position] << 8 | query[position + 1];
+        position += 4;
+
+        // Header and question copied back, without any EDNS record
+        std::string response(reinterpret_cast<const char*>(query), position);
+        response[2] = 0x80 | (query[2] & 0x01); // QR, keeping RD
+        response[3] = 0x80; // RA
+        response[6] = response[7] = response[8] = response[9] = response[10] = response[11] = 0;
+
+        unsigned int index = 0;
+        char rest = 0;
+        if (sscanf(name.c_str(), "node-%u.fleet.test%c", &index, &rest) != 2 || rest != '.')
+        {
+            response[3] |= NXDOMAIN;
+            return response;
+        }
+        if (type != TYPE_A && type != TYPE_AAAA)
+            return response; // No data of that type
+
+        resolved_address address = expected_address(type == TYPE_A ? AF_INET : AF_INET6, index);
+        size_t address_length = type == TYPE_A ? 4 : 16;
+        response[7] = 1;
+        const unsigned char record[] = {
+            0xc0, DNS_HEADER_SIZE, // The name in the question
+            0, static_cast<unsigned char>(type), 0, 1, // Type, class IN
+            0, 0, 0, TTL,
+            0, static_cast<unsigned char>(address_length)
+        };
+        response.append(reinterpret_cast<const char*>(record), sizeof(record));
+        response.append(reinterpret_cast<const char*>(address.bytes), address_length);
+        return response;
+    }
+
+    struct delayed_response
+    {
+        bench::clock::time_point due;
+        std::string data;
+        struct sockaddr_in client;
+    };
+
+    /**
+     * Answer queries on a bound UDP socket, each after delay
+     */
+    void run_stub_server(int server, std::chrono::milliseconds delay)
+    {
+        std::deque<delayed_response> waiting;
+        unsigned char query[512];
+        while (true)
+        {
+            int timeout = -1;
+            if (!waiting.empty())
+            {
+                timeout = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(waiting.front().due - bench::clock::now()).count());
+            }
+            struct pollfd descriptor = {server, POLLIN, 0};
+            poll(&descriptor, 1, timeout);
+
+            while (true)
+            {
+                delayed_response response;
+                socklen_t client_length = sizeof(response.client);
+                ssize_t length = recvfrom(server, query, sizeof(query), MSG_DONTWAIT, (struct sockaddr*)&response.client, &client_length);
+                if (length < 0)
+                    break;
+                response.data = answer_query(query, length);
+                response.due = bench::clock::now() + delay;
+                if (!response.data.empty())
+                    waiting.push_back(response);
+            }
+
+            bench::clock::time_point now = bench::clock::now();
+            while (!waiting.empty() && waiting.front().due <= now)
+            {
+                const delayed_response & response = waiting.front();
+                sendto(server, response.data.data(), response.data.size(), 0, (const struct sockaddr*)&response.client, sizeof(response.client));
+                waiting.pop_front();
+            }
+        }
+    }
+
+    int bind_dns_port()
+    {
+        int server = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in address = {0};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(DNS_PORT);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (server < 0 || bind(server, (struct sockaddr*)&address, sizeof(address)) < 0)
+        {
+            throw ssl_socket_exception("Unable to bind 127.0.0.1:53 (needs root and a free port): " + std::string(strerror(errno)));
+        }
+        // Hundreds of lookups start at once, don't drop their queries
+        int buffer_size = 4 * 1024 * 1024;
+        setsockopt(server, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        return server;
+    }
+
+    /**
+     * Count the results that don't match what the stub server hands out
+     */
+    size_t count_wrong_answers(const std::vector<resolve_result> & results)
+    {
+        size_t wrong = 0;
+        for (const resolve_result & result : results)
+        {
+            unsigned int index = 0;
+            char rest = 0;
+            bool known = sscanf(result.name.c_str(), "node-%u.fleet.test%c", &index, &rest) == 1;
+            if (!known)
+            {
+                wrong += result.error == 0;
+                continue;
+            }
+            std::vector<resolved_address> expected = {expected_address(AF_INET, index), expected_address(AF_INET6, index)};
+            std::sort(expected.begin(), expected.end());
+            wrong += result.error != 0 || result.addresses != expected;
+        }
+        return wrong;
+    }
+
+    /**
+     * The sockets_part2 way, for comparison
+     */
+    void format_with_iostreams(const resolve_result & result, std::ostream & out)
+    {
+        out << result.name << '\t';
+        if (result.error != 0)
+        {
+            out << '!' << gai_strerror(result.error) << '\n';
+            return;
+        }
+        for (size_t i = 0; i < result.addresses.size(); ++i)
+        {
+            char text[INET6_ADDRSTRLEN];
+            inet_ntop(result.addresses[i].family, result.addresses[i].bytes, text, sizeof(text));
+            out << (i != 0 ? "," : "") << text;
+        }
+        out << '\n';
+    }
+
+    double percentile(const std::vector<double> & sorted, double fraction)
+    {
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        return sorted[index];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int count = 5000;
+    std::chrono::milliseconds delay(2);
+    std::vector<size_t> concurrency_levels;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--delay-ms") == 0 && i + 1 < argc)
+            delay = std::chrono::milliseconds(std::stoul(argv[++i]));
+        else if (strcmp(argv[i], "--concurrency") == 0 && i + 1 < argc)
+            concurrency_levels.push_back(std::stoul(argv[++i]));
+        else
+            count = std::stoul(argv[i]);
+    }
+    if (concurrency_levels.empty())
+        concurrency_levels = {1, 16, 64, 256};
+
+    try
+    {
+        int server_socket = bind_dns_port();
+        bench::child_process server([server_socket, delay]() { run_stub_server(server_socket, delay); });
+        close(server_socket);
+
+        std::vector<std::string> names;
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            names.push_back(host_name(i));
+            if (i % 10 == 0)
+                names.push_back(host_name(i / 2));
+            if (i % 100 == 0)
+                names.push_back("missing-" + std::to_string(i) + ".fleet.test");
+        }
+
+        std::cout << names.size() << " names, stub delay " << delay.count() << " ms\n";
+        std::cout << "concurrency\tnames/s\tp50_ms\tp99_ms\tfailed\twrong\n";
+        std::vector<resolve_result> results;
+        for (size_t concurrency : concurrency_levels)
+        {
+            bench::clock::time_point start = bench::clock::now();
+            results = bulk_resolver().set_concurrency(concurrency).resolve(names);
+            double seconds = bench::seconds_since(start);
+
+            std::vector<double> latencies;
+            size_t failed = 0;
+            for (const resolve_result & result : results)
+            {
+                latencies.push_back(result.latency.count() / 1000.0);
+                failed += result.error != 0;
+            }
+            std::sort(latencies.begin(), latencies.end());
+            std::cout << concurrency << '\t' << results.size() / seconds << '\t'
+                      << percentile(latencies, 0.5) << '\t' << percentile(latencies, 0.99) << '\t'
+                      << failed << '\t' << count_wrong_answers(results) << '\n';
+        }
+
+        const size_t FORMAT_ROUNDS = 100;
+        std::string out;
+        bench::clock::time_point start = bench::clock::now();
+        for (size_t round = 0; round < FORMAT_ROUNDS; ++round)
+        {
+            out.clear();
+            for (const resolve_result & result : results)
+                bulk_resolver::format(result, out);
+        }
+        double direct = bench::seconds_since(start);
+
+        std::ostringstream stream;
+        start = bench::clock::now();
+        for (size_t round = 0; round < FORMAT_ROUNDS; ++round)
+        {
+            stream.str(std::string());
+            for (const resolve_result & result : results)
+                format_with_iostreams(result, stream);
+        }
+        double iostreams = bench::seconds_since(start);
+        if (stream.str() != out)
+        {
+            std::cerr << "Formatters disagree\n";
+            return 1;
+        }
+        size_t formatted = FORMAT_ROUNDS * results.size();
+        std::cout << "format ns/name: direct " << direct / formatted * 1e9 << ", iostreams " << iostreams / formatted * 1e9 << '\n';
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
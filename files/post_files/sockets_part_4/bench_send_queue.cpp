@@ -0,0 +1,318 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "bench_common.h"
+#include "socket_set.h"
+#include "ssl_socket.h"
+
+/**
+ * One thread feeding a slow reader and a fast reader at once, with
+ * blocking writes and then with try_write and the send queue. Usage:
+ *
+ *   bench_send_queue [--seconds N] [--rate MB/s] [--message BYTES] [--tls]
+ *                    [--stall SECONDS]
+ *
+ * The slow reader takes --rate (10) MB/s, the fast one reads as fast
+ * as it can. Blocking writes hold the fast peer back to the slow
+ * one's pace, queued writes let each run at its own speed while the
+ * watermarks keep the slow peer's queue bounded. Reports the
+ * throughput to each peer, the longest time the producer loop was
+ * stuck, the peak queue and the memory it held.
+ *
+ * Last, a reader stops for --stall (4) seconds after STALL_AFTER bytes
+ * while try_write and flush_queue keep going. A stall longer than the
+ * record sizing idle reset used to shrink the TLS record OpenSSL was
+ * retrying, which failed the connection with "bad length". The run
+ * exits with an error if the transfer fails.
+ */
+namespace
+{
+    const size_t READ_SIZE = 16 * 1024;
+    const size_t HIGH_WATERMARK = 256 * 1024;
+    const size_t LOW_WATERMARK = 64 * 1024;
+    const uint64_t STALL_AFTER = 1200 * 1024;
+    const uint64_t STALL_TRANSFER = 8 * 1048576;
+
+    /**
+     * The first byte of a TLS handshake record
+     */
+    const unsigned char TLS_HANDSHAKE = 0x16;
+
+    /**
+     * Read and discard everything sent on connection, pausing after
+     * each read to hold the rate down to bytes_per_second if it isn't 0
+     *
+     * @param stall_seconds how long to stop reading once STALL_AFTER
+     * bytes have arrived, 0 to never stop
+     */
+    void drain(int connection, SSL_CTX* context, double bytes_per_second, double stall_seconds = 0)
+    {
+        // A small buffer so the slow reader pushes back quickly
+        int buffer_size = 64 * 1024;
+        setsockopt(connection, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+        SSL* ssl = nullptr;
+        unsigned char first = 0;
+        if (recv(connection, &first, 1, MSG_PEEK) == 1 && first == TLS_HANDSHAKE)
+        {
+            ssl = SSL_new(context);
+            SSL_set_fd(ssl, connection);
+            if (SSL_accept(ssl) != 1)
+            {
+                SSL_free(ssl);
+                close(connection);
+                return;
+            }
+        }
+
+        std::vector<char> buffer(READ_SIZE);
+        bench::clock::time_point start = bench::clock::now();
+        uint64_t received = 0;
+        while (true)
+        {
+            ssize_t length = ssl != nullptr ? SSL_read(ssl, buffer.data(), buffer.size()) : ::read(connection, buffer.data(), buffer.size());
+            if (length <= 0)
+                break;
+            if (stall_seconds > 0 && received < STALL_AFTER && received + length >= STALL_AFTER)
+                usleep(stall_seconds * 1e6);
+            received += length;
+            if (bytes_per_second > 0)
+            {
+                double ahead = received / bytes_per_second - bench::seconds_since(start);
+                if (ahead > 0)
+                    usleep(ahead * 1e6);
+            }
+        }
+        if (ssl != nullptr)
+            SSL_free(ssl);
+        close(connection);
+    }
+
+    void run_server(int slow_listener, int fast_listener, int stall_listener, double slow_rate, double stall_seconds)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        std::thread stalling([stall_listener, context, stall_seconds]() {
+                while (true)
+                {
+                    int connection = bench::accept_connection(stall_listener);
+                    std::thread([connection, context, stall_seconds]() { drain(connection, context, 0, stall_seconds); }).detach();
+                }
+            });
+        std::thread fast([fast_listener, context]() {
+                while (true)
+                {
+                    int connection = bench::accept_connection(fast_listener);
+                    std::thread([connection, context]() { drain(connection, context, 0); }).detach();
+                }
+            });
+        while (true)
+        {
+            int connection = bench::accept_connection(slow_listener);
+            std::thread([connection, context, slow_rate]() { drain(connection, context, slow_rate); }).detach();
+        }
+    }
+
+    struct result
+    {
+        uint64_t sent[2];
+        double seconds;
+        double longest_stall;
+        size_t peak_queued;
+        size_t queue_capacity;
+        size_t resident_growth;
+    };
+
+    ssl_socket open_socket(const std::string & port, bool secure)
+    {
+        ssl_socket s("127.0.0.1", port);
+        s.set_verify_peer(false).connect();
+        if (secure)
+            s.make_secure();
+        return s;
+    }
+
+    result measure_blocking(const std::string & slow_port, const std::string & fast_port, bool secure, double seconds, size_t message_size)
+    {
+        result outcome = {{0, 0}, 0, 0, 0, 0, 0};
+        ssl_socket peers[2] = {open_socket(slow_port, secure), open_socket(fast_port, secure)};
+        std::vector<uint8_t> message(message_size, 'm');
+        size_t baseline = bench::resident_set_size();
+
+        bench::clock::time_point start = bench::clock::now();
+        bench::clock::time_point previous = start;
+        while (bench::seconds_since(start) < seconds)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                peers[i].write(message.data(), message.size());
+                outcome.sent[i] += message.size();
+            }
+            bench::clock::time_point now = bench::clock::now();
+            outcome.longest_stall = std::max(outcome.longest_stall, std::chrono::duration<double>(now - previous).count());
+            previous = now;
+        }
+        outcome.seconds = bench::seconds_since(start);
+        outcome.resident_growth = bench::resident_set_size() - baseline;
+        return outcome;
+    }
+
+    result measure_queued(const std::string & slow_port, const std::string & fast_port, bool secure, double seconds, size_t message_size)
+    {
+        result outcome = {{0, 0}, 0, 0, 0, 0, 0};
+        socket_set peers;
+        bool paused[2] = {false, false};
+        for (int i = 0; i < 2; ++i)
+        {
+            size_t index = peers.add(open_socket(i == 0 ? slow_port : fast_port, secure), 0);
+            peers[index].set_high_watermark(HIGH_WATERMARK, [&paused, i]() { paused[i] = true; })
+                .set_low_watermark(LOW_WATERMARK, [&paused, i]() { paused[i] = false; });
+        }
+        std::vector<uint8_t> message(message_size, 'm');
+        size_t baseline = bench::resident_set_size();
+
+        uint64_t accepted[2] = {0, 0};
+        bench::clock::time_point start = bench::clock::now();
+        bench::clock::time_point previous = start;
+        while (bench::seconds_since(start) < seconds)
+        {
+            for (size_t i = 0; i < 2; ++i)
+            {
+                if (!paused[i] && peers[i].enqueue(message.data(), message.size()))
+                    accepted[i] += message.size();
+                outcome.peak_queued = std::max(outcome.peak_queued, peers[i].get_queued());
+                peers.refresh(i);
+            }
+            // Only wait when every producer is held back
+            peers.poll(std::chrono::milliseconds(paused[0] && paused[1] ? 10 : 0));
+
+            bench::clock::time_point now = bench::clock::now();
+            outcome.longest_stall = std::max(outcome.longest_stall, std::chrono::duration<double>(now - previous).count());
+            previous = now;
+        }
+        outcome.seconds = bench::seconds_since(start);
+        for (size_t i = 0; i < 2; ++i)
+        {
+            outcome.sent[i] = accepted[i] - peers[i].get_queued();
+            outcome.queue_capacity += peers[i].get_send_queue_capacity();
+        }
+        outcome.resident_growth = bench::resident_set_size() - baseline;
+        return outcome;
+    }
+
+    /**
+     * Push STALL_TRANSFER bytes with try_write and flush_queue to a
+     * reader that stalls partway
+     *
+     * @return the seconds the transfer took
+     * @throw ssl_socket_exception if the socket fails
+     */
+    double measure_stall(const std::string & port, bool secure, size_t message_size)
+    {
+        ssl_socket s = open_socket(port, secure);
+        std::vector<uint8_t> message(message_size, 'm');
+        bench::clock::time_point start = bench::clock::now();
+        for (uint64_t accepted = 0; accepted < STALL_TRANSFER || s.has_queued(); )
+        {
+            if (accepted < STALL_TRANSFER && s.get_queued() < HIGH_WATERMARK)
+            {
+                accepted += s.try_write(message.data(), std::min<uint64_t>(message.size(), STALL_TRANSFER - accepted));
+                continue;
+            }
+            struct pollfd descriptor = {s.get_descriptor(), POLLOUT, 0};
+            poll(&descriptor, 1, 100);
+            s.flush_queue();
+            if (!s.is_connected())
+                throw ssl_socket_exception("The reader hung up");
+        }
+        return bench::seconds_since(start);
+    }
+
+    void report(const char* mode, const result & outcome)
+    {
+        std::cout << mode << '\t'
+                  << outcome.sent[0] / 1048576.0 / outcome.seconds << '\t'
+                  << outcome.sent[1] / 1048576.0 / outcome.seconds << '\t'
+                  << outcome.longest_stall * 1e3 << '\t'
+                  << outcome.peak_queued / 1024 << '\t'
+                  << outcome.queue_capacity / 1024 << '\t'
+                  << outcome.resident_growth / 1024 << '\n';
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = 3;
+    double slow_rate = 10;
+    size_t message_size = 4096;
+    bool secure = false;
+    double stall_seconds = 4;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = std::stod(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+            slow_rate = std::stod(argv[++i]);
+        else if (strcmp(argv[i], "--message") == 0 && i + 1 < argc)
+            message_size = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--tls") == 0)
+            secure = true;
+        else if (strcmp(argv[i], "--stall") == 0 && i + 1 < argc)
+            stall_seconds = std::stod(argv[++i]);
+    }
+
+    // Disconnecting sends close_notify to readers that may have gone
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        int slow_listener = bench::listen_on_loopback();
+        int fast_listener = bench::listen_on_loopback();
+        int stall_listener = bench::listen_on_loopback();
+        std::string slow_port = bench::bound_port(slow_listener);
+        std::string fast_port = bench::bound_port(fast_listener);
+        std::string stall_port = bench::bound_port(stall_listener);
+        bench::child_process server([slow_listener, fast_listener, stall_listener, slow_rate, stall_seconds]() {
+                run_server(slow_listener, fast_listener, stall_listener, slow_rate * 1048576, stall_seconds);
+            });
+        close(slow_listener);
+        close(fast_listener);
+        close(stall_listener);
+
+        std::cout << "slow reader: " << slow_rate << " MB/s, message: " << message_size << " bytes, tls: " << (secure ? "yes" : "no") << '\n';
+        std::cout << "mode\tslow_MB/s\tfast_MB/s\tlongest_stall_ms\tpeak_queue_KB\tqueue_memory_KB\trss_growth_KB\n";
+        report("blocking", measure_blocking(slow_port, fast_port, secure, seconds, message_size));
+        report("queued", measure_queued(slow_port, fast_port, secure, seconds, message_size));
+        if (stall_seconds > 0)
+        {
+            double elapsed = measure_stall(stall_port, secure, message_size);
+            std::cout << "stall: " << STALL_TRANSFER / 1048576 << " MB through a " << stall_seconds
+                      << " s pause in " << elapsed << " s\n";
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
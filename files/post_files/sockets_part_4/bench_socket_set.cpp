@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "bench_common.h"
+#include "socket_set.h"
+#include "ssl_socket.h"
+
+/**
+ * Compares a socket_set against a vector of unique_ptr<ssl_socket>
+ * for holding many idle TLS connections. Usage:
+ *
+ *   bench_socket_set [count] [--sweeps N]
+ *
+ * The count defaults to 100000. For each layout it reports the
+ * resident memory per connection and the cost per connection of the
+ * sweep an event loop makes before every poll: gathering the
+ * descriptors and finding sockets with decrypted bytes already
+ * waiting in OpenSSL. The poll call itself is the same for both and
+ * is reported once for scale. Each layout runs in its own process so
+ * memory freed by one doesn't flatter the other.
+ */
+namespace
+{
+    const size_t CONNECTIONS_PER_PORT = 25000;
+
+    ssl_socket open_socket(const std::vector<std::string> & ports, size_t index)
+    {
+        ssl_socket s("127.0.0.1", ports[index / CONNECTIONS_PER_PORT]);
+        s.set_idle_mode(true).set_verify_peer(false).connect().make_secure();
+        return s;
+    }
+
+    void report(const char* layout, size_t count, size_t memory, double sweep_seconds, size_t sweeps, size_t ready)
+    {
+        std::cout << layout << '\t' << count << '\t'
+                  << memory / count << '\t'
+                  << sweep_seconds / sweeps / count * 1e9 << '\t'
+                  << ready << '\n';
+    }
+
+    void measure_pointers(const std::vector<std::string> & ports, size_t count, size_t sweeps)
+    {
+        std::vector<std::unique_ptr<ssl_socket>> sockets;
+        sockets.reserve(count);
+        size_t baseline = bench::resident_set_size();
+        for (size_t i = 0; i < count; ++i)
+            sockets.emplace_back(new ssl_socket(open_socket(ports, i)));
+        size_t memory = bench::resident_set_size() - baseline;
+
+        std::vector<struct pollfd> descriptors(count);
+        size_t ready = 0;
+        bench::clock::time_point start = bench::clock::now();
+        for (size_t sweep = 0; sweep < sweeps; ++sweep)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                ssl_socket & s = *sockets[i];
+                descriptors[i].fd = s.is_connected() ? s.get_descriptor() : -1;
+                descriptors[i].events = POLLIN;
+                ready += s.has_pending();
+            }
+        }
+        double sweep_seconds = bench::seconds_since(start);
+        report("unique_ptr", count, memory, sweep_seconds, sweeps, ready);
+
+        start = bench::clock::now();
+        poll(descriptors.data(), descriptors.size(), 0);
+        std::cout << "poll of " << count << " idle sockets: " << bench::seconds_since(start) * 1e6 << " us\n";
+    }
+
+    void measure_set(const std::vector<std::string> & ports, size_t count, size_t sweeps)
+    {
+        socket_set sockets;
+        size_t baseline = bench::resident_set_size();
+        for (size_t i = 0; i < count; ++i)
+            sockets.add(open_socket(ports, i));
+        size_t memory = bench::resident_set_size() - baseline;
+
+        const std::vector<uint8_t> & flags = sockets.get_flags();
+        const std::vector<uint32_t> & pending = sockets.get_pending();
+        size_t ready = 0;
+        bench::clock::time_point start = bench::clock::now();
+        for (size_t sweep = 0; sweep < sweeps; ++sweep)
+        {
+            // The descriptors are already in the array poll takes
+            for (size_t i = 0; i < count; ++i)
+                ready += (flags[i] & socket_set::flag_connected) && pending[i] != 0;
+        }
+        double sweep_seconds = bench::seconds_since(start);
+        report("socket_set", count, memory, sweep_seconds, sweeps, ready);
+    }
+
+    /**
+     * Run one layout in a child process and wait for it
+     *
+     * @return false if the child failed
+     */
+    bool run_layout(void (*measure)(const std::vector<std::string>&, size_t, size_t), const std::vector<std::string> & ports, size_t count, size_t sweeps)
+    {
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int status = 0;
+            try
+            {
+                measure(ports, count, sweeps);
+            } catch (const ssl_socket_exception & e) {
+                std::cerr << e.to_string() << '\n';
+                status = 1;
+            }
+            std::cout.flush();
+            _exit(status);
+        }
+        int status = 1;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = 100000;
+    size_t sweeps = 1000;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--sweeps") == 0 && i + 1 < argc)
+            sweeps = std::stoul(argv[++i]);
+        else
+            count = std::stoul(argv[i]);
+    }
+
+    try
+    {
+        size_t file_limit = bench::raise_file_limit();
+        if (file_limit < count + 64)
+        {
+            std::cerr << "Open file limit of " << file_limit << " is too low for " << count << " connections\n";
+            return 1;
+        }
+
+        std::vector<int> listeners;
+        std::vector<std::string> ports;
+        for (size_t i = 0; i * CONNECTIONS_PER_PORT < count; ++i)
+        {
+            listeners.push_back(bench::listen_on_loopback());
+            ports.push_back(bench::bound_port(listeners.back()));
+        }
+        bench::child_process server([&listeners]() { bench::serve_idle(listeners); });
+        for (int listener : listeners)
+            close(listener);
+
+        std::cout << "layout\tconnections\trss_bytes_per_conn\tsweep_ns_per_conn\tready\n";
+        if (!run_layout(measure_pointers, ports, count, sweeps) || !run_layout(measure_set, ports, count, sweeps))
+            return 1;
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
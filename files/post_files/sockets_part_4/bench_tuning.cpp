@@ -0,0 +1,187 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "ssl_socket.h"
+#include "tuning_profile.h"
+
+/**
+ * Compares the tuning profiles on the loopback interface with netem
+ * emulating a real path. Usage:
+ *
+ *   bench_tuning [--netem ARGS] [--upload MEGABYTES] [--trips N] [--message BYTES] [--tls]
+ *
+ * netem defaults to "delay 5ms loss 0.1%", which needs root; pass an
+ * empty string to run on the bare loopback. Each profile uploads to
+ * the server, since the profile only tunes the client's side of the
+ * connection, and then makes request/response round trips with each
+ * request written in two parts, like a header and a body, which is
+ * where Nagle's algorithm and delayed ACKs get in each other's way.
+ */
+namespace
+{
+    const size_t UPLOAD_BLOCK_SIZE = 64 * 1024;
+    const size_t REQUEST_HEADER_SIZE = 16;
+
+    double percentile(const std::vector<double> & sorted, double fraction)
+    {
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        return sorted[index];
+    }
+
+    void run_server(int listener, size_t message_size)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        while (true)
+        {
+            int connection = bench::accept_connection(listener);
+            bench::serve_commands(connection, context, message_size);
+        }
+    }
+
+    void read_exactly(ssl_socket & s, char* data, size_t length)
+    {
+        for (size_t received = 0; received < length; )
+        {
+            size_t read_size = s.read(data + received, length - received);
+            if (read_size > 0)
+            {
+                received += read_size;
+            } else if (!s.is_connected()) {
+                throw ssl_socket_exception("Server hung up");
+            } else {
+                s.wait_readable(std::chrono::seconds(1));
+            }
+        }
+    }
+
+    void open_socket(ssl_socket & s, const tuning_profile & profile, bool secure)
+    {
+        s.set_tuning_profile(profile).set_verify_peer(false).connect();
+        if (secure)
+            s.make_secure();
+    }
+
+    double measure_upload(const std::string & port, const tuning_profile & profile, bool secure, uint64_t upload_size)
+    {
+        ssl_socket s("127.0.0.1", port);
+        open_socket(s, profile, secure);
+        std::cout << s.get_tuning_report().to_string() << '\n';
+
+        std::string command(1, bench::UPLOAD_COMMAND);
+        command.append(reinterpret_cast<const char*>(&upload_size), sizeof(upload_size));
+        std::vector<uint8_t> block(UPLOAD_BLOCK_SIZE, 'u');
+        bench::clock::time_point start = bench::clock::now();
+        s.write(command);
+        for (uint64_t remaining = upload_size; remaining > 0; )
+        {
+            size_t length = std::min<uint64_t>(remaining, block.size());
+            s.write(block.data(), length);
+            remaining -= length;
+        }
+        char acknowledgement;
+        read_exactly(s, &acknowledgement, 1);
+        return upload_size / 1048576.0 / bench::seconds_since(start);
+    }
+
+    std::vector<double> measure_round_trips(const std::string & port, const tuning_profile & profile, bool secure, size_t round_trips, size_t message_size)
+    {
+        ssl_socket s("127.0.0.1", port);
+        open_socket(s, profile, secure);
+        s.write(std::string(1, bench::ECHO_COMMAND));
+
+        std::vector<uint8_t> request(message_size, 'r');
+        std::vector<char> response(message_size);
+        size_t header_size = std::min(REQUEST_HEADER_SIZE, message_size);
+        std::vector<double> latencies;
+        latencies.reserve(round_trips);
+        for (size_t i = 0; i < round_trips; ++i)
+        {
+            bench::clock::time_point start = bench::clock::now();
+            s.write(request.data(), header_size);
+            if (header_size < message_size)
+                s.write(request.data() + header_size, message_size - header_size);
+            read_exactly(s, response.data(), message_size);
+            latencies.push_back(bench::seconds_since(start) * 1e3);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string netem = "delay 5ms loss 0.1%";
+    uint64_t upload_size = 64 * 1048576ULL;
+    size_t round_trips = 200;
+    size_t message_size = 512;
+    bool secure = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--netem") == 0 && i + 1 < argc)
+            netem = argv[++i];
+        else if (strcmp(argv[i], "--upload") == 0 && i + 1 < argc)
+            upload_size = std::stoull(argv[++i]) * 1048576ULL;
+        else if (strcmp(argv[i], "--trips") == 0 && i + 1 < argc)
+            round_trips = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--message") == 0 && i + 1 < argc)
+            message_size = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--tls") == 0)
+            secure = true;
+    }
+
+    // The server hangs up after each upload while the client may still
+    // send its close_notify
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, message_size]() { run_server(listener, message_size); });
+        close(listener);
+        bench::netem_scope link(netem);
+
+        std::cout << "netem: " << (netem.empty() ? "none" : netem) << ", tls: " << (secure ? "yes" : "no") << '\n';
+        // A custom profile for contrast, the system default is often BBR already
+        tuning_profile custom("bulk-cubic");
+        custom.set_congestion_control("cubic").set_send_buffer(4 * 1048576).set_receive_buffer(4 * 1048576);
+        std::vector<tuning_profile> profiles = {tuning_profile(), tuning_profile::bulk(), custom, tuning_profile::interactive()};
+        std::vector<std::string> results;
+        for (const tuning_profile & profile : profiles)
+        {
+            double throughput = measure_upload(port, profile, secure, upload_size);
+            std::vector<double> latencies = measure_round_trips(port, profile, secure, round_trips, message_size);
+            results.push_back(profile.get_name() + '\t' + std::to_string(throughput) + '\t'
+                              + std::to_string(percentile(latencies, 0.5)) + '\t'
+                              + std::to_string(percentile(latencies, 0.99)));
+        }
+
+        std::cout << "profile\tupload_MB/s\tp50_ms\tp99_ms\n";
+        for (const std::string & result : results)
+            std::cout << result << '\n';
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,188 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "ssl_socket.h"
+
+/**
+ * Compares TCP loopback against a Unix domain socket, in plain text
+ * and over TLS. Usage:
+ *
+ *   bench_unix [round trips] [--message BYTES] [--bulk MEGABYTES]
+ *
+ * Each transport gets a small message echo test, reported as round
+ * trip percentiles in microseconds, and a bulk transfer from the
+ * server, reported in MB/s. One server handles both transports and
+ * tells TLS clients apart by their first byte.
+ */
+namespace
+{
+    const char UNIX_ADDRESS[] = "@bench_unix";
+
+    void run_server(int tcp_listener, int unix_listener, size_t message_size)
+    {
+        SSL_CTX* context = bench::make_server_context();
+        struct pollfd listeners[2] = {{tcp_listener, POLLIN, 0}, {unix_listener, POLLIN, 0}};
+        while (true)
+        {
+            // Clients connect one at a time, so take whichever is waiting
+            poll(listeners, 2, -1);
+            int connection = bench::accept_connection(listeners[0].revents & POLLIN ? tcp_listener : unix_listener);
+            bench::serve_commands(connection, context, message_size);
+        }
+    }
+
+    double percentile(const std::vector<double> & sorted, double fraction)
+    {
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        return sorted[index];
+    }
+
+    /**
+     * Read exactly length bytes, waiting as needed
+     *
+     * @throw ssl_socket_exception if the server hangs up first
+     */
+    void read_exactly(ssl_socket & s, char* data, size_t length)
+    {
+        for (size_t received = 0; received < length; )
+        {
+            size_t read_size = s.read(data + received, length - received);
+            if (read_size > 0)
+            {
+                received += read_size;
+            } else if (!s.is_connected()) {
+                throw ssl_socket_exception("Server hung up");
+            } else {
+                s.wait_readable(std::chrono::seconds(1));
+            }
+        }
+    }
+
+    ssl_socket& open_socket(ssl_socket & s, bool secure)
+    {
+        s.set_verify_peer(false).connect();
+        if (secure)
+            s.make_secure();
+        return s;
+    }
+
+    std::vector<double> measure_round_trips(const std::string & host, const std::string & port, bool secure, size_t round_trips, size_t message_size)
+    {
+        ssl_socket s(host, port);
+        open_socket(s, secure).write(std::string(1, bench::ECHO_COMMAND));
+
+        std::vector<char> request(message_size, 'r');
+        std::vector<char> response(message_size);
+        std::vector<double> latencies;
+        latencies.reserve(round_trips);
+        for (size_t i = 0; i < round_trips; ++i)
+        {
+            bench::clock::time_point start = bench::clock::now();
+            s.write(reinterpret_cast<uint8_t*>(request.data()), request.size());
+            read_exactly(s, response.data(), message_size);
+            latencies.push_back(bench::seconds_since(start) * 1e6);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    }
+
+    double measure_throughput(const std::string & host, const std::string & port, bool secure, uint64_t bulk_size)
+    {
+        ssl_socket s(host, port);
+        open_socket(s, secure);
+
+        std::string command(1, bench::BULK_COMMAND);
+        command.append(reinterpret_cast<const char*>(&bulk_size), sizeof(bulk_size));
+        bench::clock::time_point start = bench::clock::now();
+        s.write(command);
+
+        std::vector<char> buffer;
+        uint64_t received = 0;
+        while (received < bulk_size)
+        {
+            size_t length = s.read(buffer);
+            if (length > 0)
+            {
+                received += length;
+            } else if (!s.is_connected()) {
+                throw ssl_socket_exception("Server hung up");
+            } else {
+                s.wait_readable(std::chrono::seconds(1));
+            }
+        }
+        return received / 1048576.0 / bench::seconds_since(start);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t round_trips = 100000;
+    size_t message_size = 64;
+    uint64_t bulk_size = 1024 * 1048576ULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--message") == 0 && i + 1 < argc)
+            message_size = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--bulk") == 0 && i + 1 < argc)
+            bulk_size = std::stoull(argv[++i]) * 1048576ULL;
+        else
+            round_trips = std::stoul(argv[i]);
+    }
+
+    // The server hangs up after bulk transfers, so the close_notify
+    // sent when the client disconnects may hit a closed socket
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        int tcp_listener = bench::listen_on_loopback();
+        int unix_listener = bench::listen_on_unix(UNIX_ADDRESS);
+        std::string port = bench::bound_port(tcp_listener);
+        bench::child_process server([tcp_listener, unix_listener, message_size]() {
+                run_server(tcp_listener, unix_listener, message_size);
+            });
+        close(tcp_listener);
+        close(unix_listener);
+
+        std::cout << "transport\ttls\ttrips\tp50_us\tp99_us\tMB/s\n";
+        for (bool secure : {false, true})
+        {
+            for (bool unix_socket : {false, true})
+            {
+                std::string host = unix_socket ? std::string("unix:") + UNIX_ADDRESS : "127.0.0.1";
+                std::vector<double> latencies = measure_round_trips(host, port, secure, round_trips, message_size);
+                double throughput = measure_throughput(host, port, secure, bulk_size);
+                std::cout << (unix_socket ? "unix" : "tcp") << '\t' << (secure ? "yes" : "no") << '\t'
+                          << round_trips << '\t'
+                          << percentile(latencies, 0.5) << '\t'
+                          << percentile(latencies, 0.99) << '\t'
+                          << throughput << '\n';
+            }
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include "bench_common.h"
+#include "certificate_verifier.h"
+#include "ssl_socket.h"
+
+/**
+ * Measures the client CPU time of a TLS handshake with verification
+ * off, with verification but no cache and with the verified chain
+ * cache. Usage:
+ *
+ *   bench_verify [handshakes]
+ *
+ * The server presents a certificate for localhost issued by a CA
+ * generated for this run, which is the only certificate the client
+ * trusts.
+ */
+namespace
+{
+    double process_cpu_seconds()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+    }
+
+    void run_server(int listener, const bench::test_authority & authority)
+    {
+        SSL_CTX* context = authority.make_server_context("localhost");
+        while (true)
+        {
+            int connection = bench::accept_connection(listener);
+            SSL* ssl = SSL_new(context);
+            SSL_set_fd(ssl, connection);
+            if (SSL_accept(ssl) == 1)
+                SSL_shutdown(ssl);
+            SSL_free(ssl);
+            close(connection);
+        }
+    }
+
+    void run_handshakes(const char* name, const std::string & port, size_t handshakes, bool verify)
+    {
+        certificate_verifier::statistics before = certificate_verifier::get_statistics();
+        double cpu_seconds = 0;
+        double wall_seconds = 0;
+        for (size_t i = 0; i < handshakes; ++i)
+        {
+            ssl_socket s("localhost", port);
+            s.set_verify_peer(verify).connect();
+
+            bench::clock::time_point start = bench::clock::now();
+            double cpu_start = process_cpu_seconds();
+            s.make_secure();
+            cpu_seconds += process_cpu_seconds() - cpu_start;
+            wall_seconds += bench::seconds_since(start);
+        }
+        certificate_verifier::statistics after = certificate_verifier::get_statistics();
+        std::cout << name << '\t' << cpu_seconds / handshakes * 1e6 << '\t'
+                  << wall_seconds / handshakes * 1e6 << '\t'
+                  << after.verifications - before.verifications << '\t'
+                  << after.cache_hits - before.cache_hits << '\n';
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t handshakes = argc > 1 ? std::stoul(argv[1]) : 1000;
+
+    try
+    {
+        bench::test_authority authority;
+        char ca_path[] = "/tmp/bench_verify_ca_XXXXXX";
+        int ca_file = mkstemp(ca_path);
+        if (ca_file < 0)
+        {
+            throw ssl_socket_exception("Unable to create a temporary file for the CA");
+        }
+        close(ca_file);
+        authority.write_certificate(ca_path);
+        certificate_verifier::use_ca_file(ca_path);
+
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, &authority]() { run_server(listener, authority); });
+        close(listener);
+
+        std::cout << "mode\tcpu_us\twall_us\tverified\tcache_hits\n";
+        run_handshakes("off", port, handshakes, false);
+
+        certificate_verifier::set_cache_lifetime(std::chrono::seconds(0));
+        run_handshakes("uncached", port, handshakes, true);
+
+        certificate_verifier::set_cache_lifetime(std::chrono::hours(1));
+        run_handshakes("cached", port, handshakes, true);
+
+        unlink(ca_path);
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "fault_injection.h"
+#include "ssl_socket.h"
+#include "warm_pool.h"
+
+/**
+ * Measures the latency of the first requests of a burst, with every
+ * request setting up its own connection and with connections taken
+ * from a warm_pool. Usage:
+ *
+ *   bench_warmup [--bursts N] [--burst N] [--gap MILLISECONDS]
+ *                [--setup-delay MILLISECONDS]
+ *
+ * Each of --bursts (6) bursts starts --burst (16) requests at once,
+ * each on its own thread, --gap (1000ms) apart. A request is one echo
+ * round trip over TLS. The local server waits --setup-delay (20ms)
+ * before answering a new connection, standing in for the round trips
+ * that make setup expensive over a real network. Reported per burst
+ * are the p50 and slowest request in milliseconds and, for the warm
+ * pool, how many requests found a warm connection and the pool's
+ * target afterwards.
+ */
+namespace
+{
+    const size_t MESSAGE_SIZE = 64;
+
+    void read_exactly(ssl_socket & s, char* data, size_t length)
+    {
+        for (size_t received = 0; received < length; )
+        {
+            size_t read_size = s.read(data + received, length - received);
+            if (read_size > 0)
+            {
+                received += read_size;
+            } else if (!s.is_connected()) {
+                throw ssl_socket_exception("Server hung up");
+            } else {
+                s.wait_readable(std::chrono::seconds(1));
+            }
+        }
+    }
+
+    ssl_socket connect_cold(const std::string & port)
+    {
+        ssl_socket s("127.0.0.1", port);
+        s.set_verify_peer(false).connect().make_secure();
+        return s;
+    }
+
+    /**
+     * Run one burst of requests, each getting its connection from open
+     *
+     * @return the latency of every request in milliseconds, sorted
+     */
+    std::vector<double> run_burst(size_t burst, const std::function<ssl_socket()> & open)
+    {
+        std::vector<double> latencies(burst, -1);
+        std::vector<std::thread> requests;
+        for (size_t i = 0; i < burst; ++i)
+        {
+            requests.emplace_back([i, &open, &latencies]() {
+                    bench::clock::time_point start = bench::clock::now();
+                    try
+                    {
+                        ssl_socket s = open();
+                        std::string request(1, bench::ECHO_COMMAND);
+                        request.append(MESSAGE_SIZE, 'r');
+                        s.write(request);
+                        std::vector<char> response(MESSAGE_SIZE);
+                        read_exactly(s, response.data(), response.size());
+                        latencies[i] = bench::seconds_since(start) * 1e3;
+                    } catch (const ssl_socket_exception & e) {
+                        std::cerr << e.to_string() << '\n';
+                    }
+                });
+        }
+        for (std::thread & request : requests)
+        {
+            request.join();
+        }
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t bursts = 6;
+    size_t burst = 16;
+    std::chrono::milliseconds gap(1000);
+    uint64_t setup_delay = 20;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--bursts") == 0 && i + 1 < argc)
+            bursts = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc)
+            burst = std::stoul(argv[++i]);
+        else if (strcmp(argv[i], "--gap") == 0 && i + 1 < argc)
+            gap = std::chrono::milliseconds(std::stoul(argv[++i]));
+        else if (strcmp(argv[i], "--setup-delay") == 0 && i + 1 < argc)
+            setup_delay = std::stoull(argv[++i]);
+    }
+
+    // Warm connections are closed while the server may still write
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        bench::fault_plan plan = bench::fault_plan::parse("accept_delay_ms=" + std::to_string(setup_delay));
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener, &plan]() {
+                bench::serve_faults(listener, bench::make_server_context(), plan, MESSAGE_SIZE);
+            });
+        close(listener);
+
+        warm_pool pool("127.0.0.1", port);
+        pool.set_target(1, burst).set_configure([](ssl_socket & s) { s.set_verify_peer(false); });
+
+        std::cout << "mode\tburst\tp50_ms\tmax_ms\twarm_hits\ttarget\n";
+        for (bool warm : {false, true})
+        {
+            if (warm)
+                pool.start();
+            for (size_t i = 0; i < bursts; ++i)
+            {
+                std::this_thread::sleep_for(gap);
+                uint64_t hits = pool.get_statistics().hits;
+                std::vector<double> latencies = warm
+                    ? run_burst(burst, [&pool]() { return pool.acquire(); })
+                    : run_burst(burst, [&port]() { return connect_cold(port); });
+                warm_pool::statistics statistics = pool.get_statistics();
+                std::cout << (warm ? "warm" : "cold") << '\t' << i << '\t'
+                          << latencies[latencies.size() / 2] << '\t'
+                          << latencies.back() << '\t';
+                if (warm)
+                    std::cout << statistics.hits - hits << '\t' << statistics.target << '\n';
+                else
+                    std::cout << "-\t-\n";
+            }
+        }
+        warm_pool::statistics statistics = pool.get_statistics();
+        std::cout << "setup " << statistics.setup_time.count() / 1e3 << " ms, "
+                  << statistics.discarded << " discarded, "
+                  << statistics.failures << " failed" << std::endl;
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <strings.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "websocket_client.h"
+
+/**
+ * Measures websocket_client against a local echo server. Usage:
+ *
+ *   bench_websocket [seconds per size]
+ *
+ * First the masking implementations are checked against each other
+ * and timed on their own in GB/s, then messages of each size are
+ * echoed with up to 256KB in flight and reported in messages/s and
+ * MB/s. The echo server runs in a child process, in plain text so the
+ * numbers are about framing and masking rather than TLS.
+ */
+namespace
+{
+    const size_t MASK_BUFFER_SIZE = 16 * 1024 * 1024;
+    const size_t MASK_ROUNDS = 64;
+    const size_t WINDOW_BYTES = 256 * 1024;
+    const size_t MAX_WINDOW_MESSAGES = 64;
+
+    bool read_some(int connection, std::vector<uint8_t> & buffer)
+    {
+        uint8_t block[64 * 1024];
+        ssize_t read_size = read(connection, block, sizeof(block));
+        if (read_size <= 0)
+            return false;
+        buffer.insert(buffer.end(), block, block + read_size);
+        return true;
+    }
+
+    bool write_all(int connection, const uint8_t* data, size_t length)
+    {
+        for (size_t sent = 0; sent < length; )
+        {
+            ssize_t write_size = write(connection, data + sent, length - sent);
+            if (write_size <= 0)
+                return false;
+            sent += write_size;
+        }
+        return true;
+    }
+
+    /**
+     * Answer the upgrade, then send every frame back unmasked until the
+     * client closes
+     */
+    void echo_connection(int connection)
+    {
+        std::vector<uint8_t> input;
+        const char header_end[] = "\r\n\r\n";
+        std::vector<uint8_t>::iterator end;
+        while ((end = std::search(input.begin(), input.end(), header_end, header_end + 4)) == input.end())
+        {
+            if (!read_some(connection, input))
+                return;
+        }
+        std::string request(input.begin(), end);
+        input.erase(input.begin(), end + 4);
+
+        const char key_header[] = "\r\nSec-WebSocket-Key:";
+        std::string key;
+        for (size_t i = 0; i + sizeof(key_header) - 1 < request.size() && key.empty(); ++i)
+        {
+            if (strncasecmp(request.c_str() + i, key_header, sizeof(key_header) - 1) == 0)
+            {
+                size_t start = request.find_first_not_of(' ', i + sizeof(key_header) - 1);
+                key = request.substr(start, request.find("\r\n", start) - start);
+            }
+        }
+        std::string response = "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: " + websocket_accept_key(key) + "\r\n\r\n";
+        if (!write_all(connection, reinterpret_cast<const uint8_t*>(response.data()), response.size()))
+            return;
+
+        std::vector<uint8_t> output;
+        size_t start = 0;
+        while (true)
+        {
+            websocket_frame_header header;
+            bool complete = decode_frame_header(input.data() + start, input.size() - start, header)
+                && input.size() - start - header.header_size >= header.length;
+            if (!complete)
+            {
+                input.erase(input.begin(), input.begin() + start);
+                start = 0;
+                if (!read_some(connection, input))
+                    return;
+                continue;
+            }
+
+            uint8_t* payload = input.data() + start + header.header_size;
+            if (header.masked)
+            {
+                websocket_mask(payload, header.length, header.mask_key);
+            }
+            output.resize(MAX_FRAME_HEADER_SIZE + header.length);
+            size_t header_size = encode_frame_header(output.data(), header.opcode, header.final, header.length, nullptr);
+            memcpy(output.data() + header_size, payload, header.length);
+            if (!write_all(connection, output.data(), header_size + header.length) || header.opcode == websocket_opcode::close)
+                return;
+            start += header.header_size + header.length;
+        }
+    }
+
+    void run_echo_server(int listener)
+    {
+        while (true)
+        {
+            int connection = bench::accept_connection(listener);
+            try
+            {
+                echo_connection(connection);
+            } catch (const ssl_socket_exception & e) {
+                std::cerr << "echo server: " << e.to_string() << '\n';
+            }
+            close(connection);
+        }
+    }
+
+    const char* implementation_name(mask_implementation implementation)
+    {
+        switch (implementation)
+        {
+          case mask_implementation::scalar:
+            return "scalar";
+          case mask_implementation::sse2:
+            return "sse2";
+          case mask_implementation::avx2:
+            return "avx2";
+          default:
+            return "automatic";
+        }
+    }
+
+    /**
+     * Mask random data of assorted lengths and offsets with every
+     * implementation and compare against the scalar code
+     */
+    bool check_masking()
+    {
+        std::mt19937 generator(42);
+        std::vector<uint8_t> original(4096 + 64);
+        for (uint8_t & byte : original)
+            byte = static_cast<uint8_t>(generator());
+        const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+        const mask_implementation implementations[] = {mask_implementation::sse2, mask_implementation::avx2};
+        for (size_t length = 0; length < 300; ++length)
+        {
+            for (uint64_t offset = 0; offset < 4; ++offset)
+            {
+                std::vector<uint8_t> expected(original.begin() + 1, original.begin() + 1 + length);
+                websocket_mask(expected.data(), length, key, offset, mask_implementation::scalar);
+                for (mask_implementation implementation : implementations)
+                {
+                    std::vector<uint8_t> actual(original.begin() + 1, original.begin() + 1 + length);
+                    websocket_mask(actual.data(), length, key, offset, implementation);
+                    if (actual != expected)
+                    {
+                        std::cerr << implementation_name(implementation) << " masking differs at length " << length << " offset " << offset << '\n';
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    void time_masking()
+    {
+        // One byte in so the vector loads are unaligned, as payloads
+        // after a frame header usually are
+        std::vector<uint8_t> buffer(MASK_BUFFER_SIZE + 1, 'm');
+        const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+        const mask_implementation implementations[] = {mask_implementation::scalar, mask_implementation::sse2, mask_implementation::avx2};
+        std::cout << "mask\tGB/s\n";
+        for (mask_implementation implementation : implementations)
+        {
+            if (!is_mask_supported(implementation))
+            {
+                std::cout << implementation_name(implementation) << "\tunsupported\n";
+                continue;
+            }
+            bench::clock::time_point start = bench::clock::now();
+            for (size_t round = 0; round < MASK_ROUNDS; ++round)
+            {
+                websocket_mask(buffer.data() + 1, MASK_BUFFER_SIZE, key, round, implementation);
+            }
+            double seconds = bench::seconds_since(start);
+            std::cout << implementation_name(implementation) << '\t'
+                      << MASK_ROUNDS * MASK_BUFFER_SIZE / 1e9 / seconds << '\n';
+        }
+    }
+
+    void run_echo(const std::string & port, size_t message_size, double seconds)
+    {
+        websocket_client client("127.0.0.1", port, "/echo");
+        client.set_secure(false).connect();
+
+        std::string message(message_size, 'w');
+        websocket_message reply;
+        size_t window = std::max<size_t>(1, std::min(MAX_WINDOW_MESSAGES, WINDOW_BYTES / message_size));
+        size_t in_flight = 0;
+        size_t echoed = 0;
+        bench::clock::time_point start = bench::clock::now();
+        while (bench::seconds_since(start) < seconds || in_flight > 0)
+        {
+            while (in_flight < window && bench::seconds_since(start) < seconds)
+            {
+                client.send_binary(message.data(), message.size());
+                ++in_flight;
+            }
+            if (!client.receive(reply, std::chrono::seconds(5)))
+            {
+                throw ssl_socket_exception("Echo timed out");
+            }
+            if (reply.data.size() != message_size)
+            {
+                throw ssl_socket_exception("Echo came back the wrong size");
+            }
+            --in_flight;
+            ++echoed;
+        }
+        double elapsed = bench::seconds_since(start);
+        client.close();
+
+        std::cout << message_size << '\t' << echoed / elapsed << '\t'
+                  << echoed * static_cast<double>(message_size) / 1048576.0 / elapsed << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = argc > 1 ? std::stod(argv[1]) : 2.0;
+
+    if (!check_masking())
+    {
+        return 1;
+    }
+    time_masking();
+
+    try
+    {
+        int listener = bench::listen_on_loopback();
+        std::string port = bench::bound_port(listener);
+        bench::child_process server([listener]() { run_echo_server(listener); });
+        close(listener);
+
+        const size_t message_sizes[] = {16, 256, 4096, 65536, 1048576};
+        std::cout << "bytes\tmsgs/s\tMB/s\n";
+        for (size_t message_size : message_sizes)
+        {
+            run_echo(port, message_size, seconds);
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "bench_common.h"
+#include "ssl_socket.h"
+
+/**
+ * Measures the sender's CPU time per GB for plain writes of each size,
+ * copied into the kernel and sent with MSG_ZEROCOPY. Usage:
+ *
+ *   bench_zerocopy [megabytes per run] [--host HOST --port PORT]
+ *
+ * Without --host a local server in a child process discards the data.
+ * Zero copy sends to loopback are copied on delivery anyway, so the
+ * crossover found locally is pessimistic; point --host at a discard
+ * server (ex: "socat TCP-LISTEN:9000,fork /dev/null") on another
+ * machine to measure a real NIC. The copied column is the fraction of
+ * zero copy sends the kernel ended up copying.
+ */
+namespace
+{
+    /**
+     * Writes cycle through this many buffers, each one is reused only
+     * after the kernel has released it
+     */
+    const size_t BUFFER_COUNT = 4;
+
+    void run_discard_server(int listener)
+    {
+        std::vector<char> buffer(1024 * 1024);
+        while (true)
+        {
+            int connection = bench::accept_connection(listener);
+            while (read(connection, buffer.data(), buffer.size()) > 0)
+            {
+            }
+            close(connection);
+        }
+    }
+
+    double cpu_seconds()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+            + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    }
+
+    void run_size(const std::string & host, const std::string & port, size_t write_size, uint64_t total, bool zerocopy)
+    {
+        ssl_socket s(host, port);
+        s.set_zerocopy_threshold(zerocopy ? write_size : 0).connect();
+
+        std::vector<std::vector<uint8_t>> buffers(BUFFER_COUNT, std::vector<uint8_t>(write_size, 'z'));
+        std::vector<uint32_t> marks(BUFFER_COUNT, s.get_zerocopy_mark());
+        size_t writes = std::max<uint64_t>(total / write_size, 1);
+
+        double cpu_start = cpu_seconds();
+        bench::clock::time_point start = bench::clock::now();
+        for (size_t i = 0; i < writes; ++i)
+        {
+            size_t current = i % BUFFER_COUNT;
+            while (!s.wait_zerocopy(marks[current], std::chrono::seconds(1)))
+            {
+            }
+            s.write(buffers[current].data(), write_size);
+            marks[current] = s.get_zerocopy_mark();
+        }
+        while (!s.wait_zerocopy(s.get_zerocopy_mark(), std::chrono::seconds(1)))
+        {
+        }
+        double elapsed = bench::seconds_since(start);
+        double cpu = cpu_seconds() - cpu_start;
+
+        double gigabytes = static_cast<double>(writes) * write_size / (1024.0 * 1048576.0);
+        size_t sends = s.get_zerocopy_mark();
+        std::cout << write_size / 1024 << '\t' << (zerocopy ? "zerocopy" : "copy") << '\t'
+                  << cpu / gigabytes << '\t'
+                  << gigabytes * 1024 / elapsed << '\t'
+                  << (sends > 0 ? static_cast<double>(s.get_zerocopy_copied()) / sends : 0) << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t total = 2048 * 1048576ULL;
+    std::string host;
+    std::string port;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+            host = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+            port = argv[++i];
+        else
+            total = std::stoull(argv[i]) * 1048576ULL;
+    }
+
+    try
+    {
+        std::unique_ptr<bench::child_process> server;
+        if (host.empty())
+        {
+            int listener = bench::listen_on_loopback();
+            host = "127.0.0.1";
+            port = bench::bound_port(listener);
+            server.reset(new bench::child_process([listener]() { run_discard_server(listener); }));
+            close(listener);
+        }
+
+        const size_t write_sizes[] = {4096, 16384, 65536, 262144, 1048576, 4194304, 16777216};
+        std::cout << "write_kb\tmode\tcpu_s_per_gb\tMB/s\tcopied\n";
+        for (size_t write_size : write_sizes)
+        {
+            run_size(host, port, write_size, total, false);
+            run_size(host, port, write_size, total, true);
+        }
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
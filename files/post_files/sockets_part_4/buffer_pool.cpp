@@ -0,0 +1,250 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "buffer_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+namespace
+{
+    const size_t SLAB_SIZE = 256 * 1024;
+
+    /**
+     * The most each thread caches per class, in bytes. Going over
+     * moves half of the cache to the shared list.
+     */
+    const size_t THREAD_CACHE_BYTES = 256 * 1024;
+
+    /**
+     * Free buffers are linked through their first bytes
+     */
+    struct free_buffer
+    {
+        free_buffer* next;
+    };
+
+    struct size_class
+    {
+        std::mutex lock;
+        free_buffer* free_list;
+        std::atomic<size_t> in_use;
+        std::atomic<size_t> cached;
+        std::atomic<size_t> free;
+        std::atomic<size_t> slabs;
+        std::atomic<uint64_t> acquisitions;
+    };
+
+    size_class classes[buffer_pool::CLASS_COUNT];
+
+    size_t cache_limit(uint32_t index)
+    {
+        return THREAD_CACHE_BYTES / buffer_pool::CLASS_SIZES[index];
+    }
+
+    /**
+     * Move up to count buffers from list onto the shared list
+     *
+     * @return what is left of list
+     */
+    free_buffer* give_to_shared(uint32_t index, free_buffer* list, size_t count)
+    {
+        size_class & pool = classes[index];
+        std::lock_guard<std::mutex> guard(pool.lock);
+        size_t moved = 0;
+        for (; moved < count && list != nullptr; ++moved)
+        {
+            free_buffer* next = list->next;
+            list->next = pool.free_list;
+            pool.free_list = list;
+            list = next;
+        }
+        pool.free.fetch_add(moved, std::memory_order_relaxed);
+        return list;
+    }
+
+    /**
+     * Each thread's free buffers, handed to the shared list when the
+     * thread exits
+     */
+    class thread_cache
+    {
+      public:
+        thread_cache():
+            lists(),
+            counts()
+        {}
+
+        ~thread_cache()
+        {
+            for (uint32_t index = 0; index < buffer_pool::CLASS_COUNT; ++index)
+            {
+                classes[index].cached.fetch_sub(counts[index], std::memory_order_relaxed);
+                give_to_shared(index, lists[index], counts[index]);
+            }
+        }
+
+        char* take(uint32_t index)
+        {
+            if (lists[index] == nullptr)
+                refill(index);
+            free_buffer* taken = lists[index];
+            lists[index] = taken->next;
+            --counts[index];
+            classes[index].cached.fetch_sub(1, std::memory_order_relaxed);
+            return reinterpret_cast<char*>(taken);
+        }
+
+        void give(uint32_t index, char* storage)
+        {
+            free_buffer* returned = reinterpret_cast<free_buffer*>(storage);
+            returned->next = lists[index];
+            lists[index] = returned;
+            ++counts[index];
+            classes[index].cached.fetch_add(1, std::memory_order_relaxed);
+            if (counts[index] > cache_limit(index))
+            {
+                size_t spill = counts[index] / 2;
+                lists[index] = give_to_shared(index, lists[index], spill);
+                counts[index] -= spill;
+                classes[index].cached.fetch_sub(spill, std::memory_order_relaxed);
+            }
+        }
+
+      private:
+        /**
+         * Take half a cache worth from the shared list, or carve a new
+         * slab if it is empty
+         */
+        void refill(uint32_t index)
+        {
+            size_class & pool = classes[index];
+            size_t wanted = std::max<size_t>(cache_limit(index) / 2, 1);
+            size_t taken = 0;
+            {
+                std::lock_guard<std::mutex> guard(pool.lock);
+                while (taken < wanted && pool.free_list != nullptr)
+                {
+                    free_buffer* next = pool.free_list->next;
+                    pool.free_list->next = lists[index];
+                    lists[index] = pool.free_list;
+                    pool.free_list = next;
+                    ++taken;
+                }
+                pool.free.fetch_sub(taken, std::memory_order_relaxed);
+            }
+
+            if (taken == 0)
+            {
+                size_t buffer_size = buffer_pool::CLASS_SIZES[index];
+                char* slab = static_cast<char*>(::operator new(SLAB_SIZE));
+                pool.slabs.fetch_add(1, std::memory_order_relaxed);
+                for (size_t offset = 0; offset + buffer_size <= SLAB_SIZE; offset += buffer_size)
+                {
+                    free_buffer* carved = reinterpret_cast<free_buffer*>(slab + offset);
+                    carved->next = lists[index];
+                    lists[index] = carved;
+                    ++taken;
+                }
+            }
+            counts[index] += taken;
+            pool.cached.fetch_add(taken, std::memory_order_relaxed);
+        }
+
+        free_buffer* lists[buffer_pool::CLASS_COUNT];
+        size_t counts[buffer_pool::CLASS_COUNT];
+    };
+
+    thread_local thread_cache cache;
+}
+
+buffer_pool::buffer::buffer():
+    storage(nullptr),
+    size_class(0)
+{
+
+}
+
+buffer_pool::buffer::buffer(char* _storage, uint32_t _size_class):
+    storage(_storage),
+    size_class(_size_class)
+{
+
+}
+
+buffer_pool::buffer::~buffer()
+{
+    release();
+}
+
+buffer_pool::buffer::buffer(buffer && other) noexcept:
+    storage(other.storage),
+    size_class(other.size_class)
+{
+    other.storage = nullptr;
+}
+
+buffer_pool::buffer& buffer_pool::buffer::operator=(buffer && other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        storage = other.storage;
+        size_class = other.size_class;
+        other.storage = nullptr;
+    }
+    return *this;
+}
+
+void buffer_pool::buffer::release()
+{
+    if (storage == nullptr)
+        return;
+    classes[size_class].in_use.fetch_sub(1, std::memory_order_relaxed);
+    cache.give(size_class, storage);
+    storage = nullptr;
+}
+
+buffer_pool::buffer buffer_pool::acquire(size_t minimum)
+{
+    uint32_t index = 0;
+    while (index + 1 < CLASS_COUNT && CLASS_SIZES[index] < minimum)
+        ++index;
+    char* storage = cache.take(index);
+    classes[index].in_use.fetch_add(1, std::memory_order_relaxed);
+    classes[index].acquisitions.fetch_add(1, std::memory_order_relaxed);
+    return buffer(storage, index);
+}
+
+std::vector<buffer_pool::statistics> buffer_pool::get_statistics()
+{
+    std::vector<statistics> snapshot;
+    for (uint32_t index = 0; index < CLASS_COUNT; ++index)
+    {
+        const size_class & pool = classes[index];
+        statistics stats = {
+            CLASS_SIZES[index],
+            pool.in_use.load(std::memory_order_relaxed),
+            pool.cached.load(std::memory_order_relaxed),
+            pool.free.load(std::memory_order_relaxed),
+            pool.slabs.load(std::memory_order_relaxed),
+            pool.slabs.load(std::memory_order_relaxed) * SLAB_SIZE,
+            pool.acquisitions.load(std::memory_order_relaxed)
+        };
+        snapshot.push_back(stats);
+    }
+    return snapshot;
+}
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Process wide pool of fixed size I/O buffers (4KB, 16KB and 64KB)
+ * for reading from many connections. A connection draws a buffer when
+ * data arrives and gives it back once the data is handled, so idle
+ * connections hold none. Buffers are carved out of large slabs and
+ * each thread keeps a small cache of free buffers, so most acquires
+ * and releases never take a lock or reach malloc. Slabs are never
+ * returned, the pool only grows to its high water mark.
+ */
+namespace buffer_pool
+{
+    const size_t CLASS_COUNT = 3;
+    const size_t CLASS_SIZES[CLASS_COUNT] = {4 * 1024, 16 * 1024, 64 * 1024};
+
+    /**
+     * Occupancy of one size class
+     */
+    struct statistics
+    {
+        size_t buffer_size;
+        size_t in_use; ///< Buffers handed out right now
+        size_t cached; ///< Free buffers in thread caches
+        size_t free; ///< Free buffers on the shared list
+        size_t slabs; ///< Slabs carved into buffers of this size
+        size_t bytes_reserved; ///< Memory held by those slabs
+        uint64_t acquisitions; ///< Buffers handed out since the start
+    };
+
+    /**
+     * A buffer owned by the caller until it is released or destroyed,
+     * which gives it back to the pool
+     */
+    class buffer
+    {
+      public:
+        buffer();
+        ~buffer();
+        buffer(buffer const&) = delete;
+        buffer& operator=(buffer const&) = delete;
+        buffer(buffer && other) noexcept;
+        buffer& operator=(buffer && other) noexcept;
+
+        char* data() const { return storage; }
+        size_t size() const { return storage != nullptr ? CLASS_SIZES[size_class] : 0; }
+        bool empty() const { return storage == nullptr; }
+
+        /**
+         * Give the buffer back to the pool, leaving this empty
+         */
+        void release();
+
+      private:
+        friend buffer acquire(size_t minimum);
+        buffer(char* _storage, uint32_t _size_class);
+
+        char* storage;
+        uint32_t size_class;
+    };
+
+    /**
+     * Get a buffer of the smallest class that holds minimum bytes, or
+     * of the largest class if none does
+     *
+     * @throw std::bad_alloc if a new slab can't be allocated
+     */
+    buffer acquire(size_t minimum);
+
+    /**
+     * Snapshot of every size class, smallest first
+     */
+    std::vector<statistics> get_statistics();
+}
@@ -0,0 +1,162 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "bulk_resolver.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace
+{
+    const size_t DEFAULT_CONCURRENCY = 64;
+
+    /**
+     * Collect the addresses from a getaddrinfo list, sorted and
+     * without duplicates
+     */
+    std::vector<resolved_address> collect_addresses(struct addrinfo* address_info)
+    {
+        std::vector<resolved_address> addresses;
+        for (struct addrinfo* current = address_info; current != nullptr; current = current->ai_next)
+        {
+            resolved_address address = {current->ai_family, {0}};
+            switch (current->ai_family)
+            {
+              case AF_INET:
+                memcpy(address.bytes, &((struct sockaddr_in*)current->ai_addr)->sin_addr, 4);
+                break;
+              case AF_INET6:
+                memcpy(address.bytes, &((struct sockaddr_in6*)current->ai_addr)->sin6_addr, 16);
+                break;
+              default:
+                continue;
+            }
+            addresses.push_back(address);
+        }
+        std::sort(addresses.begin(), addresses.end());
+        addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+        return addresses;
+    }
+}
+
+bool resolved_address::operator<(const resolved_address & other) const
+{
+    if (family != other.family)
+        return family < other.family;
+    return memcmp(bytes, other.bytes, sizeof(bytes)) < 0;
+}
+
+bool resolved_address::operator==(const resolved_address & other) const
+{
+    return family == other.family && memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+}
+
+bulk_resolver::bulk_resolver():
+    concurrency(DEFAULT_CONCURRENCY),
+    family(AF_UNSPEC)
+{
+
+}
+
+bulk_resolver& bulk_resolver::set_concurrency(size_t workers)
+{
+    concurrency = std::max<size_t>(workers, 1);
+    return *this;
+}
+
+bulk_resolver& bulk_resolver::set_family(int _family)
+{
+    family = _family;
+    return *this;
+}
+
+std::vector<resolve_result> bulk_resolver::resolve(const std::vector<std::string> & names) const
+{
+    std::vector<resolve_result> results;
+    std::unordered_map<std::string, size_t> seen;
+    for (const std::string & name : names)
+    {
+        if (seen.emplace(name, results.size()).second)
+        {
+            resolve_result result = {name, 0, {}, std::chrono::microseconds(0)};
+            results.push_back(result);
+        }
+    }
+
+    // Workers take the next unresolved name until none are left, each
+    // writes only to its own results
+    std::atomic<size_t> next(0);
+    int hint_family = family;
+    auto work = [&results, &next, hint_family]() {
+        struct addrinfo hints = {0};
+        hints.ai_family = hint_family;
+        hints.ai_socktype = SOCK_STREAM;
+        for (size_t index = next++; index < results.size(); index = next++)
+        {
+            resolve_result & result = results[index];
+            struct addrinfo* address_info = nullptr;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            result.error = getaddrinfo(result.name.c_str(), nullptr, &hints, &address_info);
+            result.latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            if (result.error == 0)
+            {
+                result.addresses = collect_addresses(address_info);
+                freeaddrinfo(address_info);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    size_t worker_count = std::min(concurrency, results.size());
+    for (size_t i = 1; i < worker_count; ++i)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread & worker : workers)
+    {
+        worker.join();
+    }
+    return results;
+}
+
+void bulk_resolver::format(const resolve_result & result, std::string & out)
+{
+    out.append(result.name);
+    out.push_back('\t');
+    if (result.error != 0)
+    {
+        out.push_back('!');
+        out.append(gai_strerror(result.error));
+        out.push_back('\n');
+        return;
+    }
+
+    char text[INET6_ADDRSTRLEN];
+    for (size_t i = 0; i < result.addresses.size(); ++i)
+    {
+        if (i != 0)
+            out.push_back(',');
+        if (inet_ntop(result.addresses[i].family, result.addresses[i].bytes, text, sizeof(text)) != nullptr)
+            out.append(text);
+    }
+    out.push_back('\n');
+}
@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ * One address a name resolved to, in network byte order
+ */
+struct resolved_address
+{
+    int family; ///< AF_INET or AF_INET6
+    unsigned char bytes[16]; ///< The first 4 bytes for AF_INET
+
+    bool operator<(const resolved_address & other) const;
+    bool operator==(const resolved_address & other) const;
+};
+
+/**
+ * The outcome of resolving one name
+ */
+struct resolve_result
+{
+    std::string name;
+    int error; ///< 0 or the getaddrinfo error code
+    std::vector<resolved_address> addresses; ///< Sorted, without duplicates
+    std::chrono::microseconds latency; ///< How long getaddrinfo took
+};
+
+/**
+ * Resolves a list of host names concurrently with a pool of threads
+ * calling getaddrinfo. Each name is resolved once however often it
+ * appears in the list, and the addresses for a name are deduplicated
+ * (hosts files and DNS both happily return the same address twice).
+ */
+class bulk_resolver
+{
+  public:
+    bulk_resolver();
+
+    /**
+     * Set how many lookups may be in flight at once (64 by default)
+     *
+     * @return a reference to itself
+     */
+    bulk_resolver& set_concurrency(size_t workers);
+
+    /**
+     * Limit the lookups to AF_INET or AF_INET6, AF_UNSPEC (the default)
+     * asks for both
+     *
+     * @return a reference to itself
+     */
+    bulk_resolver& set_family(int _family);
+
+    /**
+     * Resolve every distinct name in the list
+     *
+     * @return one result per distinct name, in the order each name
+     * first appears
+     */
+    std::vector<resolve_result> resolve(const std::vector<std::string> & names) const;
+
+    /**
+     * Append one line for a result to out, the name and a tab followed
+     * by comma separated addresses, or by '!' and the error message.
+     * Formats with inet_ntop directly, without iostreams.
+     */
+    static void format(const resolve_result & result, std::string & out);
+
+  private:
+    size_t concurrency;
+    int family;
+};
@@ -0,0 +1,328 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "certificate_verifier.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+namespace
+{
+    const size_t MAX_CACHE_ENTRIES = 4096;
+
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     * The process wide trust store, loaded the first time a context
+     * asks for it. It is deliberately never freed, at exit OpenSSL may
+     * already have cleaned up by the time static destructors run.
+     */
+    class trust_store_holder
+    {
+      public:
+        trust_store_holder():
+            store(nullptr),
+            loaded(false)
+        {}
+
+        bool set_ca_file(const std::string & path)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (loaded)
+                return false;
+            ca_file = path;
+            return true;
+        }
+
+        X509_STORE* get()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!loaded)
+            {
+                loaded = true;
+                store = X509_STORE_new();
+                int success = ca_file.empty() ? X509_STORE_set_default_paths(store) : X509_STORE_load_locations(store, ca_file.c_str(), nullptr);
+                if (success != 1)
+                {
+                    X509_STORE_free(store);
+                    store = nullptr;
+                }
+            }
+            return store;
+        }
+
+      private:
+        std::mutex lock;
+        std::string ca_file;
+        X509_STORE* store;
+        bool loaded;
+    };
+
+    /**
+     * Verified chains keyed by host and chain fingerprint, mapped to
+     * the time they stop being trusted
+     */
+    class chain_cache
+    {
+      public:
+        chain_cache():
+            lifetime(std::chrono::hours(1))
+        {}
+
+        bool enabled()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return lifetime.count() > 0;
+        }
+
+        bool contains(const std::string & key)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            std::unordered_map<std::string, clock::time_point>::iterator entry = entries.find(key);
+            if (entry == entries.end())
+                return false;
+            if (entry->second <= clock::now())
+            {
+                entries.erase(entry);
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * Remember a chain until the cache lifetime passes or the leaf
+         * expires, whichever comes first
+         */
+        void insert(const std::string & key, std::chrono::seconds leaf_remaining)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            clock::time_point now = clock::now();
+            if (entries.size() >= MAX_CACHE_ENTRIES)
+            {
+                for (std::unordered_map<std::string, clock::time_point>::iterator entry = entries.begin(); entry != entries.end(); )
+                {
+                    if (entry->second <= now)
+                        entry = entries.erase(entry);
+                    else
+                        ++entry;
+                }
+                if (entries.size() >= MAX_CACHE_ENTRIES)
+                    entries.clear();
+            }
+            entries[key] = now + std::min(lifetime, leaf_remaining);
+        }
+
+        void set_lifetime(std::chrono::seconds _lifetime)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            lifetime = _lifetime;
+            entries.clear();
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            entries.clear();
+        }
+
+      private:
+        std::mutex lock;
+        std::chrono::seconds lifetime;
+        std::unordered_map<std::string, clock::time_point> entries;
+    };
+
+    trust_store_holder trust_store;
+    chain_cache cache;
+    std::atomic<size_t> cache_hits(0);
+    std::atomic<size_t> verifications(0);
+    std::atomic<size_t> failures(0);
+
+    void free_host(void*, void* host, CRYPTO_EX_DATA*, int, long, void*)
+    {
+        OPENSSL_free(host);
+    }
+
+    /**
+     * Index of the ex_data slot holding the host an SSL handle should
+     * be verified against
+     */
+    int host_index()
+    {
+        static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, free_host);
+        return index;
+    }
+
+    bool add_certificate(EVP_MD_CTX* digest, X509* certificate)
+    {
+        unsigned char certificate_digest[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        return X509_digest(certificate, EVP_sha256(), certificate_digest, &length) == 1
+            && EVP_DigestUpdate(digest, certificate_digest, length) == 1;
+    }
+
+    /**
+     * SHA-256 over the SHA-256 of every certificate the peer sent,
+     * starting with the leaf
+     *
+     * @return the fingerprint, or an empty string on failure
+     */
+    std::string chain_fingerprint(X509_STORE_CTX* store_context)
+    {
+        EVP_MD_CTX* digest = EVP_MD_CTX_new();
+        bool success = digest != nullptr
+            && EVP_DigestInit_ex(digest, EVP_sha256(), nullptr) == 1
+            && add_certificate(digest, X509_STORE_CTX_get0_cert(store_context));
+        STACK_OF(X509)* untrusted = X509_STORE_CTX_get0_untrusted(store_context);
+        for (int i = 0; success && untrusted != nullptr && i < sk_X509_num(untrusted); ++i)
+        {
+            success = add_certificate(digest, sk_X509_value(untrusted, i));
+        }
+
+        unsigned char fingerprint[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        success = success && EVP_DigestFinal_ex(digest, fingerprint, &length) == 1;
+        EVP_MD_CTX_free(digest);
+        return success ? std::string((const char*)fingerprint, length) : std::string();
+    }
+
+    /**
+     * Seconds until the leaf certificate expires, zero if it already
+     * has
+     */
+    std::chrono::seconds leaf_remaining(X509_STORE_CTX* store_context)
+    {
+        int days = 0;
+        int seconds = 0;
+        if (ASN1_TIME_diff(&days, &seconds, nullptr, X509_get0_notAfter(X509_STORE_CTX_get0_cert(store_context))) != 1 || days < 0 || seconds < 0)
+        {
+            return std::chrono::seconds(0);
+        }
+        return std::chrono::seconds(days * 24LL * 60 * 60 + seconds);
+    }
+
+    /**
+     * Replaces OpenSSL's chain verification, consulting the cache
+     * before falling back to a full X509_verify_cert
+     */
+    int verify_chain(X509_STORE_CTX* store_context, void*)
+    {
+        SSL* ssl = static_cast<SSL*>(X509_STORE_CTX_get_ex_data(store_context, SSL_get_ex_data_X509_STORE_CTX_idx()));
+        if (ssl != nullptr && SSL_get_verify_mode(ssl) == SSL_VERIFY_NONE)
+        {
+            return 1; // The result would be ignored anyway, don't pay for it
+        }
+
+        const char* host = ssl == nullptr ? nullptr : static_cast<const char*>(SSL_get_ex_data(ssl, host_index()));
+        std::string key;
+        if (host != nullptr && cache.enabled())
+        {
+            std::string fingerprint = chain_fingerprint(store_context);
+            if (!fingerprint.empty())
+            {
+                key = std::string(host) + '\n' + fingerprint;
+                if (cache.contains(key))
+                {
+                    cache_hits.fetch_add(1, std::memory_order_relaxed);
+                    return 1;
+                }
+            }
+        }
+
+        int result = X509_verify_cert(store_context);
+        if (result == 1)
+        {
+            verifications.fetch_add(1, std::memory_order_relaxed);
+            if (!key.empty())
+                cache.insert(key, leaf_remaining(store_context));
+        } else {
+            failures.fetch_add(1, std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    bool is_ip_address(const std::string & host)
+    {
+        unsigned char address[sizeof(struct in6_addr)];
+        return inet_pton(AF_INET, host.c_str(), address) == 1 || inet_pton(AF_INET6, host.c_str(), address) == 1;
+    }
+}
+
+bool certificate_verifier::use_ca_file(const std::string & path)
+{
+    return trust_store.set_ca_file(path);
+}
+
+void certificate_verifier::set_cache_lifetime(std::chrono::seconds lifetime)
+{
+    cache.set_lifetime(lifetime);
+}
+
+void certificate_verifier::clear_cache()
+{
+    cache.clear();
+}
+
+certificate_verifier::statistics certificate_verifier::get_statistics()
+{
+    statistics stats;
+    stats.cache_hits = cache_hits.load(std::memory_order_relaxed);
+    stats.verifications = verifications.load(std::memory_order_relaxed);
+    stats.failures = failures.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void certificate_verifier::attach(SSL_CTX* context)
+{
+    X509_STORE* store = trust_store.get();
+    if (store != nullptr)
+    {
+        SSL_CTX_set1_cert_store(context, store);
+    }
+    SSL_CTX_set_cert_verify_callback(context, verify_chain, nullptr);
+}
+
+bool certificate_verifier::prepare(SSL* ssl, const std::string & host, bool verify)
+{
+    bool ip_address = is_ip_address(host);
+    if (!ip_address && SSL_set_tlsext_host_name(ssl, host.c_str()) != 1)
+    {
+        return false;
+    }
+
+    if (!verify)
+    {
+        SSL_set_verify(ssl, SSL_VERIFY_NONE, nullptr);
+        return true;
+    }
+
+    SSL_set_verify(ssl, SSL_VERIFY_PEER, nullptr);
+    int success = ip_address ? X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host.c_str()) : SSL_set1_host(ssl, host.c_str());
+    if (success != 1)
+    {
+        return false;
+    }
+
+    char* stored_host = OPENSSL_strdup(host.c_str());
+    if (stored_host == nullptr)
+    {
+        return false;
+    }
+    OPENSSL_free(SSL_get_ex_data(ssl, host_index()));
+    return SSL_set_ex_data(ssl, host_index(), stored_host) == 1;
+}
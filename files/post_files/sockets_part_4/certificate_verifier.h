@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <chrono>
+#include <string>
+#include <openssl/ssl.h>
+
+/**
+ * Peer certificate verification for ssl_socket. The trust store is
+ * loaded once per process and shared by every context. Chains that
+ * verified successfully are remembered per host by fingerprint for a
+ * bounded time, so reconnecting to a host that presents the same chain
+ * skips chain building and signature checks. The handshake itself
+ * still proves the peer holds the leaf's private key.
+ */
+namespace certificate_verifier
+{
+    struct statistics
+    {
+        size_t cache_hits; ///< Chains accepted from the cache
+        size_t verifications; ///< Chains fully verified by OpenSSL
+        size_t failures; ///< Chains that failed verification
+    };
+
+    /**
+     * Trust the certificates in a PEM file instead of the system
+     * default locations. Must be called before the first secure
+     * socket is created since the trust store is only loaded once.
+     *
+     * @param path the PEM file to load
+     *
+     * @return false if the trust store has already been loaded
+     */
+    bool use_ca_file(const std::string & path);
+
+    /**
+     * Set how long a verified chain is trusted without being verified
+     * again. Zero disables the cache. Defaults to one hour.
+     */
+    void set_cache_lifetime(std::chrono::seconds lifetime);
+
+    /**
+     * Forget every verified chain
+     */
+    void clear_cache();
+
+    statistics get_statistics();
+
+    /**
+     * Install the shared trust store and the caching verification
+     * callback on a client context. If the trust store could not be
+     * loaded the context trusts nothing, so only sockets that skip
+     * verification will be able to connect.
+     */
+    void attach(SSL_CTX* context);
+
+    /**
+     * Configure an SSL handle to verify its peer against host, or to
+     * skip verification entirely. Either way host is sent as SNI when
+     * it is a name rather than an address.
+     *
+     * @return false if OpenSSL rejected the host
+     */
+    bool prepare(SSL* ssl, const std::string & host, bool verify);
+}
@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace
+{
+    cpu_features detect()
+    {
+        cpu_features features = {false, false, false, false};
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        {
+            features.sse2 = (edx & bit_SSE2) != 0;
+            features.aes = (ecx & bit_AES) != 0;
+            features.pclmul = (ecx & bit_PCLMUL) != 0;
+
+            // AVX2 also needs the OS to save the upper halves of the
+            // registers on a context switch
+            bool os_saves_ymm = false;
+            if ((ecx & bit_OSXSAVE) != 0)
+            {
+                unsigned int xcr0_low, xcr0_high;
+                __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+                os_saves_ymm = (xcr0_low & 0x6) == 0x6;
+            }
+            if (os_saves_ymm && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            {
+                features.avx2 = (ebx & bit_AVX2) != 0;
+            }
+        }
+#elif defined(__aarch64__)
+        unsigned long capabilities = getauxval(AT_HWCAP);
+        features.aes = (capabilities & HWCAP_AES) != 0;
+        features.pclmul = (capabilities & HWCAP_PMULL) != 0;
+#endif
+        return features;
+    }
+}
+
+const cpu_features& cpu_features::get()
+{
+    static const cpu_features features = detect();
+    return features;
+}
@@ -0,0 +1,40 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+
+/**
+ * Instruction set extensions that change which algorithms are cheap
+ * on this machine
+ */
+struct cpu_features
+{
+    bool aes; ///< Hardware AES rounds (AES-NI on x86, the crypto extension on ARMv8)
+    bool pclmul; ///< Carry-less multiply, which GCM's GHASH relies on (PMULL on ARMv8)
+    bool avx2; ///< 256 bit integer vectors, enabled by both the CPU and the OS
+    bool sse2; ///< 128 bit integer vectors
+
+    /**
+     * True if AES-GCM will run in hardware rather than in a much
+     * slower table driven fallback
+     */
+    bool fast_aes_gcm() const { return aes && pclmul; }
+
+    /**
+     * Detect the features of the CPU we are running on. The result is
+     * computed once, the first time this is called.
+     */
+    static const cpu_features& get();
+};
@@ -0,0 +1,216 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "crypto_pool.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <openssl/crypto.h>
+
+namespace
+{
+    const size_t SLAB_SIZE = 64 * 1024;
+    const size_t GRANULARITY = 16;
+    const size_t LARGEST_CLASS = 32 * 1024;
+    const uint32_t LARGE_ALLOCATION = UINT32_MAX;
+
+    /**
+     * Every block is prefixed with a header so free and realloc can
+     * find the size class. Keeping it at 16 bytes keeps the payload
+     * as aligned as malloc would have made it.
+     */
+    union block_header
+    {
+        struct
+        {
+            uint32_t size_class;
+            size_t size; // Only meaningful for large allocations
+        } info;
+        block_header* next_free;
+        char padding[16];
+    };
+
+    struct size_class
+    {
+        std::mutex lock;
+        size_t size;
+        block_header* free_list;
+        char* slab_position;
+        char* slab_end;
+    };
+
+    /**
+     * Size classes step by a quarter of the previous power of two
+     * (16, 32, 48, 64, 80, 96, 112, 128, 160, ... 28672, 32768) so no
+     * more than 25% of a block is wasted to rounding
+     */
+    class size_class_table
+    {
+      public:
+        size_class_table():
+            class_count(0)
+        {
+            for (size_t size = GRANULARITY; size < 64; size += GRANULARITY)
+                classes[class_count++].size = size;
+            for (size_t power = 64; power <= LARGEST_CLASS; power *= 2)
+            {
+                for (size_t size = power; size < power * 2 && size <= LARGEST_CLASS; size += power / 4)
+                    classes[class_count++].size = size;
+            }
+
+            uint32_t index = 0;
+            for (size_t slot = 0; slot <= LARGEST_CLASS / GRANULARITY; ++slot)
+            {
+                while (classes[index].size < slot * GRANULARITY)
+                    ++index;
+                lookup[slot] = index;
+            }
+        }
+
+        /**
+         * Get the index of the smallest class that can hold size
+         * bytes, size must be no larger than LARGEST_CLASS
+         */
+        uint32_t class_for(size_t size) const
+        {
+            return lookup[(size + GRANULARITY - 1) / GRANULARITY];
+        }
+
+        size_class classes[64];
+
+      private:
+        uint8_t lookup[LARGEST_CLASS / GRANULARITY + 1];
+        uint32_t class_count;
+    };
+
+    size_class_table table;
+    std::atomic<size_t> bytes_in_use(0);
+    std::atomic<size_t> bytes_reserved(0);
+    std::atomic<size_t> allocations(0);
+
+    size_t class_size(uint32_t index)
+    {
+        return table.classes[index].size;
+    }
+
+    block_header* header_of(void* payload)
+    {
+        return static_cast<block_header*>(payload) - 1;
+    }
+
+    void* pool_malloc(size_t size, const char*, int)
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        if (size > LARGEST_CLASS)
+        {
+            block_header* header = static_cast<block_header*>(std::malloc(sizeof(block_header) + size));
+            if (header == nullptr)
+                return nullptr;
+            header->info.size_class = LARGE_ALLOCATION;
+            header->info.size = size;
+            bytes_in_use.fetch_add(size, std::memory_order_relaxed);
+            return header + 1;
+        }
+
+        uint32_t index = table.class_for(size);
+        size_t block_size = sizeof(block_header) + class_size(index);
+        size_class & pool = table.classes[index];
+        block_header* header;
+        {
+            std::lock_guard<std::mutex> guard(pool.lock);
+            if (pool.free_list != nullptr)
+            {
+                header = pool.free_list;
+                pool.free_list = header->next_free;
+            } else {
+                if (pool.slab_position == nullptr || pool.slab_position + block_size > pool.slab_end)
+                {
+                    // Slabs are never returned, the pool only grows to the high water mark
+                    char* slab = static_cast<char*>(std::malloc(SLAB_SIZE));
+                    if (slab == nullptr)
+                        return nullptr;
+                    pool.slab_position = slab;
+                    pool.slab_end = slab + SLAB_SIZE;
+                    bytes_reserved.fetch_add(SLAB_SIZE, std::memory_order_relaxed);
+                }
+                header = reinterpret_cast<block_header*>(pool.slab_position);
+                pool.slab_position += block_size;
+            }
+        }
+        header->info.size_class = index;
+        bytes_in_use.fetch_add(class_size(index), std::memory_order_relaxed);
+        return header + 1;
+    }
+
+    void pool_free(void* payload, const char*, int)
+    {
+        if (payload == nullptr)
+            return;
+
+        block_header* header = header_of(payload);
+        uint32_t index = header->info.size_class;
+        if (index == LARGE_ALLOCATION)
+        {
+            bytes_in_use.fetch_sub(header->info.size, std::memory_order_relaxed);
+            std::free(header);
+            return;
+        }
+
+        bytes_in_use.fetch_sub(class_size(index), std::memory_order_relaxed);
+        size_class & pool = table.classes[index];
+        std::lock_guard<std::mutex> guard(pool.lock);
+        header->next_free = pool.free_list;
+        pool.free_list = header;
+    }
+
+    void* pool_realloc(void* payload, size_t size, const char* file, int line)
+    {
+        if (payload == nullptr)
+            return pool_malloc(size, file, line);
+        if (size == 0)
+        {
+            pool_free(payload, file, line);
+            return nullptr;
+        }
+
+        block_header* header = header_of(payload);
+        size_t capacity = header->info.size_class == LARGE_ALLOCATION ? header->info.size : class_size(header->info.size_class);
+        if (header->info.size_class != LARGE_ALLOCATION && size <= capacity)
+            return payload; // Still fits in the same block
+
+        void* replacement = pool_malloc(size, file, line);
+        if (replacement == nullptr)
+            return nullptr;
+        std::memcpy(replacement, payload, capacity < size ? capacity : size);
+        pool_free(payload, file, line);
+        return replacement;
+    }
+}
+
+bool crypto_pool::install()
+{
+    return CRYPTO_set_mem_functions(pool_malloc, pool_realloc, pool_free) == 1;
+}
+
+crypto_pool::statistics crypto_pool::get_statistics()
+{
+    statistics stats;
+    stats.bytes_in_use = bytes_in_use.load(std::memory_order_relaxed);
+    stats.bytes_reserved = bytes_reserved.load(std::memory_order_relaxed);
+    stats.allocations = allocations.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,49 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <cstddef>
+
+/**
+ * Pooled allocator for OpenSSL. Allocations up to 32KB are carved
+ * out of large slabs and recycled through per size class free lists.
+ * That covers the record buffers SSL_MODE_RELEASE_BUFFERS frees and
+ * allocates again as idle connections wake up, so they are reused
+ * rather than going back and forth through malloc.
+ */
+namespace crypto_pool
+{
+    struct statistics
+    {
+        size_t bytes_in_use; ///< Bytes currently handed out to OpenSSL (rounded up to the size class)
+        size_t bytes_reserved; ///< Bytes held in slabs, whether in use or on a free list
+        size_t allocations; ///< Total number of allocations served since install
+    };
+
+    /**
+     * Route all OpenSSL allocations through the pool. This must be
+     * called before anything else touches OpenSSL (so before the
+     * first ssl_socket connects) because memory allocated with the
+     * default functions can not be freed by the pool.
+     *
+     * @return true if the pool was installed, false if OpenSSL has already allocated memory
+     */
+    bool install();
+
+    /**
+     * Snapshot of the pool usage
+     */
+    statistics get_statistics();
+}
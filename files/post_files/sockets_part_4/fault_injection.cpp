@@ -0,0 +1,304 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "fault_injection.h"
+#include "bench_common.h"
+#include "ssl_socket.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/bio.h>
+
+namespace
+{
+    /**
+     * The first byte of a TLS handshake record
+     */
+    const unsigned char TLS_HANDSHAKE = 0x16;
+
+    /**
+     * One accepted connection with the plan's faults applied to every
+     * send and recv
+     */
+    class faulty_connection
+    {
+      public:
+        faulty_connection(int _connection, const bench::fault_plan & _plan):
+            connection(_connection),
+            plan(_plan),
+            sent(0),
+            handshaking(false),
+            reset(false)
+        {}
+
+        ssize_t send_some(const char* data, size_t length)
+        {
+            if (reset)
+                return -1;
+            size_t chunk = handshaking ? plan.handshake_chunk : plan.write_chunk;
+            std::chrono::microseconds gap = handshaking ? plan.handshake_gap : plan.write_gap;
+            if (chunk > 0)
+                length = std::min(length, chunk);
+            if (plan.reset_after > 0)
+            {
+                if (sent >= plan.reset_after)
+                {
+                    reset_connection();
+                    return -1;
+                }
+                length = std::min<uint64_t>(length, plan.reset_after - sent);
+            }
+            if (gap.count() > 0)
+                std::this_thread::sleep_for(gap);
+
+            ssize_t written = ::send(connection, data, length, MSG_NOSIGNAL);
+            if (written > 0)
+                sent += written;
+            return written;
+        }
+
+        ssize_t recv_some(char* data, size_t length)
+        {
+            if (reset)
+                return -1;
+            if (plan.read_chunk > 0)
+                length = std::min(length, plan.read_chunk);
+            if (plan.read_gap.count() > 0)
+                std::this_thread::sleep_for(plan.read_gap);
+            return ::recv(connection, data, length, 0);
+        }
+
+        void set_handshaking(bool enabled) { handshaking = enabled; }
+
+      private:
+        /**
+         * Close with SO_LINGER at zero, which sends an RST
+         */
+        void reset_connection()
+        {
+            struct linger abort = {1, 0};
+            setsockopt(connection, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+            shutdown(connection, SHUT_RDWR);
+            reset = true;
+        }
+
+        int connection;
+        const bench::fault_plan & plan;
+        uint64_t sent;
+        bool handshaking;
+        bool reset;
+    };
+
+    /**
+     * A BIO that hands OpenSSL's traffic to a faulty_connection, so
+     * the faults apply to the encrypted byte stream
+     */
+    int bio_write(BIO* bio, const char* data, int length)
+    {
+        faulty_connection* connection = static_cast<faulty_connection*>(BIO_get_data(bio));
+        return connection->send_some(data, length);
+    }
+
+    int bio_read(BIO* bio, char* data, int length)
+    {
+        faulty_connection* connection = static_cast<faulty_connection*>(BIO_get_data(bio));
+        return connection->recv_some(data, length);
+    }
+
+    long bio_ctrl(BIO*, int command, long, void*)
+    {
+        return command == BIO_CTRL_FLUSH ? 1 : 0;
+    }
+
+    int bio_create(BIO* bio)
+    {
+        BIO_set_init(bio, 1);
+        return 1;
+    }
+
+    BIO_METHOD* faulty_bio_method()
+    {
+        static BIO_METHOD* method = []() {
+            BIO_METHOD* created = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "faulty connection");
+            BIO_meth_set_write(created, bio_write);
+            BIO_meth_set_read(created, bio_read);
+            BIO_meth_set_ctrl(created, bio_ctrl);
+            BIO_meth_set_create(created, bio_create);
+            return created;
+        }();
+        return method;
+    }
+
+    void serve_connection(int connection, SSL_CTX* context, const bench::fault_plan & plan, size_t message_size)
+    {
+        if (plan.accept_delay.count() > 0)
+            std::this_thread::sleep_for(plan.accept_delay);
+
+        int no_delay = 1;
+        setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+        faulty_connection faulty(connection, plan);
+        unsigned char first = 0;
+        if (recv(connection, &first, 1, MSG_PEEK) == 1 && first == TLS_HANDSHAKE)
+        {
+            SSL* ssl = SSL_new(context);
+            BIO* bio = BIO_new(faulty_bio_method());
+            BIO_set_data(bio, &faulty);
+            SSL_set_bio(ssl, bio, bio);
+            if (plan.record_size > 0)
+                SSL_set_max_send_fragment(ssl, plan.record_size);
+
+            faulty.set_handshaking(true);
+            int accepted = SSL_accept(ssl);
+            faulty.set_handshaking(false);
+            if (accepted == 1)
+            {
+                bench::command_stream stream = {
+                    [ssl](char* data, size_t length) -> ssize_t { return SSL_read(ssl, data, length); },
+                    [ssl](const char* data, size_t length) -> ssize_t { return SSL_write(ssl, data, length); }
+                };
+                bench::serve_command(stream, message_size);
+                SSL_shutdown(ssl);
+            }
+            SSL_free(ssl);
+        } else {
+            bench::command_stream stream = {
+                [&faulty](char* data, size_t length) { return faulty.recv_some(data, length); },
+                [&faulty](const char* data, size_t length) { return faulty.send_some(data, length); }
+            };
+            bench::serve_command(stream, message_size);
+        }
+        close(connection);
+    }
+
+    /**
+     * Set a size field from a script value
+     */
+    template <typename value_type>
+    void parse_number(const std::string & key, const std::string & value, value_type & field)
+    {
+        try
+        {
+            field = static_cast<value_type>(std::stoull(value));
+        } catch (const std::exception &) {
+            throw ssl_socket_exception("Bad value for fault " + key + ": " + value);
+        }
+    }
+}
+
+bench::fault_plan::fault_plan():
+    write_chunk(0),
+    write_gap(0),
+    read_chunk(0),
+    read_gap(0),
+    handshake_chunk(0),
+    handshake_gap(0),
+    record_size(0),
+    accept_delay(0),
+    reset_after(0),
+    receive_window(0)
+{
+
+}
+
+bench::fault_plan bench::fault_plan::parse(const std::string & script)
+{
+    fault_plan plan;
+    std::stringstream items(script);
+    for (std::string item; std::getline(items, item, ','); )
+    {
+        if (item.empty())
+            continue;
+        size_t equals = item.find('=');
+        if (equals == std::string::npos)
+        {
+            throw ssl_socket_exception("Expected key=value in fault script: " + item);
+        }
+        std::string key = item.substr(0, equals);
+        std::string value = item.substr(equals + 1);
+        uint64_t number = 0;
+        parse_number(key, value, number);
+
+        if (key == "write_chunk")
+            plan.write_chunk = number;
+        else if (key == "write_gap_us")
+            plan.write_gap = std::chrono::microseconds(number);
+        else if (key == "read_chunk")
+            plan.read_chunk = number;
+        else if (key == "read_gap_us")
+            plan.read_gap = std::chrono::microseconds(number);
+        else if (key == "handshake_chunk")
+            plan.handshake_chunk = number;
+        else if (key == "handshake_gap_us")
+            plan.handshake_gap = std::chrono::microseconds(number);
+        else if (key == "record_size")
+            plan.record_size = number;
+        else if (key == "accept_delay_ms")
+            plan.accept_delay = std::chrono::milliseconds(number);
+        else if (key == "reset_after")
+            plan.reset_after = number;
+        else if (key == "receive_window")
+            plan.receive_window = number;
+        else
+            throw ssl_socket_exception("Unknown fault: " + key);
+    }
+    if (plan.record_size != 0 && (plan.record_size < 512 || plan.record_size > 16384))
+    {
+        throw ssl_socket_exception("record_size must be between 512 and 16384");
+    }
+    return plan;
+}
+
+std::string bench::fault_plan::to_string() const
+{
+    std::ostringstream out;
+    auto add = [&out](const char* key, uint64_t value) {
+        if (value != 0)
+            out << (out.tellp() > 0 ? "," : "") << key << '=' << value;
+    };
+    add("write_chunk", write_chunk);
+    add("write_gap_us", write_gap.count());
+    add("read_chunk", read_chunk);
+    add("read_gap_us", read_gap.count());
+    add("handshake_chunk", handshake_chunk);
+    add("handshake_gap_us", handshake_gap.count());
+    add("record_size", record_size);
+    add("accept_delay_ms", accept_delay.count());
+    add("reset_after", reset_after);
+    add("receive_window", receive_window);
+    return out.str().empty() ? "none" : out.str();
+}
+
+void bench::serve_faults(int listener, SSL_CTX* context, const fault_plan & plan, size_t message_size)
+{
+    if (plan.receive_window > 0)
+    {
+        // Accepted connections inherit it, set before the handshake so
+        // the window scale offered in the SYN-ACK matches
+        setsockopt(listener, SOL_SOCKET, SO_RCVBUF, &plan.receive_window, sizeof(plan.receive_window));
+    }
+    while (true)
+    {
+        int connection = accept_connection(listener);
+        std::thread([connection, context, &plan, message_size]() {
+                serve_connection(connection, context, plan, message_size);
+            }).detach();
+    }
+}
@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <chrono>
+#include <cinttypes>
+#include <string>
+#include <openssl/ssl.h>
+
+/**
+ * A loopback server that misbehaves on purpose, for measuring how
+ * ssl_socket copes with hostile or broken peers. It serves the
+ * requests from bench_common (echo, bulk and upload) over plain TCP or
+ * TLS, with faults injected below TLS so they hit the raw byte stream
+ * just as a bad network or peer would.
+ */
+namespace bench
+{
+    /**
+     * The faults to inject, everything off by default. Scripts are
+     * comma separated key=value pairs with the field names, ex:
+     * "write_chunk=1,write_gap_us=50,reset_after=65536"
+     */
+    struct fault_plan
+    {
+        size_t write_chunk; ///< Most bytes per send, partial writes (0 for no limit)
+        std::chrono::microseconds write_gap; ///< Pause before each send, EAGAIN storms for the reader
+        size_t read_chunk; ///< Most bytes per recv, 1 for byte at a time reads (0 for no limit)
+        std::chrono::microseconds read_gap; ///< Pause before each recv, a slow consumer
+        size_t handshake_chunk; ///< Most bytes per send while the TLS handshake runs
+        std::chrono::microseconds handshake_gap; ///< Pause before each handshake send
+        size_t record_size; ///< Largest TLS record sent (512 to 16384), splits handshake messages
+        std::chrono::milliseconds accept_delay; ///< Wait this long before answering a new connection
+        uint64_t reset_after; ///< Reset the connection after sending this many bytes (0 for never)
+        int receive_window; ///< SO_RCVBUF of accepted connections, a tiny window (0 for the default)
+
+        fault_plan();
+
+        /**
+         * @throw ssl_socket_exception for unknown keys or bad values
+         */
+        static fault_plan parse(const std::string & script);
+
+        /**
+         * The plan as a script, only the faults that are on
+         */
+        std::string to_string() const;
+    };
+
+    /**
+     * Accept connections on listener forever, serving each on its own
+     * thread with the faults in plan. Connections that start with a
+     * TLS handshake are served over TLS with context.
+     *
+     * @param message_size the size of each echoed message
+     */
+    void serve_faults(int listener, SSL_CTX* context, const fault_plan & plan, size_t message_size);
+}
@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <signal.h>
+#include "bench_common.h"
+#include "fault_injection.h"
+#include "ssl_socket.h"
+
+/**
+ * A loopback server that injects faults, for trying clients against
+ * a misbehaving peer by hand. Usage:
+ *
+ *   fault_server <port> [fault script] [--message BYTES]
+ *
+ * It answers the bench_common requests over plain TCP and TLS with a
+ * throwaway certificate. The script lists the faults as key=value
+ * pairs, see fault_plan, ex: "read_chunk=1,reset_after=1048576"
+ */
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <port> [fault script] [--message BYTES]\n";
+        return 1;
+    }
+
+    std::string script;
+    size_t message_size = 64;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--message" && i + 1 < argc)
+            message_size = std::stoul(argv[++i]);
+        else
+            script = argv[i];
+    }
+
+    // Resets and clients hanging up must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+
+    try
+    {
+        bench::fault_plan plan = bench::fault_plan::parse(script);
+        int listener = bench::listen_on_loopback(std::stoul(argv[1]));
+        std::cerr << "Serving on 127.0.0.1:" << bench::bound_port(listener) << " with faults: " << plan.to_string() << '\n';
+        bench::serve_faults(listener, bench::make_server_context(), plan, message_size);
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
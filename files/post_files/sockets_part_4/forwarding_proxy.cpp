@@ -0,0 +1,400 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "forwarding_proxy.h"
+#include "ssl_socket.h"
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace
+{
+    /**
+     * One direction of a relayed connection. Each side is either a
+     * plain descriptor or an ssl_socket, bytes move from source to
+     * sink through a pipe when splicing or a buffer when copying.
+     */
+    class pump
+    {
+      public:
+        pump(int _source_descriptor, ssl_socket* _source, int _sink_descriptor, ssl_socket* _sink, bool splice, size_t size):
+            source_descriptor(_source_descriptor),
+            source(_source),
+            sink_descriptor(_sink_descriptor),
+            sink(_sink),
+            splicing(false),
+            pipe_capacity(size),
+            in_pipe(0),
+            buffer(splice ? 0 : size),
+            head(0),
+            tail(0),
+            source_closed(false),
+            sink_closed(false)
+        {
+            pipe_descriptors[0] = pipe_descriptors[1] = -1;
+            if (splice && pipe2(pipe_descriptors, O_NONBLOCK) == 0)
+            {
+                splicing = true;
+                fcntl(pipe_descriptors[1], F_SETPIPE_SZ, static_cast<int>(size));
+                int actual = fcntl(pipe_descriptors[1], F_GETPIPE_SZ);
+                pipe_capacity = actual > 0 ? actual : size;
+            } else {
+                buffer.resize(size);
+            }
+        }
+
+        ~pump()
+        {
+            for (int descriptor : pipe_descriptors)
+            {
+                if (descriptor >= 0)
+                    close(descriptor);
+            }
+        }
+
+        pump(pump const&) = delete;
+        pump& operator=(pump const&) = delete;
+
+        bool is_splicing() const { return splicing; }
+
+        /**
+         * Check to see if there is room for more from the source
+         */
+        bool wants_input() const
+        {
+            return !source_closed && !sink_closed && (splicing ? in_pipe < pipe_capacity : tail < buffer.size());
+        }
+
+        /**
+         * Check to see if anything is waiting for the sink
+         */
+        bool wants_output() const { return !sink_closed && (in_pipe > 0 || head < tail); }
+
+        /**
+         * Check to see if the source has data buffered in OpenSSL,
+         * which poll can't see
+         */
+        bool has_buffered_input() const
+        {
+            return wants_input() && source != nullptr && source->is_secure() && source->available() > 0;
+        }
+
+        bool is_finished() const { return sink_closed || (source_closed && !wants_output()); }
+
+        /**
+         * Stop reading, the source's side of the connection broke.
+         * Whatever was already read is still sent.
+         */
+        void end_source() { source_closed = true; }
+
+        /**
+         * Stop sending, the sink's side of the connection is gone
+         */
+        void end_sink() { sink_closed = true; }
+
+        /**
+         * Move whatever can be moved without blocking
+         *
+         * @return true if the sink should be shut down for writing
+         * because the source ended and everything has been sent
+         */
+        bool transfer()
+        {
+            bool was_finished = is_finished();
+            drain();
+            fill();
+            drain();
+            return !was_finished && !sink_closed && is_finished();
+        }
+
+      private:
+        void fill()
+        {
+            while (wants_input())
+            {
+                if (splicing)
+                {
+                    ssize_t moved = ::splice(source_descriptor, nullptr, pipe_descriptors[1], nullptr,
+                                             pipe_capacity - in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                    if (moved > 0)
+                    {
+                        in_pipe += moved;
+                        continue;
+                    }
+                    if (moved == 0)
+                    {
+                        source_closed = true;
+                    } else if (errno == EIO && source != nullptr) {
+                        // kTLS refuses to splice a record that isn't
+                        // application data (ex: a TLS 1.3 session
+                        // ticket), OpenSSL has to read it
+                        stop_splicing();
+                        continue;
+                    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        throw ssl_socket_exception("Error splicing socket: " + std::string(strerror(errno)));
+                    }
+                    return;
+                }
+
+                size_t length = 0;
+                if (source != nullptr)
+                {
+                    length = source->read(buffer.data() + tail, buffer.size() - tail);
+                    source_closed = length == 0 && !source->is_connected();
+                } else {
+                    ssize_t read_size = recv(source_descriptor, buffer.data() + tail, buffer.size() - tail, 0);
+                    if (read_size < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                    {
+                        throw ssl_socket_exception("Error reading socket: " + std::string(strerror(errno)));
+                    }
+                    source_closed = read_size == 0;
+                    length = read_size > 0 ? read_size : 0;
+                }
+                if (length == 0)
+                    return;
+                tail += length;
+            }
+        }
+
+        void drain()
+        {
+            if (sink != nullptr && !sink->is_connected())
+            {
+                sink_closed = true; // Nowhere left to send anything
+                return;
+            }
+            while (in_pipe > 0)
+            {
+                ssize_t moved = ::splice(pipe_descriptors[0], nullptr, sink_descriptor, nullptr,
+                                         in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (moved <= 0)
+                {
+                    if (moved < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                    {
+                        throw ssl_socket_exception("Error splicing socket: " + std::string(strerror(errno)));
+                    }
+                    return;
+                }
+                in_pipe -= moved;
+            }
+            while (head < tail)
+            {
+                size_t length = 0;
+                if (sink != nullptr)
+                {
+                    length = sink->write_some(reinterpret_cast<const uint8_t*>(buffer.data() + head), tail - head);
+                } else {
+                    ssize_t sent = send(sink_descriptor, buffer.data() + head, tail - head, MSG_NOSIGNAL);
+                    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                    {
+                        throw ssl_socket_exception("Error sending socket: " + std::string(strerror(errno)));
+                    }
+                    length = sent > 0 ? sent : 0;
+                }
+                if (length == 0)
+                    return;
+                head += length;
+            }
+            // Only rewind once empty, a TLS write that didn't finish
+            // has to be retried from the same address
+            head = tail = 0;
+        }
+
+        /**
+         * Fall back to copying, anything already in the pipe is still
+         * sent first
+         */
+        void stop_splicing()
+        {
+            splicing = false;
+            buffer.resize(pipe_capacity);
+        }
+
+        int source_descriptor;
+        ssl_socket* source;
+        int sink_descriptor;
+        ssl_socket* sink;
+        bool splicing;
+        int pipe_descriptors[2];
+        size_t pipe_capacity;
+        size_t in_pipe;
+        std::vector<char> buffer;
+        size_t head;
+        size_t tail;
+        bool source_closed;
+        bool sink_closed;
+    };
+
+    /**
+     * Closes a descriptor when it goes out of scope
+     */
+    class descriptor_guard
+    {
+      public:
+        explicit descriptor_guard(int _descriptor): descriptor(_descriptor) {}
+        ~descriptor_guard() { close(descriptor); }
+        descriptor_guard(descriptor_guard const&) = delete;
+        descriptor_guard& operator=(descriptor_guard const&) = delete;
+
+      private:
+        int descriptor;
+    };
+}
+
+forwarding_proxy::forwarding_proxy(const std::string & _host, const std::string & _port):
+    host(_host),
+    port(_port),
+    secure(true),
+    verify_peer(true),
+    kernel_tls(true),
+    splice(true),
+    buffer_size(64 * 1024)
+{
+
+}
+
+forwarding_proxy& forwarding_proxy::set_secure(bool enabled)
+{
+    secure = enabled;
+    return *this;
+}
+
+forwarding_proxy& forwarding_proxy::set_verify_peer(bool enabled)
+{
+    verify_peer = enabled;
+    return *this;
+}
+
+forwarding_proxy& forwarding_proxy::set_kernel_tls(bool enabled)
+{
+    kernel_tls = enabled;
+    return *this;
+}
+
+forwarding_proxy& forwarding_proxy::set_splice(bool enabled)
+{
+    splice = enabled;
+    return *this;
+}
+
+forwarding_proxy& forwarding_proxy::set_buffer_size(size_t size)
+{
+    buffer_size = std::max<size_t>(size, 4096);
+    return *this;
+}
+
+void forwarding_proxy::serve(int listener)
+{
+    // Relays may outlive this object if accept fails
+    std::shared_ptr<const forwarding_proxy> settings = std::make_shared<forwarding_proxy>(*this);
+    struct pollfd descriptor = {0};
+    descriptor.fd = listener;
+    descriptor.events = POLLIN;
+    while (true)
+    {
+        int client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK);
+        if (client < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+            {
+                throw ssl_socket_exception("Unable to accept: " + std::string(strerror(errno)));
+            }
+            poll(&descriptor, 1, -1);
+            continue;
+        }
+
+        std::thread([settings, client]() {
+                try
+                {
+                    settings->relay(client);
+                } catch (const ssl_socket_exception & e) {
+                    std::cerr << e.to_string() << '\n';
+                }
+            }).detach();
+    }
+}
+
+bool forwarding_proxy::relay(int client) const
+{
+    descriptor_guard client_guard(client);
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+
+    // Read ahead would leave records in OpenSSL where poll can't see
+    // them once this side's buffer is full
+    ssl_socket upstream(host, port);
+    upstream.set_adaptive_receive(false).set_verify_peer(verify_peer).set_kernel_tls(kernel_tls).connect();
+    if (secure)
+    {
+        upstream.make_secure();
+    }
+
+    int upstream_descriptor = upstream.get_descriptor();
+    bool splice_out = splice && (!secure || upstream.has_kernel_tls_send());
+    bool splice_in = splice && (!secure || upstream.has_kernel_tls_receive());
+    pump outbound(client, nullptr, upstream_descriptor, &upstream, splice_out, buffer_size);
+    pump inbound(upstream_descriptor, &upstream, client, nullptr, splice_in, buffer_size);
+
+    bool hung_up[2] = {false, false};
+    while (!outbound.is_finished() || !inbound.is_finished())
+    {
+        if (outbound.transfer())
+        {
+            upstream.shutdown_write(); // Pass the client's end of stream on
+        }
+        if (inbound.transfer())
+        {
+            shutdown(client, SHUT_WR);
+        }
+        if (outbound.is_finished() && inbound.is_finished())
+        {
+            break;
+        }
+
+        // poll reports a hang up even with no events asked for, so a
+        // side whose hang up was handled is left out until it has
+        // something to wait for again
+        struct pollfd descriptors[2] = {{0}, {0}};
+        descriptors[0].events = (outbound.wants_input() ? POLLIN : 0) | (inbound.wants_output() ? POLLOUT : 0);
+        descriptors[0].fd = descriptors[0].events != 0 || !hung_up[0] ? client : -1;
+        descriptors[1].events = (inbound.wants_input() ? POLLIN : 0) | (outbound.wants_output() ? POLLOUT : 0);
+        descriptors[1].fd = descriptors[1].events != 0 || !hung_up[1] ? upstream.get_descriptor() : -1;
+        poll(descriptors, 2, inbound.has_buffered_input() ? 0 : -1);
+
+        // A hang up ends sending to that side, an error ends the side
+        pump* into[2] = {&inbound, &outbound};
+        pump* out_of[2] = {&outbound, &inbound};
+        for (size_t side = 0; side < 2; ++side)
+        {
+            if (descriptors[side].revents & (POLLERR | POLLHUP))
+            {
+                hung_up[side] = true;
+                into[side]->end_sink();
+            }
+            if (descriptors[side].revents & POLLERR)
+            {
+                out_of[side]->end_source();
+            }
+        }
+    }
+    return outbound.is_splicing() || inbound.is_splicing();
+}
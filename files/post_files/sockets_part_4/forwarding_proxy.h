@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <cinttypes>
+#include <string>
+
+/**
+ * Accepts plain text connections and forwards each one to an upstream
+ * server, over TLS unless told otherwise, relaying bytes both ways
+ * until the connection ends. Legs the kernel can move on its own are
+ * relayed with splice through a pipe: plain to plain always, and TLS
+ * when kTLS took over the record encryption. Everything else goes
+ * through a bounded buffer per direction, so a slow reader holds back
+ * its writer instead of growing memory.
+ */
+class forwarding_proxy
+{
+  public:
+    /**
+     * @param _host The upstream hostname or ip address
+     * @param _port The upstream port or service name (ex: "443" or "https")
+     */
+    forwarding_proxy(const std::string & _host, const std::string & _port);
+
+    /**
+     * Enable or disable TLS to the upstream (on by default)
+     *
+     * @return a reference to itself
+     */
+    forwarding_proxy& set_secure(bool enabled = true);
+
+    /**
+     * Enable or disable upstream certificate verification (on by default)
+     *
+     * @return a reference to itself
+     */
+    forwarding_proxy& set_verify_peer(bool enabled = true);
+
+    /**
+     * Enable or disable kTLS on the upstream leg (on by default),
+     * which lets TLS legs be spliced when the kernel supports it
+     *
+     * @return a reference to itself
+     */
+    forwarding_proxy& set_kernel_tls(bool enabled = true);
+
+    /**
+     * Enable or disable splicing (on by default), disabled every leg
+     * is copied through user space
+     *
+     * @return a reference to itself
+     */
+    forwarding_proxy& set_splice(bool enabled = true);
+
+    /**
+     * Set how many bytes may be in flight in each direction of a
+     * connection (64KB by default), the pipe size when splicing
+     *
+     * @return a reference to itself
+     */
+    forwarding_proxy& set_buffer_size(size_t size);
+
+    /**
+     * Accept connections forever, relaying each on its own thread.
+     * Failed connections are reported on stderr. The relays work from
+     * a copy of the settings, so they may outlive the proxy if this
+     * throws.
+     *
+     * @param listener a listening socket, blocking or not
+     *
+     * @throw ssl_socket_exception if accept fails
+     */
+    void serve(int listener);
+
+    /**
+     * Connect to the upstream and relay between it and client until
+     * both directions have finished
+     *
+     * @param client an accepted connection, closed when done
+     *
+     * @return whether any direction was spliced
+     * @throw ssl_socket_exception if the upstream connection fails or
+     * either side breaks
+     */
+    bool relay(int client) const;
+
+  private:
+    std::string host;
+    std::string port;
+    bool secure;
+    bool verify_peer;
+    bool kernel_tls;
+    bool splice;
+    size_t buffer_size;
+};
@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "gzip_decoder.h"
+#include "ssl_socket.h"
+
+namespace
+{
+    /**
+     * Window bits for inflateInit2: the largest window plus 32 to
+     * detect gzip or zlib headers automatically
+     */
+    const int AUTODETECT_WINDOW_BITS = 15 + 32;
+}
+
+gzip_decoder::gzip_decoder(const sink_type & _sink, size_t output_size):
+    sink(_sink),
+    output(output_size),
+    stream(),
+    complete(false)
+{
+    if (inflateInit2(&stream, AUTODETECT_WINDOW_BITS) != Z_OK)
+    {
+        throw ssl_socket_exception("Unable to initialize zlib");
+    }
+}
+
+gzip_decoder::~gzip_decoder()
+{
+    inflateEnd(&stream);
+}
+
+void gzip_decoder::feed(const char* data, size_t length)
+{
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = length;
+    // zlib may hold back output when the buffer fills, so keep going
+    // until there is no input left and the last call had room to spare
+    bool output_full = false;
+    while (stream.avail_in > 0 || output_full)
+    {
+        if (complete)
+        {
+            // Another gzip member follows the one that just ended
+            inflateReset(&stream);
+            complete = false;
+        }
+
+        stream.next_out = (Bytef*)output.data();
+        stream.avail_out = output.size();
+        int result = inflate(&stream, Z_NO_FLUSH);
+        switch (result)
+        {
+          case Z_STREAM_END:
+            complete = true;
+            break;
+          case Z_OK:
+          case Z_BUF_ERROR: // No progress possible until more input arrives
+            break;
+          default:
+            throw ssl_socket_exception("Error decompressing: " + std::string(stream.msg != nullptr ? stream.msg : zError(result)));
+            break;
+        }
+
+        size_t produced = output.size() - stream.avail_out;
+        if (produced > 0)
+        {
+            sink(output.data(), produced);
+        }
+        output_full = !complete && stream.avail_out == 0;
+        if (result == Z_BUF_ERROR)
+        {
+            break;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <cinttypes>
+#include <functional>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * Incremental gzip/zlib decompression. Compressed bytes can be fed in
+ * whatever pieces they arrive in and are inflated into one output
+ * buffer that is reused for the life of the decoder, so nothing is
+ * ever buffered beyond a single output block.
+ */
+class gzip_decoder
+{
+  public:
+    typedef std::function<void(const char* data, size_t length)> sink_type;
+
+    /**
+     * @param _sink called with every block of decompressed data, the
+     * data is only valid for the duration of the call
+     * @param output_size the size of the reusable output buffer
+     */
+    explicit gzip_decoder(const sink_type & _sink, size_t output_size = 64 * 1024);
+    ~gzip_decoder();
+    gzip_decoder(gzip_decoder const&) = delete;
+    gzip_decoder& operator=(gzip_decoder const&) = delete;
+
+    /**
+     * Decompress the next piece of the stream. Concatenated gzip
+     * members (as produced by pigz or cat a.gz b.gz) are decoded one
+     * after another.
+     *
+     * @param data compressed bytes
+     * @param length the number of compressed bytes
+     *
+     * @throw ssl_socket_exception if the data is not valid gzip or zlib
+     */
+    void feed(const char* data, size_t length);
+
+    /**
+     * Check to see if the last member of the stream has ended
+     */
+    bool is_complete() const { return complete; }
+
+  private:
+    sink_type sink;
+    std::vector<char> output;
+    z_stream stream;
+    bool complete;
+};
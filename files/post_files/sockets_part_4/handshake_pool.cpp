@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "handshake_pool.h"
+#include "ssl_socket.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <openssl/err.h>
+
+namespace
+{
+    /**
+     * Describe the error left by the step on this thread. A reset
+     * leaves the error queue empty, errno says what happened.
+     */
+    std::string describe_error()
+    {
+        int saved_errno = errno;
+        unsigned long error = ERR_get_error();
+        if (error == 0 && saved_errno != 0)
+        {
+            return std::string(strerror(saved_errno));
+        }
+        return std::string(ERR_error_string(error, nullptr));
+    }
+}
+
+handshake_pool::handshake_pool(size_t threads):
+    stopping(false),
+    notify(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    steps(0)
+{
+    if (notify < 0)
+    {
+        throw ssl_socket_exception("Unable to create eventfd: " + std::string(strerror(errno)));
+    }
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        workers.emplace_back(&handshake_pool::run, this);
+    }
+}
+
+handshake_pool::~handshake_pool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (std::thread & worker : workers)
+    {
+        worker.join();
+    }
+    close(notify);
+}
+
+void handshake_pool::submit(job & target)
+{
+    target.running.store(true, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(&target);
+    }
+    work_ready.notify_one();
+}
+
+void handshake_pool::wait(job & target)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    step_done.wait(guard, [&target]() { return !target.is_running(); });
+}
+
+void handshake_pool::clear_notifications()
+{
+    uint64_t count;
+    while (read(notify, &count, sizeof(count)) > 0)
+    {
+    }
+}
+
+void handshake_pool::run()
+{
+    while (true)
+    {
+        job* current;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            work_ready.wait(guard, [this]() { return stopping || !queue.empty(); });
+            // Queued steps still run, their owners may be waiting on them
+            if (queue.empty())
+                return;
+            current = queue.front();
+            queue.pop_front();
+        }
+
+        ERR_clear_error();
+        errno = 0;
+        current->result = SSL_do_handshake(current->ssl);
+        current->ssl_error = current->result == 1 ? SSL_ERROR_NONE : SSL_get_error(current->ssl, current->result);
+        current->error.clear();
+        if (current->ssl_error != SSL_ERROR_NONE && current->ssl_error != SSL_ERROR_WANT_READ && current->ssl_error != SSL_ERROR_WANT_WRITE)
+        {
+            current->error = describe_error();
+        }
+        steps.fetch_add(1, std::memory_order_relaxed);
+
+        {
+            // Under the lock so wait can't miss the change
+            std::lock_guard<std::mutex> guard(lock);
+            current->running.store(false, std::memory_order_release);
+        }
+        step_done.notify_all();
+        uint64_t one = 1;
+        ssize_t ignored = write(notify, &one, sizeof(one));
+        (void)ignored;
+    }
+}
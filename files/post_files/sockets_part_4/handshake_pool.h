@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <openssl/ssl.h>
+
+/**
+ * Worker threads that run TLS handshake steps, so the key exchange,
+ * signatures and certificate checks of a reconnect burst don't hold
+ * up an event loop serving established connections.
+ *
+ * A step is one SSL_do_handshake call. It runs until the handshake
+ * either completes, fails or needs the socket (WANT_READ or
+ * WANT_WRITE), then the SSL handle goes back to its owner, who waits
+ * for the socket and submits the next step. Only one thread touches a
+ * handle at a time, which is all OpenSSL asks for. The notification
+ * descriptor becomes readable whenever a step finishes, so it can sit
+ * in the same poll set as the sockets.
+ */
+class handshake_pool
+{
+  public:
+    /**
+     * One handshake in flight. The owner may only look at the results,
+     * or the SSL handle, while the job is not running.
+     */
+    struct job
+    {
+        SSL* ssl;
+        std::atomic<bool> running;
+        int result; ///< What SSL_do_handshake returned
+        int ssl_error; ///< SSL_get_error for the result
+        std::string error; ///< What went wrong, the error queue is per thread so it is read on the worker
+
+        job(): ssl(nullptr), running(false), result(0), ssl_error(SSL_ERROR_NONE) {}
+        bool is_running() const { return running.load(std::memory_order_acquire); }
+    };
+
+    /**
+     * @param threads the number of workers, 0 for one per CPU
+     * @throw ssl_socket_exception if the notification descriptor can't be created
+     */
+    explicit handshake_pool(size_t threads = 0);
+    ~handshake_pool();
+    handshake_pool(handshake_pool const&) = delete;
+    handshake_pool& operator=(handshake_pool const&) = delete;
+
+    /**
+     * Queue the next step of the handshake on target.ssl. target must
+     * not be running and must outlive the step.
+     */
+    void submit(job & target);
+
+    /**
+     * Block until target is no longer running
+     */
+    void wait(job & target);
+
+    /**
+     * A descriptor that polls readable after steps finish, until
+     * clear_notifications is called
+     */
+    int get_descriptor() const { return notify; }
+
+    /**
+     * Reset the notification descriptor, call it before checking jobs
+     * so a step finishing in between isn't missed
+     */
+    void clear_notifications();
+
+    size_t get_threads() const { return workers.size(); }
+
+    /**
+     * The number of steps run so far
+     */
+    uint64_t get_steps() const { return steps.load(std::memory_order_relaxed); }
+
+  private:
+    void run();
+
+    std::vector<std::thread> workers;
+    std::deque<job*> queue;
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::condition_variable step_done;
+    bool stopping;
+    int notify;
+    std::atomic<uint64_t> steps;
+};
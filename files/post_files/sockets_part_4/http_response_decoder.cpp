@@ -0,0 +1,212 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "http_response_decoder.h"
+#include "ssl_socket.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+namespace
+{
+    const size_t MAX_HEADER_SIZE = 64 * 1024;
+    const size_t MAX_LINE_SIZE = 8 * 1024;
+    const char HEADER_END[] = "\r\n\r\n";
+
+    std::string trim(const std::string & value)
+    {
+        size_t start = value.find_first_not_of(" \t\r");
+        size_t end = value.find_last_not_of(" \t\r");
+        return start == std::string::npos ? std::string() : value.substr(start, end - start + 1);
+    }
+
+    bool contains_token(const std::string & value, const char* token)
+    {
+        std::string lower = value;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        return lower.find(token) != std::string::npos;
+    }
+}
+
+http_response_decoder::http_response_decoder(const sink_type & _sink, bool _decode_content):
+    sink(_sink),
+    decode_content(_decode_content),
+    state(state_headers),
+    status(0),
+    has_length(false),
+    remaining(0)
+{
+
+}
+
+std::string http_response_decoder::get_header(const std::string & name) const
+{
+    // Skip the status line, then look at each "Name: value" line
+    for (size_t start = headers.find("\r\n"); start != std::string::npos && start + 2 < headers.size(); )
+    {
+        start += 2;
+        size_t end = headers.find("\r\n", start);
+        size_t colon = headers.find(':', start);
+        if (colon != std::string::npos && colon < end && colon - start == name.size()
+            && strncasecmp(headers.c_str() + start, name.c_str(), name.size()) == 0)
+        {
+            return trim(headers.substr(colon + 1, end - colon - 1));
+        }
+        start = end;
+    }
+    return "";
+}
+
+void http_response_decoder::feed(const char* data, size_t length)
+{
+    while (length > 0 && state != state_complete)
+    {
+        size_t consumed = 0;
+        switch (state)
+        {
+          case state_headers:
+          {
+            size_t previous_size = headers.size();
+            headers.append(data, length);
+            size_t end = headers.find(HEADER_END, previous_size >= 3 ? previous_size - 3 : 0);
+            if (end == std::string::npos)
+            {
+                if (headers.size() > MAX_HEADER_SIZE)
+                {
+                    throw ssl_socket_exception("HTTP headers too large");
+                }
+                return;
+            }
+            headers.resize(end + 4);
+            consumed = headers.size() - previous_size;
+            parse_headers();
+            break;
+          }
+          case state_chunk_size:
+          case state_chunk_end:
+          case state_trailers:
+            consumed = feed_line(data, length);
+            break;
+          case state_chunk_data:
+          case state_body:
+            consumed = has_length ? std::min<uint64_t>(remaining, length) : length;
+            emit_body(data, consumed);
+            remaining -= has_length ? consumed : 0;
+            if (has_length && remaining == 0)
+            {
+                state = state == state_chunk_data ? state_chunk_end : state_complete;
+            }
+            break;
+          case state_complete:
+            break;
+        }
+        data += consumed;
+        length -= consumed;
+    }
+}
+
+void http_response_decoder::parse_headers()
+{
+    // "HTTP/1.1 200 OK", 101, 204 and 304 responses have no body
+    size_t status_start = headers.find(' ');
+    status = status_start == std::string::npos ? 0 : atoi(headers.c_str() + status_start + 1);
+    if (status >= 100 && status < 200 && status != 101)
+    {
+        // Interim responses like 100 Continue and 103 Early Hints come
+        // before the real one, skip them and keep reading headers
+        headers.clear();
+        status = 0;
+        return;
+    }
+    if (status == 101 || status == 204 || status == 304)
+    {
+        state = state_complete;
+        return;
+    }
+
+    std::string encoding = get_header("Content-Encoding");
+    if (decode_content && (contains_token(encoding, "gzip") || contains_token(encoding, "deflate")))
+    {
+        decompressor.reset(new gzip_decoder(sink));
+    }
+
+    if (contains_token(get_header("Transfer-Encoding"), "chunked"))
+    {
+        state = state_chunk_size;
+        has_length = true;
+        return;
+    }
+
+    std::string content_length = get_header("Content-Length");
+    state = state_body;
+    if (!content_length.empty())
+    {
+        has_length = true;
+        remaining = strtoull(content_length.c_str(), nullptr, 10);
+        if (remaining == 0)
+            state = state_complete;
+    }
+}
+
+size_t http_response_decoder::feed_line(const char* data, size_t length)
+{
+    const char* newline = static_cast<const char*>(memchr(data, '\n', length));
+    size_t consumed = newline == nullptr ? length : newline - data + 1;
+    line.append(data, consumed);
+    if (line.size() > MAX_LINE_SIZE)
+    {
+        throw ssl_socket_exception("HTTP chunk line too long");
+    }
+    if (newline == nullptr)
+    {
+        return consumed;
+    }
+
+    std::string current = trim(line.substr(0, line.size() - 1));
+    line.clear();
+    switch (state)
+    {
+      case state_chunk_size:
+        // Chunk extensions after a ';' are ignored
+        remaining = strtoull(current.c_str(), nullptr, 16);
+        state = remaining == 0 ? state_trailers : state_chunk_data;
+        break;
+      case state_chunk_end:
+        if (!current.empty())
+        {
+            throw ssl_socket_exception("Malformed HTTP chunk");
+        }
+        state = state_chunk_size;
+        break;
+      case state_trailers:
+        if (current.empty())
+            state = state_complete;
+        break;
+      default:
+        break;
+    }
+    return consumed;
+}
+
+void http_response_decoder::emit_body(const char* data, size_t length)
+{
+    if (decompressor)
+    {
+        decompressor->feed(data, length);
+    } else {
+        sink(data, length);
+    }
+}
@@ -0,0 +1,101 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <memory>
+#include <string>
+#include "gzip_decoder.h"
+
+/**
+ * Streaming decoder for an HTTP/1.1 response. Raw bytes from the
+ * socket go in as they are read. The body comes out of the sink with
+ * the chunked transfer coding removed and, if the server used gzip or
+ * deflate, decompressed. Nothing but the headers is ever buffered.
+ */
+class http_response_decoder
+{
+  public:
+    typedef gzip_decoder::sink_type sink_type;
+
+    /**
+     * @param _sink called with every block of the decoded body
+     * @param _decode_content whether to decompress gzip and deflate
+     * bodies, pass false to get the body exactly as it was encoded
+     */
+    explicit http_response_decoder(const sink_type & _sink, bool _decode_content = true);
+
+    /**
+     * Decode the next bytes read from the socket
+     *
+     * @throw ssl_socket_exception if the response is malformed
+     */
+    void feed(const char* data, size_t length);
+
+    /**
+     * Check to see if the whole response has been received. Responses
+     * without a length or chunked coding only end when the server
+     * closes the connection, so this never becomes true for them.
+     */
+    bool is_complete() const { return state == state_complete; }
+
+    /**
+     * Check to see if the status line and headers have been received
+     */
+    bool has_headers() const { return state != state_headers; }
+
+    /**
+     * The raw status line and headers, including the blank line that
+     * ends them
+     */
+    const std::string& get_headers() const { return headers; }
+
+    /**
+     * The status code from the status line, or 0 before the headers
+     * have been received
+     */
+    int get_status() const { return status; }
+
+    /**
+     * The value of a header (matched case-insensitively), or an empty
+     * string if the header wasn't sent
+     */
+    std::string get_header(const std::string & name) const;
+
+  private:
+    enum parse_state
+    {
+        state_headers,
+        state_chunk_size,
+        state_chunk_data,
+        state_chunk_end,
+        state_trailers,
+        state_body,
+        state_complete
+    };
+
+    void parse_headers();
+    void emit_body(const char* data, size_t length);
+    size_t feed_line(const char* data, size_t length);
+
+    sink_type sink;
+    bool decode_content;
+    std::unique_ptr<gzip_decoder> decompressor;
+    std::string headers;
+    std::string line;
+    parse_state state;
+    int status;
+    bool has_length;
+    uint64_t remaining;
+};
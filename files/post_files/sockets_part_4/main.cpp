@@ -14,35 +14,162 @@ ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
 OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 #include <iostream>
-#include <thread>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#include "batch_fetcher.h"
+#include "http_response_decoder.h"
+#include "output_sink.h"
 #include "ssl_socket.h"
+#include "threaded_sink.h"
 
 namespace
 {
     const char HOST[] = "fizz.buzz";
-    const size_t BUFFER_SIZE = 1024;
+
+    /**
+     * Read one URL per line, skipping blank lines and # comments
+     *
+     * @param path the file to read, or "-" for stdin
+     */
+    std::vector<std::string> read_url_list(const std::string & path)
+    {
+        std::ifstream file;
+        if (path != "-")
+        {
+            file.open(path);
+            if (!file)
+            {
+                throw ssl_socket_exception("Unable to open URL list " + path);
+            }
+        }
+        std::istream & in = path == "-" ? std::cin : file;
+
+        std::vector<std::string> urls;
+        for (std::string line; std::getline(in, line); )
+        {
+            size_t start = line.find_first_not_of(" \t\r");
+            size_t end = line.find_last_not_of(" \t\r");
+            if (start != std::string::npos && line[start] != '#')
+                urls.push_back(line.substr(start, end - start + 1));
+        }
+        return urls;
+    }
 }
 
+/**
+ * Fetches the front page, asking for a gzip body and decompressing it
+ * as it arrives. Usage:
+ *
+ *   sockets_part_4 [--threaded] [--spin MICROSECONDS] [--output FILE [--direct]]
+ *   sockets_part_4 --batch URL_LIST [--connections N] [--per-host N] [--insecure] [--output FILE]
+ *
+ * --threaded decompresses on a separate thread while the next records
+ * are read from the socket. The body goes to stdout unless --output
+ * names a file, --direct writes that file with O_DIRECT. --spin spins
+ * on the socket for up to that long before blocking for more data.
+ *
+ * --batch fetches every URL listed in a file (- for stdin) instead,
+ * at most --connections (32) at once and --per-host (4) per host.
+ * Bodies are written in the order of the list, failures are reported
+ * on stderr. --insecure skips certificate verification.
+ */
 int main(int argc, char** argv)
 {
+    bool threaded = false;
+    bool direct = false;
+    std::chrono::microseconds spin(0);
+    std::string output_path;
+    std::string batch_path;
+    batch_fetcher batch;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--threaded") == 0)
+            threaded = true;
+        else if (strcmp(argv[i], "--direct") == 0)
+            direct = true;
+        else if (strcmp(argv[i], "--spin") == 0 && i + 1 < argc)
+            spin = std::chrono::microseconds(std::stoul(argv[++i]));
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output_path = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batch_path = argv[++i];
+        else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc)
+            batch.set_max_connections(std::stoul(argv[++i]));
+        else if (strcmp(argv[i], "--per-host") == 0 && i + 1 < argc)
+            batch.set_max_per_host(std::stoul(argv[++i]));
+        else if (strcmp(argv[i], "--insecure") == 0)
+            batch.set_verify_peer(false);
+    }
+
     try
     {
+        std::unique_ptr<output_sink> output(output_path.empty() ? new output_sink(STDOUT_FILENO) : new output_sink(output_path, direct));
+        output_sink* body = output.get();
+        auto write_body = [body](const char* data, size_t length) { body->write(data, length); };
+
+        if (!batch_path.empty())
+        {
+            bool all_succeeded = true;
+            batch.run(read_url_list(batch_path), [body, &all_succeeded](const fetch_result & result) {
+                    if (!result.error.empty())
+                    {
+                        std::cerr << result.url << ": " << result.error << '\n';
+                        all_succeeded = false;
+                        return;
+                    }
+                    body->write(result.body.data(), result.body.size());
+                });
+            output->flush();
+            return all_succeeded ? 0 : 1;
+        }
+
         ssl_socket s(HOST, "https");
-        char buffer[BUFFER_SIZE];
+        std::vector<char> buffer; // Sized by each read to fit what has arrived
         std::string http_query = "GET / HTTP/1.1\r\n"    \
-            "Host: " + std::string(HOST) + "\r\n\r\n";
+            "Host: " + std::string(HOST) + "\r\n"         \
+            "Accept-Encoding: gzip\r\n\r\n";
 
-        s.connect().make_secure().write(http_query);
-        while (s.is_connected())
+        std::unique_ptr<http_response_decoder> decoder;
+        std::unique_ptr<threaded_sink> pipeline;
+        if (threaded)
         {
-            size_t length = s.read(buffer, BUFFER_SIZE);
+            // The decoder lives on the worker thread, reads only copy into the queue
+            std::shared_ptr<http_response_decoder> worker_decoder(new http_response_decoder(write_body));
+            pipeline.reset(new threaded_sink([worker_decoder](const char* data, size_t length) {
+                        worker_decoder->feed(data, length);
+                    }));
+        } else {
+            decoder.reset(new http_response_decoder(write_body));
+        }
+
+        // The reader needs to know where the response ends, so it
+        // parses the framing itself when decompression runs elsewhere
+        http_response_decoder framing([](const char*, size_t) {}, false);
+        http_response_decoder & progress = threaded ? framing : *decoder;
+
+        s.set_spin_wait(spin).connect().make_secure().write(http_query);
+        while (s.is_connected() && !progress.is_complete())
+        {
+            size_t length = s.read(buffer);
             if (length == 0 && s.is_connected())
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                s.wait_readable(std::chrono::seconds(1));
+            } else if (threaded) {
+                framing.feed(buffer.data(), length);
+                pipeline->write(buffer.data(), length);
             } else {
-                std::cout << std::string(buffer, length);
+                decoder->feed(buffer.data(), length);
             }
         }
+        if (pipeline)
+        {
+            pipeline->finish();
+        }
+        output->flush();
+        std::cerr << progress.get_headers();
     } catch (const ssl_socket_exception & e) {
         std::cerr << e.to_string() << '\n';
         return 1;
@@ -0,0 +1,256 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "output_sink.h"
+#include "ssl_socket.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+    /**
+     * O_DIRECT needs the buffer, the file offset and the length
+     * aligned, 4KB covers every common block size
+     */
+    const size_t DIRECT_ALIGNMENT = 4096;
+}
+
+output_sink::output_sink(int _fd, size_t buffer_size):
+    fd(_fd),
+    owns_fd(false),
+    method(write_method::plain),
+    blocks{nullptr, nullptr},
+    block_size(0),
+    current(0),
+    used(0)
+{
+    struct stat status;
+    if (fstat(fd, &status) == 0 && S_ISFIFO(status.st_mode))
+    {
+        method = write_method::vmsplice;
+    }
+    setup(buffer_size);
+}
+
+output_sink::output_sink(const std::string & path, bool direct, size_t buffer_size):
+    fd(-1),
+    owns_fd(true),
+    method(write_method::plain),
+    blocks{nullptr, nullptr},
+    block_size(0),
+    current(0),
+    used(0)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (direct)
+    {
+        fd = open(path.c_str(), flags | O_DIRECT, 0644);
+        method = write_method::direct;
+    }
+    if (fd < 0)
+    {
+        // tmpfs and some others refuse O_DIRECT with EINVAL
+        fd = open(path.c_str(), flags, 0644);
+        method = write_method::plain;
+    }
+    if (fd < 0)
+    {
+        throw ssl_socket_exception("Unable to open " + path + ": " + std::string(strerror(errno)));
+    }
+    setup(buffer_size);
+}
+
+output_sink::~output_sink()
+{
+    try
+    {
+        flush();
+    } catch (...) {
+        // Destructors can't report errors, call flush to see them
+    }
+
+    // Pages given to a pipe with vmsplice stay referenced by the pipe
+    // until they're read, munmap leaves them intact for the reader
+    // where free could hand them out again
+    for (char* block : blocks)
+    {
+        if (block != nullptr)
+            munmap(block, block_size);
+    }
+    if (owns_fd)
+    {
+        close(fd);
+    }
+}
+
+void output_sink::setup(size_t buffer_size)
+{
+    if (method == write_method::vmsplice)
+    {
+        // A block may only be refilled once the reader is done with it.
+        // With blocks the size of the pipe, filling the pipe with the
+        // next block guarantees the previous one has been read.
+        fcntl(fd, F_SETPIPE_SZ, buffer_size);
+        int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+        if (pipe_size <= 0)
+        {
+            method = write_method::plain;
+        } else {
+            buffer_size = pipe_size;
+        }
+    }
+    block_size = (buffer_size + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+
+    // mmap gives page aligned memory for O_DIRECT and pages that are
+    // never recycled behind a pipe's back
+    size_t block_count = method == write_method::vmsplice ? 2 : 1;
+    for (size_t i = 0; i < block_count; ++i)
+    {
+        void* block = mmap(nullptr, block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED)
+        {
+            std::string error = strerror(errno);
+            if (owns_fd)
+                close(fd);
+            if (blocks[0] != nullptr)
+                munmap(blocks[0], block_size);
+            throw ssl_socket_exception("Unable to allocate output buffer: " + error);
+        }
+        blocks[i] = static_cast<char*>(block);
+    }
+}
+
+output_sink& output_sink::set_vmsplice(bool enabled)
+{
+    if (!enabled && method == write_method::vmsplice)
+    {
+        method = write_method::plain;
+    }
+    return *this;
+}
+
+const char* output_sink::get_method() const
+{
+    switch (method)
+    {
+      case write_method::vmsplice:
+        return "vmsplice";
+      case write_method::direct:
+        return "direct";
+      default:
+        return "write";
+    }
+}
+
+void output_sink::write(const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        if (used == 0 && length >= block_size && method == write_method::plain)
+        {
+            // Nothing to gain from copying a large write into the buffer
+            write_fully(data, length);
+            return;
+        }
+
+        size_t copied = std::min(length, block_size - used);
+        memcpy(blocks[current] + used, data, copied);
+        used += copied;
+        data += copied;
+        length -= copied;
+        if (used == block_size)
+        {
+            write_block(blocks[current], used);
+            used = 0;
+        }
+    }
+}
+
+void output_sink::flush()
+{
+    if (used == 0)
+    {
+        return;
+    }
+
+    size_t length = used;
+    used = 0;
+    if (method == write_method::direct)
+    {
+        // Write the aligned part directly, then the tail through the page cache
+        size_t aligned = length / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT;
+        write_fully(blocks[current], aligned);
+        if (aligned < length)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            write_fully(blocks[current] + aligned, length - aligned);
+            method = write_method::plain;
+        }
+    } else {
+        // A partial block can't be spliced, the pipe might not be full
+        // enough when its pages are reused
+        write_fully(blocks[current], length);
+    }
+}
+
+void output_sink::write_block(const char* data, size_t length)
+{
+    if (method == write_method::vmsplice)
+    {
+        vmsplice_fully(data, length);
+        current = (current + 1) % 2;
+    } else {
+        write_fully(data, length);
+    }
+}
+
+void output_sink::write_fully(const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw ssl_socket_exception("Error writing output: " + std::string(strerror(errno)));
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+void output_sink::vmsplice_fully(const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        struct iovec vector = {const_cast<char*>(data), length};
+        ssize_t spliced = vmsplice(fd, &vector, 1, 0);
+        if (spliced < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw ssl_socket_exception("Error splicing output: " + std::string(strerror(errno)));
+        }
+        data += spliced;
+        length -= spliced;
+    }
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * Writes received data to a file descriptor in large blocks instead
+ * of one small write per read. When the descriptor is a pipe, full
+ * blocks are handed to the kernel with vmsplice so the pipe references
+ * our pages instead of copying them. Files can optionally be written
+ * with O_DIRECT to keep huge downloads out of the page cache.
+ */
+class output_sink
+{
+  public:
+    /**
+     * Write to an already open descriptor, such as STDOUT_FILENO. The
+     * descriptor is not closed.
+     *
+     * @param _fd the descriptor to write to
+     * @param buffer_size the size of each block written
+     */
+    explicit output_sink(int _fd, size_t buffer_size = 1024 * 1024);
+
+    /**
+     * Create or truncate a file and write to it
+     *
+     * @param path the file to write
+     * @param direct whether to bypass the page cache with O_DIRECT,
+     * ignored where the filesystem doesn't support it
+     * @param buffer_size the size of each block written
+     *
+     * @throw ssl_socket_exception if the file can not be opened
+     */
+    output_sink(const std::string & path, bool direct, size_t buffer_size = 1024 * 1024);
+
+    /**
+     * Flushes whatever is buffered, use flush to see errors
+     */
+    ~output_sink();
+    output_sink(output_sink const&) = delete;
+    output_sink& operator=(output_sink const&) = delete;
+
+    /**
+     * Enable or disable vmsplice for pipes (on by default). Must be
+     * set before the first write.
+     *
+     * @return a reference to itself
+     */
+    output_sink& set_vmsplice(bool enabled = true);
+
+    /**
+     * Buffer data for writing, writing out every block that fills
+     *
+     * @throw ssl_socket_exception if a write fails
+     */
+    void write(const char* data, size_t length);
+
+    /**
+     * Write out everything buffered so far
+     *
+     * @throw ssl_socket_exception if a write fails
+     */
+    void flush();
+
+    /**
+     * How full blocks are written: "vmsplice", "direct" or "write"
+     */
+    const char* get_method() const;
+
+  private:
+    enum class write_method
+    {
+        plain,
+        vmsplice,
+        direct
+    };
+
+    void setup(size_t buffer_size);
+    void write_block(const char* data, size_t length);
+    void write_fully(const char* data, size_t length);
+    void vmsplice_fully(const char* data, size_t length);
+
+    int fd;
+    bool owns_fd;
+    write_method method;
+    char* blocks[2];
+    size_t block_size;
+    size_t current;
+    size_t used;
+};
@@ -18,9 +18,509 @@ kind("ConsoleApp")
 language("C++")
 buildoptions({"-std=c++11"})
 linkoptions({"-pthread"})
-links({"ssl", "crypto"})
+links({"ssl", "crypto", "z"})
 libdirs({"/usr/local/lib"})
 files({"main.cpp"
+       , "batch_fetcher.cpp"
+       , "buffer_pool.cpp"
+       , "bulk_resolver.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "gzip_decoder.cpp"
+       , "handshake_pool.cpp"
+       , "http_response_decoder.cpp"
+       , "output_sink.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "threaded_sink.cpp"
+       , "tuning_profile.cpp"
+})
+
+
+project("bench_idle")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_idle.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "crypto_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_record_size")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_record_size.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_ciphers")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_ciphers.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_verify")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_verify.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_gzip")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto", "z"})
+libdirs({"/usr/local/lib"})
+files({"bench_gzip.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "gzip_decoder.cpp"
+       , "handshake_pool.cpp"
+       , "http_response_decoder.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "threaded_sink.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("download")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto", "z"})
+libdirs({"/usr/local/lib"})
+files({"download.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "gzip_decoder.cpp"
+       , "handshake_pool.cpp"
+       , "http_response_decoder.cpp"
+       , "range_download.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_range")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto", "z"})
+libdirs({"/usr/local/lib"})
+files({"bench_range.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "gzip_decoder.cpp"
+       , "handshake_pool.cpp"
+       , "http_response_decoder.cpp"
+       , "range_download.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_output")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_output.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "output_sink.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_receive")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto", "dl"})
+libdirs({"/usr/local/lib"})
+files({"bench_receive.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_latency")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_latency.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_batch")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto", "z"})
+libdirs({"/usr/local/lib"})
+files({"bench_batch.cpp"
+       , "batch_fetcher.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "bulk_resolver.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "gzip_decoder.cpp"
+       , "handshake_pool.cpp"
+       , "http_response_decoder.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_unix")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_unix.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_zerocopy")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_zerocopy.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
        , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
 })
 
+project("proxy")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"proxy.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "forwarding_proxy.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_proxy")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_proxy.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "forwarding_proxy.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_websocket")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto", "z"})
+libdirs({"/usr/local/lib"})
+files({"bench_websocket.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "gzip_decoder.cpp"
+       , "handshake_pool.cpp"
+       , "http_response_decoder.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+       , "websocket_client.cpp"
+       , "websocket_frame.cpp"
+})
+
+project("bench_socket_set")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_socket_set.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "socket_set.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_tuning")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_tuning.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_send_queue")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_send_queue.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "socket_set.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("resolve")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+libdirs({"/usr/local/lib"})
+files({"resolve.cpp"
+       , "bulk_resolver.cpp"
+       , "output_sink.cpp"
+})
+
+project("bench_resolver")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_resolver.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "bulk_resolver.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_buffer_pool")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_buffer_pool.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "socket_set.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("fault_server")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"fault_server.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "fault_injection.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_faults")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_faults.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "fault_injection.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_handshakes")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_handshakes.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+})
+
+project("bench_warmup")
+kind("ConsoleApp")
+language("C++")
+buildoptions({"-std=c++11"})
+linkoptions({"-pthread"})
+links({"ssl", "crypto"})
+libdirs({"/usr/local/lib"})
+files({"bench_warmup.cpp"
+       , "bench_common.cpp"
+       , "buffer_pool.cpp"
+       , "certificate_verifier.cpp"
+       , "cpu_features.cpp"
+       , "fault_injection.cpp"
+       , "handshake_pool.cpp"
+       , "send_queue.cpp"
+       , "ssl_socket.cpp"
+       , "tuning_profile.cpp"
+       , "warm_pool.cpp"
+})
@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "forwarding_proxy.h"
+#include "ssl_socket.h"
+
+/**
+ * Accept plain text connections on a local port and forward them to
+ * a server over TLS. Usage:
+ *
+ *   proxy <listen port> <upstream host> <upstream port> [--plain]
+ *         [--insecure] [--no-splice] [--no-ktls] [--buffer BYTES]
+ *
+ * --plain forwards without TLS, --insecure skips verifying the
+ * upstream certificate. --no-splice and --no-ktls copy every byte
+ * through user space. --buffer sets how much may be in flight in each
+ * direction of a connection.
+ */
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        std::cerr << "Usage: " << argv[0] << " <listen port> <upstream host> <upstream port> [--plain] [--insecure] [--no-splice] [--no-ktls] [--buffer BYTES]\n";
+        return 1;
+    }
+
+    forwarding_proxy proxy(argv[2], argv[3]);
+    for (int i = 4; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--plain") == 0)
+            proxy.set_secure(false);
+        else if (strcmp(argv[i], "--insecure") == 0)
+            proxy.set_verify_peer(false);
+        else if (strcmp(argv[i], "--no-splice") == 0)
+            proxy.set_splice(false);
+        else if (strcmp(argv[i], "--no-ktls") == 0)
+            proxy.set_kernel_tls(false);
+        else if (strcmp(argv[i], "--buffer") == 0 && i + 1 < argc)
+            proxy.set_buffer_size(std::stoul(argv[++i]));
+    }
+
+    // A client hanging up mid write must not take the proxy down
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(std::stoul(argv[1]));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, SOMAXCONN) < 0)
+    {
+        std::cerr << "Unable to listen: " << strerror(errno) << '\n';
+        return 1;
+    }
+
+    try
+    {
+        proxy.serve(listener);
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,457 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "range_download.h"
+#include "http_response_decoder.h"
+#include "ssl_socket.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+    const size_t BUFFER_SIZE = 64 * 1024;
+    const std::chrono::seconds READ_TIMEOUT(30);
+    const std::chrono::milliseconds RETRY_DELAY(100);
+
+    /**
+     * Everything needed to open a connection and build a request
+     */
+    struct endpoint
+    {
+        std::string host;
+        std::string port;
+        std::string path;
+        bool secure;
+        bool verify_peer;
+    };
+
+    /**
+     * The half open byte range [start, end) and how often it failed
+     */
+    struct byte_range
+    {
+        uint64_t start;
+        uint64_t end;
+        size_t attempts;
+    };
+
+    /**
+     * How far read_response reads
+     */
+    enum class response_end
+    {
+        headers, ///< Stop once the headers are in, for HEAD requests
+        body, ///< The body must be complete
+        body_or_close ///< A body without a length ends when the server closes
+    };
+
+    /**
+     * Ranges waiting to be fetched, shared by every connection thread
+     */
+    class range_queue
+    {
+      public:
+        void push(const byte_range & range)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ranges.push_back(range);
+        }
+
+        /**
+         * Take the next range
+         *
+         * @return false if there are none left or the download failed
+         */
+        bool pop(byte_range & range)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (ranges.empty() || !failure.empty())
+            {
+                return false;
+            }
+            range = ranges.front();
+            ranges.pop_front();
+            return true;
+        }
+
+        /**
+         * Abandon the download, only the first failure is kept
+         */
+        void fail(const std::string & message)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (failure.empty())
+                failure = message;
+        }
+
+        std::string get_failure()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            return failure;
+        }
+
+      private:
+        std::mutex lock;
+        std::deque<byte_range> ranges;
+        std::string failure;
+    };
+
+    /**
+     * The output file, preallocated so the download can't run out of
+     * space half way and mapped so ranges can be written in any order
+     */
+    class mapped_file
+    {
+      public:
+        mapped_file(const std::string & path, uint64_t _size):
+            size(_size),
+            data(nullptr),
+            file(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644))
+        {
+            if (file < 0)
+            {
+                throw ssl_socket_exception("Unable to open " + path + ": " + std::string(strerror(errno)));
+            }
+            if (size == 0)
+            {
+                return; // mmap refuses empty mappings
+            }
+
+            int error = posix_fallocate(file, 0, size);
+            if (error == EOPNOTSUPP || error == EINVAL)
+            {
+                // Some filesystems can't preallocate, a sparse file still works
+                error = ftruncate(file, size) < 0 ? errno : 0;
+            }
+            if (error != 0)
+            {
+                close(file);
+                unlink(path.c_str());
+                throw ssl_socket_exception("Unable to allocate " + path + ": " + std::string(strerror(error)));
+            }
+
+            void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+            if (mapping == MAP_FAILED)
+            {
+                close(file);
+                unlink(path.c_str());
+                throw ssl_socket_exception("Unable to map " + path + ": " + std::string(strerror(errno)));
+            }
+            data = static_cast<char*>(mapping);
+        }
+        ~mapped_file()
+        {
+            if (data != nullptr)
+                munmap(data, size);
+            close(file);
+        }
+        mapped_file(mapped_file const&) = delete;
+        mapped_file& operator=(mapped_file const&) = delete;
+
+        char* get_data() const { return data; }
+
+      private:
+        uint64_t size;
+        char* data;
+        int file;
+    };
+
+    std::unique_ptr<ssl_socket> open_socket(const endpoint & target)
+    {
+        std::unique_ptr<ssl_socket> s(new ssl_socket(target.host, target.port));
+        s->set_verify_peer(target.verify_peer).connect();
+        if (target.secure)
+        {
+            s->make_secure();
+        }
+        return s;
+    }
+
+    std::string make_request(const endpoint & target, const char* method, const std::string & extra_headers)
+    {
+        // Ranges count bytes of the stored resource, so ask for it unencoded
+        return std::string(method) + " " + target.path + " HTTP/1.1\r\n"
+            "Host: " + target.host + "\r\n"
+            "Accept-Encoding: identity\r\n" + extra_headers + "\r\n";
+    }
+
+    bool header_contains(const http_response_decoder & decoder, const char* name, const char* token)
+    {
+        std::string value = decoder.get_header(name);
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        return value.find(token) != std::string::npos;
+    }
+
+    void read_response(ssl_socket & s, http_response_decoder & decoder, response_end end)
+    {
+        char buffer[BUFFER_SIZE];
+        while (end == response_end::headers ? !decoder.has_headers() : !decoder.is_complete())
+        {
+            if (!s.is_connected())
+            {
+                if (end == response_end::body_or_close && decoder.has_headers())
+                {
+                    return;
+                }
+                throw ssl_socket_exception("Connection closed before the response was complete");
+            }
+
+            size_t length = s.read(buffer, BUFFER_SIZE);
+            if (length > 0)
+            {
+                decoder.feed(buffer, length);
+            } else if (s.is_connected() && !s.wait_readable(READ_TIMEOUT)) {
+                throw ssl_socket_exception("Timed out waiting for the server");
+            }
+        }
+    }
+
+    /**
+     * Fetch ranges from the queue over one keep-alive connection until
+     * none are left, requeueing whatever is left of a failed range
+     */
+    void fetch_ranges(const endpoint & target, range_queue & queue, char* output, size_t max_attempts)
+    {
+        std::unique_ptr<ssl_socket> s;
+        byte_range range;
+        while (queue.pop(range))
+        {
+            uint64_t received = 0;
+            try
+            {
+                if (!s || !s->is_connected())
+                {
+                    s = open_socket(target);
+                }
+
+                // Nothing may be written until the response is known to
+                // be the range that was asked for
+                http_response_decoder* response = nullptr;
+                http_response_decoder decoder([&](const char* data, size_t length) {
+                        if (received == 0)
+                        {
+                            std::string expected = "bytes " + std::to_string(range.start) + "-";
+                            if (response->get_status() != 206 || response->get_header("Content-Range").compare(0, expected.size(), expected) != 0)
+                            {
+                                throw ssl_socket_exception("Server did not honour the range request");
+                            }
+                        }
+                        if (length > range.end - range.start - received)
+                        {
+                            throw ssl_socket_exception("Server sent more than the requested range");
+                        }
+                        memcpy(output + range.start + received, data, length);
+                        received += length;
+                    }, false);
+                response = &decoder;
+
+                s->write(make_request(target, "GET", "Range: bytes=" + std::to_string(range.start) + "-" + std::to_string(range.end - 1) + "\r\n"));
+                read_response(*s, decoder, response_end::body);
+                if (received != range.end - range.start)
+                {
+                    throw ssl_socket_exception("Server sent less than the requested range");
+                }
+                if (header_contains(decoder, "Connection", "close"))
+                {
+                    s.reset();
+                }
+            } catch (const ssl_socket_exception & e) {
+                s.reset(); // The connection is in an unknown state
+                byte_range rest = {range.start + received, range.end, range.attempts + 1};
+                if (rest.attempts >= max_attempts)
+                {
+                    queue.fail("Range " + std::to_string(range.start) + "-" + std::to_string(range.end - 1) + " failed: " + e.to_string());
+                    return;
+                }
+                std::this_thread::sleep_for(RETRY_DELAY * rest.attempts);
+                queue.push(rest);
+            }
+        }
+    }
+
+    /**
+     * Download without ranges, streaming the body into the file. A
+     * download that fails starts over, as often as a range may fail.
+     * Nothing but a successful response is written, and the file is
+     * removed if the download is abandoned.
+     */
+    uint64_t fetch_whole(const endpoint & target, const std::string & output_path, size_t max_attempts)
+    {
+        int file = open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0)
+        {
+            throw ssl_socket_exception("Unable to open " + output_path + ": " + std::string(strerror(errno)));
+        }
+
+        uint64_t written = 0;
+        try
+        {
+            for (size_t attempts = 1; ; ++attempts)
+            {
+                try
+                {
+                    written = 0;
+                    if (ftruncate(file, 0) < 0 || lseek(file, 0, SEEK_SET) < 0)
+                    {
+                        throw ssl_socket_exception("Unable to truncate " + output_path + ": " + std::string(strerror(errno)));
+                    }
+
+                    std::unique_ptr<ssl_socket> s = open_socket(target);
+                    http_response_decoder* response = nullptr;
+                    http_response_decoder decoder([&](const char* data, size_t length) {
+                            // The headers are in before any of the body
+                            if (response->get_status() != 200)
+                            {
+                                throw ssl_socket_exception("Server responded with status " + std::to_string(response->get_status()));
+                            }
+                            for (size_t offset = 0; offset < length; )
+                            {
+                                ssize_t result = ::write(file, data + offset, length - offset);
+                                if (result < 0)
+                                {
+                                    throw ssl_socket_exception("Unable to write " + output_path + ": " + std::string(strerror(errno)));
+                                }
+                                offset += result;
+                            }
+                            written += length;
+                        }, false);
+                    response = &decoder;
+                    s->write(make_request(target, "GET", ""));
+                    read_response(*s, decoder, response_end::body_or_close);
+                    if (decoder.get_status() != 200)
+                    {
+                        throw ssl_socket_exception("Server responded with status " + std::to_string(decoder.get_status()));
+                    }
+                    break;
+                } catch (const ssl_socket_exception &) {
+                    if (attempts >= max_attempts)
+                    {
+                        throw;
+                    }
+                    std::this_thread::sleep_for(RETRY_DELAY * attempts);
+                }
+            }
+        } catch (...) {
+            // An error page or a partial body must not pass for the resource
+            close(file);
+            unlink(output_path.c_str());
+            throw;
+        }
+        close(file);
+        return written;
+    }
+}
+
+range_download::range_download(const std::string & _host, const std::string & _port, const std::string & _path):
+    host(_host),
+    port(_port),
+    path(_path),
+    connections(4),
+    range_size(8 * 1024 * 1024),
+    max_attempts(4),
+    secure(true),
+    verify_peer(true)
+{
+
+}
+
+range_download& range_download::set_connections(size_t count)
+{
+    connections = std::max<size_t>(count, 1);
+    return *this;
+}
+
+range_download& range_download::set_range_size(uint64_t size)
+{
+    range_size = std::max<uint64_t>(size, 1);
+    return *this;
+}
+
+range_download& range_download::set_max_attempts(size_t attempts)
+{
+    max_attempts = std::max<size_t>(attempts, 1);
+    return *this;
+}
+
+range_download& range_download::set_secure(bool enabled)
+{
+    secure = enabled;
+    return *this;
+}
+
+range_download& range_download::set_verify_peer(bool enabled)
+{
+    verify_peer = enabled;
+    return *this;
+}
+
+uint64_t range_download::save(const std::string & output_path)
+{
+    endpoint target = {host, port, path, secure, verify_peer};
+
+    http_response_decoder head([](const char*, size_t) {}, false);
+    {
+        std::unique_ptr<ssl_socket> s = open_socket(target);
+        s->write(make_request(target, "HEAD", ""));
+        read_response(*s, head, response_end::headers);
+    }
+    if (head.get_status() != 200)
+    {
+        throw ssl_socket_exception("Server responded to HEAD with status " + std::to_string(head.get_status()));
+    }
+    std::string content_length = head.get_header("Content-Length");
+    if (content_length.empty() || !header_contains(head, "Accept-Ranges", "bytes"))
+    {
+        return fetch_whole(target, output_path, max_attempts);
+    }
+
+    uint64_t size = strtoull(content_length.c_str(), nullptr, 10);
+    mapped_file output(output_path, size);
+    range_queue queue;
+    size_t range_count = 0;
+    for (uint64_t start = 0; start < size; start += range_size, ++range_count)
+    {
+        byte_range range = {start, std::min(start + range_size, size), 0};
+        queue.push(range);
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(connections, range_count); ++i)
+    {
+        workers.emplace_back(fetch_ranges, std::cref(target), std::ref(queue), output.get_data(), max_attempts);
+    }
+    for (std::thread & worker : workers)
+    {
+        worker.join();
+    }
+
+    std::string failure = queue.get_failure();
+    if (!failure.empty())
+    {
+        unlink(output_path.c_str());
+        throw ssl_socket_exception(failure);
+    }
+    return size;
+}
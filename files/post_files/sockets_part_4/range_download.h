@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <cinttypes>
+#include <string>
+
+/**
+ * Downloads one resource over several connections at once. A HEAD
+ * request finds the size, the resource is split into byte ranges and
+ * each connection fetches ranges with keep-alive GET requests, writing
+ * the body straight into a preallocated memory mapped output file at
+ * the range's offset. A range that fails part way is retried from the
+ * last byte received on a fresh connection. Servers that don't accept
+ * ranges or don't send a length are downloaded over one connection,
+ * starting over from the first byte if it fails.
+ */
+class range_download
+{
+  public:
+    /**
+     * @param _host The hostname or ip address to download from
+     * @param _port The port or service name to connect to (ex: "443" or "https")
+     * @param _path The path of the resource (ex: "/logs/access.log")
+     */
+    range_download(const std::string & _host, const std::string & _port, const std::string & _path);
+
+    /**
+     * Set the number of concurrent connections (4 by default)
+     *
+     * @return a reference to itself
+     */
+    range_download& set_connections(size_t count);
+
+    /**
+     * Set the size of each range (8MB by default). Smaller ranges
+     * balance better across connections and lose less on a retry,
+     * larger ranges need fewer requests.
+     *
+     * @return a reference to itself
+     */
+    range_download& set_range_size(uint64_t size);
+
+    /**
+     * Set how many times a range, or a download without ranges, may
+     * fail before the download is abandoned (4 by default)
+     *
+     * @return a reference to itself
+     */
+    range_download& set_max_attempts(size_t attempts);
+
+    /**
+     * Enable or disable TLS (on by default)
+     *
+     * @return a reference to itself
+     */
+    range_download& set_secure(bool enabled = true);
+
+    /**
+     * Enable or disable peer certificate verification (on by default)
+     *
+     * @return a reference to itself
+     */
+    range_download& set_verify_peer(bool enabled = true);
+
+    /**
+     * Download the resource to a file, replacing anything already there
+     *
+     * @param output_path where to write the resource
+     *
+     * @return the number of bytes written
+     * @throw ssl_socket_exception if the download fails, the file is
+     * then removed
+     */
+    uint64_t save(const std::string & output_path);
+
+  private:
+    std::string host;
+    std::string port;
+    std::string path;
+    size_t connections;
+    uint64_t range_size;
+    size_t max_attempts;
+    bool secure;
+    bool verify_peer;
+};
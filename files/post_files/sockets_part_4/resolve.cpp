@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "bulk_resolver.h"
+#include "output_sink.h"
+#include "ssl_socket.h"
+
+/**
+ * Resolve a list of host names and write what each resolved to. Usage:
+ *
+ *   resolve [--concurrency N] [--ipv4 | --ipv6] [--output FILE] [NAME_LIST]
+ *
+ * Names are read one per line from NAME_LIST, or stdin if it is
+ * missing or "-". Blank lines and # comments are skipped. Each distinct
+ * name gets one line of output, "name<TAB>address,address" or
+ * "name<TAB>!error". Statistics and lookup latency percentiles go to
+ * stderr. Exits with 1 if any name failed to resolve.
+ */
+namespace
+{
+    std::vector<std::string> read_name_list(const std::string & path)
+    {
+        std::ifstream file;
+        if (path != "-")
+        {
+            file.open(path);
+            if (!file)
+            {
+                throw ssl_socket_exception("Unable to open name list " + path);
+            }
+        }
+        std::istream & in = path == "-" ? std::cin : file;
+
+        std::vector<std::string> names;
+        for (std::string line; std::getline(in, line); )
+        {
+            size_t start = line.find_first_not_of(" \t\r");
+            size_t end = line.find_last_not_of(" \t\r");
+            if (start != std::string::npos && line[start] != '#')
+                names.push_back(line.substr(start, end - start + 1));
+        }
+        return names;
+    }
+
+    double percentile_ms(const std::vector<double> & sorted, double fraction)
+    {
+        if (sorted.empty())
+            return 0;
+        size_t index = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+        return sorted[index];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bulk_resolver resolver;
+    std::string list_path = "-";
+    std::string output_path;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--concurrency") == 0 && i + 1 < argc)
+            resolver.set_concurrency(std::stoul(argv[++i]));
+        else if (strcmp(argv[i], "--ipv4") == 0)
+            resolver.set_family(AF_INET);
+        else if (strcmp(argv[i], "--ipv6") == 0)
+            resolver.set_family(AF_INET6);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output_path = argv[++i];
+        else
+            list_path = argv[i];
+    }
+
+    try
+    {
+        std::vector<std::string> names = read_name_list(list_path);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<resolve_result> results = resolver.resolve(names);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::unique_ptr<output_sink> output(output_path.empty() ? new output_sink(STDOUT_FILENO) : new output_sink(output_path, false));
+        std::string line;
+        std::vector<double> latencies;
+        latencies.reserve(results.size());
+        size_t failed = 0;
+        for (const resolve_result & result : results)
+        {
+            line.clear();
+            bulk_resolver::format(result, line);
+            output->write(line.data(), line.size());
+            latencies.push_back(result.latency.count() / 1000.0);
+            failed += result.error != 0;
+        }
+        output->flush();
+
+        std::sort(latencies.begin(), latencies.end());
+        std::cerr << names.size() << " names, " << results.size() << " distinct, " << failed << " failed in "
+                  << seconds << " s (" << results.size() / seconds << " names/s)\n"
+                  << "latency ms: p50 " << percentile_ms(latencies, 0.5)
+                  << " p90 " << percentile_ms(latencies, 0.9)
+                  << " p99 " << percentile_ms(latencies, 0.99)
+                  << " max " << (latencies.empty() ? 0 : latencies.back()) << '\n';
+        return failed == 0 ? 0 : 1;
+    } catch (const ssl_socket_exception & e) {
+        std::cerr << e.to_string() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "send_queue.h"
+#include <algorithm>
+#include <cstring>
+
+send_queue::send_queue(size_t _chunk_size, size_t _spare_limit):
+    chunk_size(_chunk_size),
+    spare_limit(_spare_limit),
+    queued(0)
+{
+
+}
+
+void send_queue::append(const uint8_t* data, size_t length)
+{
+    while (length > 0)
+    {
+        if (chunks.empty() || chunks.back().end == chunk_size)
+        {
+            chunk next = {nullptr, 0, 0};
+            if (!spare.empty())
+            {
+                next.data = std::move(spare.back());
+                spare.pop_back();
+            } else {
+                next.data.reset(new uint8_t[chunk_size]);
+            }
+            chunks.push_back(std::move(next));
+        }
+        chunk & tail = chunks.back();
+        size_t copy_size = std::min(length, chunk_size - tail.end);
+        memcpy(tail.data.get() + tail.end, data, copy_size);
+        tail.end += copy_size;
+        queued += copy_size;
+        data += copy_size;
+        length -= copy_size;
+    }
+}
+
+const uint8_t* send_queue::front() const
+{
+    return chunks.empty() ? nullptr : chunks.front().data.get() + chunks.front().begin;
+}
+
+size_t send_queue::front_size() const
+{
+    return chunks.empty() ? 0 : chunks.front().end - chunks.front().begin;
+}
+
+void send_queue::consume(size_t length)
+{
+    while (length > 0 && !chunks.empty())
+    {
+        chunk & head = chunks.front();
+        size_t consumed = std::min(length, head.end - head.begin);
+        head.begin += consumed;
+        queued -= consumed;
+        length -= consumed;
+        if (head.begin == head.end)
+        {
+            release_front();
+        }
+    }
+}
+
+void send_queue::clear()
+{
+    while (!chunks.empty())
+    {
+        release_front();
+    }
+    queued = 0;
+}
+
+void send_queue::release_front()
+{
+    if (spare.size() < spare_limit)
+    {
+        spare.push_back(std::move(chunks.front().data));
+    }
+    chunks.pop_front();
+}
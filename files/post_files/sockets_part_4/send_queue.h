@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <cinttypes>
+#include <deque>
+#include <memory>
+#include <vector>
+
+/**
+ * A FIFO of bytes waiting to be written, stored in fixed size chunks.
+ * Chunks that empty out are kept for reuse up to a limit, so a queue
+ * that keeps filling and draining stops allocating. The first chunk
+ * is only ever appended to, never moved, which lets a TLS write that
+ * had to be retried see the same bytes again.
+ */
+class send_queue
+{
+  public:
+    /**
+     * @param _chunk_size the size of each chunk, the most front
+     * returns at once
+     * @param _spare_limit how many empty chunks to keep for reuse
+     */
+    explicit send_queue(size_t _chunk_size = 16 * 1024, size_t _spare_limit = 4);
+
+    /**
+     * Copy bytes onto the end of the queue
+     */
+    void append(const uint8_t* data, size_t length);
+
+    /**
+     * The oldest queued bytes, front_size of them are contiguous
+     */
+    const uint8_t* front() const;
+    size_t front_size() const;
+
+    /**
+     * Drop length bytes from the front after they were written
+     */
+    void consume(size_t length);
+
+    /**
+     * Drop everything, keeping chunks for reuse
+     */
+    void clear();
+
+    size_t size() const { return queued; }
+    bool empty() const { return queued == 0; }
+
+    /**
+     * The memory held in chunks, queued or spare
+     */
+    size_t get_capacity() const { return (chunks.size() + spare.size()) * chunk_size; }
+
+  private:
+    struct chunk
+    {
+        std::unique_ptr<uint8_t[]> data;
+        size_t begin;
+        size_t end;
+    };
+
+    void release_front();
+
+    size_t chunk_size;
+    size_t spare_limit;
+    size_t queued;
+    std::deque<chunk> chunks;
+    std::vector<std::unique_ptr<uint8_t[]>> spare;
+};
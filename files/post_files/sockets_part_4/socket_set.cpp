@@ -0,0 +1,117 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "socket_set.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+size_t socket_set::add(ssl_socket && socket, short events)
+{
+    sockets.push_back(std::move(socket));
+    descriptors.push_back(pollfd());
+    flags.push_back(0);
+    handles.push_back(nullptr);
+    pending.push_back(0);
+    requested.push_back(events);
+    refresh(sockets.size() - 1);
+    return sockets.size() - 1;
+}
+
+void socket_set::remove(size_t index)
+{
+    size_t last = sockets.size() - 1;
+    if (index != last)
+    {
+        sockets[index] = std::move(sockets[last]);
+        descriptors[index] = descriptors[last];
+        flags[index] = flags[last];
+        handles[index] = handles[last];
+        pending[index] = pending[last];
+        requested[index] = requested[last];
+    }
+    sockets.pop_back();
+    descriptors.pop_back();
+    flags.pop_back();
+    handles.pop_back();
+    pending.pop_back();
+    requested.pop_back();
+}
+
+void socket_set::set_events(size_t index, short events)
+{
+    requested[index] = events;
+    descriptors[index].events = events | (sockets[index].has_queued() ? POLLOUT : 0);
+}
+
+void socket_set::refresh(size_t index)
+{
+    ssl_socket & socket = sockets[index];
+    // poll skips negative descriptors, so closed sockets drop out
+    descriptors[index].fd = socket.is_connected() ? socket.get_descriptor() : -1;
+    descriptors[index].events = requested[index] | (socket.has_queued() ? POLLOUT : 0);
+    descriptors[index].revents = 0;
+    flags[index] = (socket.is_connected() ? flag_connected : 0) | (socket.is_secure() ? flag_secure : 0)
+        | (socket.has_queued() ? flag_queued : 0);
+    handles[index] = socket.get_handle();
+    // Undecrypted records count too, get_pending alone misses them
+    pending[index] = socket.has_pending() ? std::max<size_t>(1, socket.get_pending()) : 0;
+}
+
+size_t socket_set::poll(std::chrono::milliseconds timeout)
+{
+    size_t buffered = 0;
+    bool draining = false;
+    for (size_t i = 0; i < descriptors.size(); ++i)
+    {
+        buffered += pending[i] != 0;
+        draining = draining || (flags[i] & flag_queued);
+    }
+
+    int ready = ::poll(descriptors.data(), descriptors.size(), buffered > 0 ? 0 : timeout.count());
+    if (ready < 0)
+    {
+        if (errno == EINTR)
+            ready = 0;
+        else
+            throw ssl_socket_exception("Unable to poll: " + std::string(strerror(errno)));
+    }
+    if (buffered == 0 && !draining)
+        return ready;
+
+    ready = 0;
+    for (size_t i = 0; i < descriptors.size(); ++i)
+    {
+        struct pollfd & descriptor = descriptors[i];
+        if (pending[i] != 0)
+            descriptor.revents |= POLLIN;
+        if ((descriptor.revents & (POLLOUT | POLLERR | POLLHUP)) && (flags[i] & flag_queued))
+        {
+            short revents = descriptor.revents;
+            try
+            {
+                sockets[i].flush_queue();
+            } catch (const ssl_socket_exception &) {
+                revents |= POLLERR;
+            }
+            refresh(i);
+            descriptor.revents = revents;
+        }
+        if (!(requested[i] & POLLOUT))
+            descriptor.revents &= ~POLLOUT;
+        ready += descriptor.revents != 0;
+    }
+    return ready;
+}
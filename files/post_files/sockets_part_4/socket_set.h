@@ -0,0 +1,127 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <poll.h>
+#include "ssl_socket.h"
+
+/**
+ * A set of sockets for an event loop. The state the loop checks on
+ * every pass (descriptor, flags, SSL handle and the decrypted bytes
+ * OpenSSL holds) is kept in parallel arrays, so a sweep over every
+ * connection reads a few dense arrays instead of visiting each socket
+ * object. The sockets themselves are stored by value, which keeps
+ * them contiguous as well.
+ *
+ * Sockets with bytes in their send queue are also polled for
+ * writability and drained automatically, see ssl_socket::try_write.
+ *
+ * Indexes are stable until a socket is removed, removing moves the
+ * last socket into the freed slot.
+ */
+class socket_set
+{
+  public:
+    /**
+     * Bits of the per-socket flags
+     */
+    enum flag : uint8_t
+    {
+        flag_connected = 1,
+        flag_secure = 2,
+        flag_queued = 4 ///< Bytes are waiting in the send queue
+    };
+
+    /**
+     * Take over a socket
+     *
+     * @param events the poll events to wait for on it
+     *
+     * @return the index of the socket
+     */
+    size_t add(ssl_socket && socket, short events = POLLIN);
+
+    /**
+     * Disconnect and remove the socket at index. The last socket
+     * takes its index.
+     */
+    void remove(size_t index);
+
+    size_t size() const { return sockets.size(); }
+    bool empty() const { return sockets.empty(); }
+
+    ssl_socket& operator[](size_t index) { return sockets[index]; }
+    const ssl_socket& operator[](size_t index) const { return sockets[index]; }
+
+    /**
+     * Change the poll events to wait for on the socket at index
+     */
+    void set_events(size_t index, short events);
+
+    /**
+     * Update the hot state of the socket at index after it was used
+     * directly, it may have disconnected, left data in OpenSSL or
+     * queued bytes to send
+     */
+    void refresh(size_t index);
+
+    /**
+     * Wait for sockets to become ready. Sockets with bytes waiting in
+     * OpenSSL, decrypted or whole records read ahead, count as
+     * readable without waiting, since poll can't see those bytes.
+     * Writable sockets with a send queue are flushed, and only count
+     * as ready if they asked for POLLOUT. A flush that fails reports
+     * POLLERR.
+     *
+     * @return the number of ready sockets
+     * @throw ssl_socket_exception if poll fails
+     */
+    size_t poll(std::chrono::milliseconds timeout);
+
+    /**
+     * Call handler(index, revents) for every socket the last poll
+     * found ready, then refresh it. The handler must not add or remove
+     * sockets, collect the indexes and remove them afterwards from the
+     * highest down.
+     */
+    template <typename handler_type>
+    void for_each_ready(const handler_type & handler)
+    {
+        for (size_t i = 0; i < descriptors.size(); ++i)
+        {
+            if (descriptors[i].revents != 0)
+            {
+                handler(i, descriptors[i].revents);
+                refresh(i);
+            }
+        }
+    }
+
+    const std::vector<struct pollfd>& get_descriptors() const { return descriptors; }
+    const std::vector<uint8_t>& get_flags() const { return flags; }
+    const std::vector<SSL*>& get_handles() const { return handles; }
+    const std::vector<uint32_t>& get_pending() const { return pending; }
+
+  private:
+    std::vector<struct pollfd> descriptors;
+    std::vector<uint8_t> flags;
+    std::vector<SSL*> handles;
+    std::vector<uint32_t> pending;
+    std::vector<short> requested; // The events asked for, without the POLLOUT added for queued bytes
+    std::vector<ssl_socket> sockets;
+};
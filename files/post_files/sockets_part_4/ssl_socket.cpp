@@ -14,22 +14,190 @@ ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
 OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 #include "ssl_socket.h"
+#include "certificate_verifier.h"
+#include "cpu_features.h"
 #include <cstring>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+#include <linux/errqueue.h>
+#include <cstddef>
+#include <mutex>
 #include <thread>
+#include <algorithm>
 #include <openssl/err.h>
 
 namespace
 {
     const ssl_socket_exception NOT_CONNECTED("Socket not connected");
 
+    /**
+     * Dynamic record sizing: records start small enough that a
+     * record plus its TLS framing fits in a 1460 byte MSS, then grow
+     * to the largest record TLS allows after a megabyte has been sent
+     * and shrink again after a second without writes.
+     */
+    const size_t SMALL_RECORD_SIZE = 1400;
+    const size_t LARGE_RECORD_SIZE = 16384;
+    const size_t DEFAULT_SEND_QUEUE_LIMIT = 1024 * 1024;
+    const size_t RECORD_GROWTH_THRESHOLD = 1024 * 1024;
+    const std::chrono::seconds RECORD_SIZE_IDLE_RESET(1);
+
+    /**
+     * Adaptive receiving: reads are at least one full record and at
+     * most MAX_READ_SIZE, OpenSSL reads up to READ_AHEAD_SIZE of raw
+     * records per system call and SO_RCVBUF is reconsidered every
+     * AUTOTUNE_INTERVAL
+     */
+    const size_t MIN_READ_SIZE = LARGE_RECORD_SIZE;
+    const size_t MAX_READ_SIZE = 4 * 1024 * 1024;
+    const size_t READ_AHEAD_SIZE = 64 * 1024;
+    const size_t MAX_RECEIVE_BUFFER = 16 * 1024 * 1024;
+    const std::chrono::milliseconds AUTOTUNE_INTERVAL(200);
+
+    /**
+     * TLS 1.2 cipher lists, both restricted to AEAD suites with
+     * forward secrecy ahead of whatever else OpenSSL considers HIGH
+     */
+    const char AES_GCM_FIRST_CIPHERS[] = "ECDHE+AESGCM:ECDHE+CHACHA20:DHE+AESGCM:DHE+CHACHA20:HIGH:!aNULL:!eNULL:!MD5:!RC4:!3DES";
+    const char CHACHA20_FIRST_CIPHERS[] = "ECDHE+CHACHA20:ECDHE+AESGCM:DHE+CHACHA20:DHE+AESGCM:HIGH:!aNULL:!eNULL:!MD5:!RC4:!3DES";
+
+    /**
+     * TLS 1.3 suites are configured separately from the older ciphers
+     */
+    const char AES_GCM_FIRST_SUITES[] = "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256";
+    const char CHACHA20_FIRST_SUITES[] = "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384";
+
+    /**
+     * Hosts starting with this are Unix domain socket addresses
+     */
+    const char UNIX_PREFIX[] = "unix:";
+    const size_t UNIX_PREFIX_LENGTH = sizeof(UNIX_PREFIX) - 1;
+
+    bool is_unix_address(const std::string & host)
+    {
+        return host.compare(0, UNIX_PREFIX_LENGTH, UNIX_PREFIX) == 0;
+    }
+
+    /**
+     * Connect a non-blocking stream socket to a Unix domain socket path,
+     * or to a name in the abstract namespace if it starts with '@'
+     *
+     * @return the connected socket
+     * @throw ssl_socket_exception if the connection fails
+     */
+    int connect_unix(const std::string & path)
+    {
+        struct sockaddr_un address = {0};
+        address.sun_family = AF_UNIX;
+        // Paths need room for their NUL, abstract names fill sun_path
+        bool abstract = !path.empty() && path[0] == '@';
+        if (path.empty() || (abstract ? path.size() > sizeof(address.sun_path) : path.size() >= sizeof(address.sun_path)))
+        {
+            throw ssl_socket_exception("Invalid Unix domain socket address: " + path);
+        }
+        memcpy(address.sun_path, path.data(), path.size());
+        socklen_t address_length = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+        if (abstract)
+        {
+            // Abstract names start with a NUL and aren't terminated
+            address.sun_path[0] = '\0';
+            address_length = offsetof(struct sockaddr_un, sun_path) + path.size();
+        }
+
+        int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connection < 0)
+        {
+            throw ssl_socket_exception("Unable to open socket: " + std::string(strerror(errno)));
+        }
+        std::string error_string;
+        if (::connect(connection, (struct sockaddr*)&address, address_length) < 0)
+        {
+            error_string = "Unable to connect: " + std::string(strerror(errno));
+        } else if (fcntl(connection, F_SETFL, O_NONBLOCK) < 0) {
+            error_string = "Unable to set nonblocking: " + std::string(strerror(errno));
+        }
+        if (!error_string.empty())
+        {
+            close(connection); // Cleanup
+            throw ssl_socket_exception(error_string);
+        }
+        return connection;
+    }
+
+    /**
+     * Describe the last OpenSSL error. A reset or other system call
+     * failure leaves the error queue empty, errno says what happened.
+     */
     std::string get_ssl_error()
     {
-        return std::string(ERR_error_string(0, nullptr));
+        int saved_errno = errno;
+        unsigned long error = ERR_get_error();
+        if (error == 0 && saved_errno != 0)
+        {
+            return std::string(strerror(saved_errno));
+        }
+        return std::string(ERR_error_string(error, nullptr));
+    }
+
+    /**
+     * Order the context's ciphers according to the policy
+     *
+     * @return false if OpenSSL rejected the cipher lists
+     */
+    bool apply_cipher_policy(SSL_CTX* context, cipher_policy policy)
+    {
+        if (policy == cipher_policy::automatic)
+        {
+            // Without AES-NI and PCLMUL, AES-GCM is several times
+            // slower than ChaCha20-Poly1305
+            policy = cpu_features::get().fast_aes_gcm() ? cipher_policy::prefer_aes_gcm : cipher_policy::prefer_chacha20;
+        }
+        if (policy == cipher_policy::openssl_default)
+        {
+            return true;
+        }
+
+        bool aes_first = policy == cipher_policy::prefer_aes_gcm;
+        if (SSL_CTX_set_cipher_list(context, aes_first ? AES_GCM_FIRST_CIPHERS : CHACHA20_FIRST_CIPHERS) != 1)
+        {
+            return false;
+        }
+#ifdef TLS1_3_VERSION
+        if (SSL_CTX_set_ciphersuites(context, aes_first ? AES_GCM_FIRST_SUITES : CHACHA20_FIRST_SUITES) != 1)
+        {
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    /**
+     * Create a client context with the given cipher policy and the
+     * shared trust store
+     *
+     * @return the new context or nullptr on failure
+     */
+    SSL_CTX* create_context(cipher_policy policy)
+    {
+        SSL_CTX* context = SSL_CTX_new(SSLv23_client_method());
+        if (context != nullptr && !apply_cipher_policy(context, policy))
+        {
+            SSL_CTX_free(context);
+            return nullptr;
+        }
+        if (context != nullptr)
+        {
+            certificate_verifier::attach(context);
+        }
+        return context;
     }
 
     /**
@@ -46,13 +214,104 @@ namespace
         }
         ~openssl_init_handler()
         {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+            // OpenSSL 1.1 and newer clean up after themselves at exit,
+            // freeing these again there would be a double free
             ERR_remove_state(0);
             ERR_free_strings();
             EVP_cleanup();
             CRYPTO_cleanup_all_ex_data();
             sk_SSL_COMP_free(SSL_COMP_get_compression_methods());
+#endif
+        }
+    };
+
+    /**
+     * Owns the SSL contexts shared by the sockets with the same cipher
+     * policy, one for idle mode and one for sockets handshaking on a
+     * pool. Each socket holds its own reference so a context outlives
+     * any socket still using it.
+     */
+    class shared_context_holder
+    {
+      public:
+        explicit shared_context_holder(cipher_policy _policy):
+            policy(_policy),
+            idle_context(nullptr),
+            pooled_context(nullptr)
+        {}
+        ~shared_context_holder()
+        {
+            if (idle_context != nullptr)
+                SSL_CTX_free(idle_context);
+            if (pooled_context != nullptr)
+                SSL_CTX_free(pooled_context);
+        }
+
+        /**
+         * Get a new reference to one of the shared contexts, creating
+         * it on first use, or nullptr if it could not be created
+         */
+        SSL_CTX* acquire(bool idle)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            SSL_CTX*& context = idle ? idle_context : pooled_context;
+            if (context == nullptr)
+            {
+                context = create_context(policy);
+                if (context != nullptr && idle)
+                {
+                    // Let OpenSSL free the read/write buffers while they're empty
+                    SSL_CTX_set_mode(context, SSL_MODE_RELEASE_BUFFERS);
+                }
+            }
+            if (context != nullptr)
+                SSL_CTX_up_ref(context);
+            return context;
         }
+
+      private:
+        cipher_policy policy;
+        SSL_CTX* idle_context;
+        SSL_CTX* pooled_context;
+        std::mutex lock;
     };
+
+    /**
+     * Get a new reference to a shared context for the cipher policy
+     *
+     * @param idle whether to get the idle mode context
+     */
+    SSL_CTX* acquire_shared_context(cipher_policy policy, bool idle)
+    {
+        static shared_context_holder automatic(cipher_policy::automatic);
+        static shared_context_holder aes_gcm(cipher_policy::prefer_aes_gcm);
+        static shared_context_holder chacha20(cipher_policy::prefer_chacha20);
+        static shared_context_holder openssl_default(cipher_policy::openssl_default);
+        switch (policy)
+        {
+          case cipher_policy::prefer_aes_gcm:
+            return aes_gcm.acquire(idle);
+          case cipher_policy::prefer_chacha20:
+            return chacha20.acquire(idle);
+          case cipher_policy::openssl_default:
+            return openssl_default.acquire(idle);
+          default:
+            return automatic.acquire(idle);
+        }
+    }
+
+    /**
+     * Wait until the socket is ready for the direction OpenSSL asked
+     * for, or until the timeout passes
+     */
+    void wait_for_ssl(int connection, int ssl_error, std::chrono::milliseconds timeout)
+    {
+        struct pollfd descriptor = {0};
+        descriptor.fd = connection;
+        descriptor.events = ssl_error == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN;
+        poll(&descriptor, 1, timeout.count());
+    }
 }
 
 ssl_socket::ssl_socket(const std::string & _host, const std::string & _port):
@@ -61,7 +320,38 @@ ssl_socket::ssl_socket(const std::string & _host, const std::string & _port):
     host(_host),
     port(_port),
     ssl_handle(nullptr),
-    ssl_context(nullptr)
+    ssl_context(nullptr),
+    idle_mode(false),
+    dynamic_record_sizing(true),
+    bytes_since_idle(0),
+    ciphers(cipher_policy::automatic),
+    verify_peer(true),
+    adaptive_receive(true),
+    receive_autotune(false),
+    window_bytes(0),
+    spin_wait(0),
+    kernel_busy_poll(false),
+    zerocopy_threshold(0),
+    zerocopy_active(false),
+    zerocopy_sends(0),
+    zerocopy_completed(0),
+    zerocopy_copied(0),
+    kernel_tls(false),
+    tuning(),
+    tuning_applied(),
+    outgoing(),
+    send_queue_limit(DEFAULT_SEND_QUEUE_LIMIT),
+    high_watermark(0),
+    low_watermark(0),
+    above_high_watermark(false),
+    write_retry_size(0),
+    next_address(nullptr),
+    connect_error(),
+    connecting(false),
+    handshake_workers(nullptr),
+    handshake(),
+    handshake_events(0),
+    handshaking(false)
 {
 
 }
@@ -71,7 +361,79 @@ ssl_socket::~ssl_socket()
     disconnect();
 }
 
+ssl_socket::ssl_socket(ssl_socket && other) noexcept:
+    ssl_socket(std::string(), std::string())
+{
+    swap(other);
+}
+
+ssl_socket& ssl_socket::operator=(ssl_socket && other) noexcept
+{
+    // Our old connection leaves with the temporary
+    ssl_socket moved(std::move(other));
+    swap(moved);
+    return *this;
+}
+
+void ssl_socket::swap(ssl_socket & other) noexcept
+{
+    using std::swap;
+    swap(address_info, other.address_info);
+    swap(ssl_handle, other.ssl_handle);
+    swap(ssl_context, other.ssl_context);
+    swap(connection, other.connection);
+    swap(host, other.host);
+    swap(port, other.port);
+    swap(server_name, other.server_name);
+    swap(idle_mode, other.idle_mode);
+    swap(dynamic_record_sizing, other.dynamic_record_sizing);
+    swap(bytes_since_idle, other.bytes_since_idle);
+    swap(last_write, other.last_write);
+    swap(ciphers, other.ciphers);
+    swap(verify_peer, other.verify_peer);
+    swap(adaptive_receive, other.adaptive_receive);
+    swap(receive_autotune, other.receive_autotune);
+    swap(window_bytes, other.window_bytes);
+    swap(window_start, other.window_start);
+    swap(spin_wait, other.spin_wait);
+    swap(kernel_busy_poll, other.kernel_busy_poll);
+    swap(zerocopy_threshold, other.zerocopy_threshold);
+    swap(zerocopy_active, other.zerocopy_active);
+    swap(zerocopy_sends, other.zerocopy_sends);
+    swap(zerocopy_completed, other.zerocopy_completed);
+    swap(zerocopy_out_of_order, other.zerocopy_out_of_order);
+    swap(zerocopy_copied, other.zerocopy_copied);
+    swap(kernel_tls, other.kernel_tls);
+    swap(tuning, other.tuning);
+    swap(tuning_applied, other.tuning_applied);
+    swap(outgoing, other.outgoing);
+    swap(send_queue_limit, other.send_queue_limit);
+    swap(high_watermark, other.high_watermark);
+    swap(low_watermark, other.low_watermark);
+    swap(high_watermark_handler, other.high_watermark_handler);
+    swap(low_watermark_handler, other.low_watermark_handler);
+    swap(above_high_watermark, other.above_high_watermark);
+    swap(write_retry_size, other.write_retry_size);
+    swap(next_address, other.next_address);
+    swap(connect_error, other.connect_error);
+    swap(connecting, other.connecting);
+    swap(handshake_workers, other.handshake_workers);
+    swap(handshake, other.handshake);
+    swap(handshake_events, other.handshake_events);
+    swap(handshaking, other.handshaking);
+}
+
 ssl_socket& ssl_socket::connect()
+{
+    start_connect();
+    while (!continue_connect())
+    {
+        wait_for_ssl(connection, SSL_ERROR_WANT_WRITE, std::chrono::milliseconds(200));
+    }
+    return *this;
+}
+
+ssl_socket& ssl_socket::start_connect()
 {
     static openssl_init_handler _ssl_init_life;
 
@@ -80,6 +442,13 @@ ssl_socket& ssl_socket::connect()
         throw ssl_socket_exception("Attempting to connect after socket already connected");
     }
 
+    if (is_unix_address(host))
+    {
+        connection = connect_unix(host.substr(UNIX_PREFIX_LENGTH));
+        tuning_applied = tuning.apply(connection, false);
+        return *this;
+    }
+
     if (address_info == nullptr)
     {
         struct addrinfo hints = {0};
@@ -92,54 +461,140 @@ ssl_socket& ssl_socket::connect()
         }
     }
 
-    std::string error_string = "";
-    for (struct addrinfo* current_address_info = address_info; current_address_info != nullptr; current_address_info = current_address_info->ai_next)
+    next_address = address_info;
+    connect_error = "";
+    connecting = true;
+    if (!connect_next_address())
+    {
+        connecting = false;
+        throw ssl_socket_exception(connect_error);
+    }
+    return *this;
+}
+
+bool ssl_socket::continue_connect()
+{
+    if (!connecting)
     {
-        connection = socket(current_address_info->ai_family, current_address_info->ai_socktype, current_address_info->ai_protocol);
         if (connection < 0)
         {
-            error_string = "Unable to open socket: " + std::string(strerror(errno));
-            continue;
+            throw ssl_socket_exception("No connection has been started");
+        }
+        return true;
+    }
+
+    struct pollfd descriptor = {0};
+    descriptor.fd = connection;
+    descriptor.events = POLLOUT;
+    if (poll(&descriptor, 1, 0) <= 0)
+    {
+        return false;
+    }
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(connection, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+    {
+        error = errno;
+    }
+    if (error != 0)
+    {
+        connect_error = "Unable to connect: " + std::string(strerror(error));
+        close(connection); // Cleanup
+        connection = -1;
+        if (!connect_next_address())
+        {
+            connecting = false;
+            throw ssl_socket_exception(connect_error);
         }
-        
-        if (::connect(connection, current_address_info->ai_addr, current_address_info->ai_addrlen) < 0)
+        return false;
+    }
+    connecting = false;
+
+    if (kernel_busy_poll)
+    {
+        apply_busy_poll();
+    }
+
+    if (zerocopy_threshold > 0)
+    {
+        apply_zerocopy();
+    }
+
+    if (idle_mode)
+    {
+        // A reconnect will resolve the host again
+        freeaddrinfo(address_info);
+        address_info = nullptr;
+        next_address = nullptr;
+    }
+    return true;
+}
+
+bool ssl_socket::connect_next_address()
+{
+    for (; next_address != nullptr; next_address = next_address->ai_next)
+    {
+        connection = socket(next_address->ai_family, next_address->ai_socktype | SOCK_NONBLOCK, next_address->ai_protocol);
+        if (connection < 0)
         {
-            error_string = "Unable to connect: " + std::string(strerror(errno));
-            close(connection); // Cleanup
-            connection = -1;
+            connect_error = "Unable to open socket: " + std::string(strerror(errno));
             continue;
         }
-        
-        if (fcntl(connection, F_SETFL, O_NONBLOCK) < 0)
+
+        // Buffer sizes have to be in place before the SYN goes out
+        tuning_applied = tuning.apply(connection, true);
+        if (::connect(connection, next_address->ai_addr, next_address->ai_addrlen) < 0 && errno != EINPROGRESS)
         {
-            error_string = "Unable to set nonblocking: " + std::string(strerror(errno));
+            connect_error = "Unable to connect: " + std::string(strerror(errno));
             close(connection); // Cleanup
             connection = -1;
             continue;
         }
 
-        break; // Success
+        next_address = next_address->ai_next; // Where to go if this one fails
+        return true;
     }
-    if (connection < 0) // If we failed to connect
-    {
-        throw ssl_socket_exception(error_string);
-    }
-    return *this;
+    return false;
 }
 
 ssl_socket& ssl_socket::write(const uint8_t* data, size_t length)
 {
+    // Queued bytes were written first as far as the caller knows
+    while (!flush_queue())
+    {
+        wait_for_ssl(connection, SSL_ERROR_WANT_WRITE, std::chrono::milliseconds(200));
+    }
+
+    if (is_secure() && write_retry_size == 0 && std::chrono::steady_clock::now() - last_write > RECORD_SIZE_IDLE_RESET)
+    {
+        bytes_since_idle = 0; // Start over with small records
+    }
+
+    bool zerocopy = zerocopy_active && !is_secure() && length >= zerocopy_threshold;
     for (const uint8_t* current_position = data, * end = data + length; current_position < end; )
     {
         if (!is_secure())
         {
+#ifdef MSG_ZEROCOPY
+            ssize_t sent = send(connection, current_position, end - current_position, zerocopy ? MSG_ZEROCOPY : 0);
+#else
             ssize_t sent = send(connection, current_position, end - current_position, 0);
+#endif
             switch (sent)
             {
               case -1: // We got an error, check errno
                 if (errno == EAGAIN || errno == EWOULDBLOCK)
                 {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                    if (zerocopy_sends != zerocopy_completed)
+                    {
+                        // Completions waiting in the error queue would
+                        // wake poll straight away
+                        reap_zerocopy();
+                    }
+                    wait_for_ssl(connection, SSL_ERROR_WANT_WRITE, std::chrono::milliseconds(200));
+                } else if (errno == ENOBUFS && zerocopy) {
+                    // Out of optmem for pinning pages, copy the rest
+                    zerocopy = false;
                 } else {
                     throw ssl_socket_exception("Error sending socket: " + std::string(strerror(errno)));
                 }
@@ -150,15 +605,32 @@ ssl_socket& ssl_socket::write(const uint8_t* data, size_t length)
                 break;
               default:
                 current_position += sent;
+                zerocopy_sends += zerocopy ? 1 : 0;
                 break;
             }
         } else {
-            ssize_t sent = SSL_write(ssl_handle, current_position, end - current_position);
+            // A retry after WANT_READ/WANT_WRITE must repeat the same
+            // length, which holds because the record size only changes
+            // after a successful write. A record write_some left behind
+            // goes first, at the length OpenSSL kept.
+            size_t record_size = std::min(static_cast<size_t>(end - current_position), next_record_size());
+            if (write_retry_size > 0)
+            {
+                if (write_retry_size > static_cast<size_t>(end - current_position))
+                {
+                    throw ssl_socket_exception("A retried write must pass at least the record OpenSSL kept");
+                }
+                record_size = write_retry_size;
+            }
+            ssize_t sent = SSL_write(ssl_handle, current_position, record_size);
             if (sent > 0)
             {
                 current_position += sent;
+                bytes_since_idle += sent;
+                write_retry_size = 0;
             } else {
-                switch(SSL_get_error(ssl_handle, sent))
+                int ssl_error = SSL_get_error(ssl_handle, sent);
+                switch(ssl_error)
                 {
                   case SSL_ERROR_ZERO_RETURN: // The socket has been closed on the other end
                     disconnect();
@@ -166,7 +638,7 @@ ssl_socket& ssl_socket::write(const uint8_t* data, size_t length)
                     break;
                   case SSL_ERROR_WANT_READ:
                   case SSL_ERROR_WANT_WRITE:
-                    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                    wait_for_ssl(connection, ssl_error, std::chrono::milliseconds(200));
                     break;
                   default:
                     throw ssl_socket_exception("Error sending socket: " + get_ssl_error());
@@ -175,6 +647,7 @@ ssl_socket& ssl_socket::write(const uint8_t* data, size_t length)
             }
         }
     }
+    last_write = std::chrono::steady_clock::now();
     return *this;
 }
 
@@ -183,8 +656,166 @@ ssl_socket& ssl_socket::write(const std::string & data)
     return write((uint8_t*)data.c_str(), data.size());
 }
 
+size_t ssl_socket::write_some(const uint8_t* data, size_t length)
+{
+    if (!is_secure())
+    {
+        ssize_t sent = send(connection, data, length, 0);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return 0;
+            }
+            throw ssl_socket_exception("Error sending socket: " + std::string(strerror(errno)));
+        }
+        return sent;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    size_t record_size = write_retry_size;
+    if (record_size == 0)
+    {
+        if (now - last_write > RECORD_SIZE_IDLE_RESET)
+        {
+            bytes_since_idle = 0;
+        }
+        record_size = std::min(length, std::min(next_record_size(), LARGE_RECORD_SIZE));
+    } else if (length < record_size) {
+        throw ssl_socket_exception("A retried write must pass at least the record OpenSSL kept");
+    }
+    // A stall longer than the idle reset must not shrink the record
+    // OpenSSL is still holding, a shorter retry fails with bad length
+    ssize_t sent = SSL_write(ssl_handle, data, record_size);
+    if (sent > 0)
+    {
+        bytes_since_idle += sent;
+        last_write = now;
+        write_retry_size = 0;
+        return sent;
+    }
+    switch(SSL_get_error(ssl_handle, sent))
+    {
+      case SSL_ERROR_ZERO_RETURN: // The socket has been closed on the other end
+        disconnect();
+        throw ssl_socket_exception("The socket disconnected");
+        break;
+      case SSL_ERROR_WANT_READ:
+      case SSL_ERROR_WANT_WRITE:
+        write_retry_size = record_size;
+        return 0;
+        break;
+      default:
+        throw ssl_socket_exception("Error sending socket: " + get_ssl_error());
+        break;
+    }
+}
+
+size_t ssl_socket::try_write(const uint8_t* data, size_t length)
+{
+    size_t written = 0;
+    bool stalled = false;
+    if (flush_queue())
+    {
+        while (written < length && is_connected())
+        {
+            size_t sent = write_some(data + written, length - written);
+            if (sent == 0)
+            {
+                stalled = true;
+                break;
+            }
+            written += sent;
+        }
+    }
+
+    size_t room = send_queue_limit - std::min(send_queue_limit, outgoing.size());
+    size_t queued_length = std::min(length - written, room);
+    if (stalled && write_retry_size > 0)
+    {
+        // OpenSSL has started on a record of our data and needs it
+        // back whole. A record kept from the queue is already queued.
+        queued_length = std::max(queued_length, std::min(length - written, write_retry_size));
+    }
+    outgoing.append(data + written, queued_length);
+    check_watermarks();
+    return written + queued_length;
+}
+
+bool ssl_socket::enqueue(const uint8_t* data, size_t length)
+{
+    if (outgoing.size() + length > send_queue_limit)
+    {
+        return false;
+    }
+    try_write(data, length);
+    return true;
+}
+
+bool ssl_socket::enqueue(const std::string & data)
+{
+    return enqueue(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+bool ssl_socket::flush_queue()
+{
+    while (!outgoing.empty() && is_connected())
+    {
+        size_t sent = write_some(outgoing.front(), outgoing.front_size());
+        if (sent == 0)
+        {
+            break;
+        }
+        outgoing.consume(sent);
+    }
+    check_watermarks();
+    return outgoing.empty();
+}
+
+void ssl_socket::check_watermarks()
+{
+    if (!above_high_watermark && high_watermark > 0 && outgoing.size() >= high_watermark)
+    {
+        above_high_watermark = true;
+        if (high_watermark_handler)
+            high_watermark_handler();
+    } else if (above_high_watermark && outgoing.size() <= low_watermark) {
+        above_high_watermark = false;
+        if (low_watermark_handler)
+            low_watermark_handler();
+    }
+}
+
+ssl_socket& ssl_socket::set_send_queue_limit(size_t bytes)
+{
+    send_queue_limit = bytes;
+    return *this;
+}
+
+ssl_socket& ssl_socket::set_high_watermark(size_t bytes, const std::function<void()> & handler)
+{
+    high_watermark = bytes;
+    high_watermark_handler = handler;
+    return *this;
+}
+
+ssl_socket& ssl_socket::set_low_watermark(size_t bytes, const std::function<void()> & handler)
+{
+    low_watermark = bytes;
+    low_watermark_handler = handler;
+    return *this;
+}
+
 void ssl_socket::disconnect()
 {
+    if (handshake && handshake->is_running())
+    {
+        // The worker still has the handle
+        handshake_workers->wait(*handshake);
+    }
+    handshaking = false;
+    handshake_events = 0;
+
     if (ssl_handle != nullptr)
     {
         SSL_shutdown(ssl_handle);
@@ -209,6 +840,33 @@ void ssl_socket::disconnect()
         freeaddrinfo(address_info);
         address_info = nullptr;
     }
+    next_address = nullptr;
+    connecting = false;
+
+    bytes_since_idle = 0;
+    window_bytes = 0;
+    window_start = std::chrono::steady_clock::time_point();
+    // A new socket numbers its zero copy sends from 0 again
+    zerocopy_active = false;
+    zerocopy_sends = 0;
+    zerocopy_completed = 0;
+    zerocopy_out_of_order.clear();
+    outgoing.clear();
+    above_high_watermark = false;
+    write_retry_size = 0;
+}
+
+void ssl_socket::shutdown_write()
+{
+    if (!is_connected())
+    {
+        throw NOT_CONNECTED;
+    }
+    if (is_secure())
+    {
+        SSL_shutdown(ssl_handle); // Only sends our close_notify
+    }
+    ::shutdown(connection, SHUT_WR);
 }
 
 size_t ssl_socket::read(void* buffer, size_t length)
@@ -231,6 +889,7 @@ size_t ssl_socket::read(void* buffer, size_t length)
             return 0;
             break;
           default:
+            rearm_quick_ack();
             return read_size;
             break;
         }
@@ -238,6 +897,7 @@ size_t ssl_socket::read(void* buffer, size_t length)
         ssize_t read_size = SSL_read(ssl_handle, buffer, length);
         if (read_size > 0)
         {
+            rearm_quick_ack();
             return read_size;
         } else {
             switch(SSL_get_error(ssl_handle, read_size))
@@ -258,51 +918,654 @@ size_t ssl_socket::read(void* buffer, size_t length)
     }
 }
 
-ssl_socket& ssl_socket::make_secure()
+bool ssl_socket::wait_readable(std::chrono::milliseconds timeout)
 {
-    ssl_context = SSL_CTX_new(TLSv1_client_method());
-    if (ssl_context == nullptr)
+    if (!is_connected())
     {
-        throw ssl_socket_exception("Unable to create SSL context " + get_ssl_error());
+        throw NOT_CONNECTED;
+    }
+    if (has_pending())
+    {
+        return true;
     }
 
-    // Create an SSL handle that we will use for reading and writing
-    ssl_handle = SSL_new(ssl_context);
-    if (ssl_handle == nullptr)
+    if (zerocopy_sends != zerocopy_completed)
     {
-        SSL_CTX_free(ssl_context);
-        ssl_context = nullptr;
-        throw ssl_socket_exception("Unable to create SSL handle " + get_ssl_error());
+        reap_zerocopy(); // Otherwise poll would report the error queue
     }
 
-    // Pair the SSL handle with the plain socket
-    if (!SSL_set_fd(ssl_handle, connection))
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (spin_wait.count() > 0)
     {
-        SSL_free(ssl_handle);
-        SSL_CTX_free(ssl_context);
+        // A non-blocking peek is also what triggers a kernel busy poll
+        // of the device queue, where poll with no timeout would not
+        std::chrono::steady_clock::time_point spin_end = start + std::min<std::chrono::microseconds>(spin_wait, timeout);
+        do
+        {
+            char next;
+            if (recv(connection, &next, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                return true; // Data, the peer closing or an error, read will tell which
+            }
+        } while (std::chrono::steady_clock::now() < spin_end);
+    }
+
+    std::chrono::milliseconds remaining = timeout - std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    struct pollfd descriptor = {0};
+    descriptor.fd = connection;
+    descriptor.events = POLLIN;
+    return poll(&descriptor, 1, std::max<int64_t>(remaining.count(), 0)) > 0;
+}
+
+size_t ssl_socket::read(std::vector<char> & buffer)
+{
+    size_t queued = available();
+    size_t wanted = std::max(queued, MIN_READ_SIZE);
+    wanted = std::min((wanted + LARGE_RECORD_SIZE - 1) / LARGE_RECORD_SIZE * LARGE_RECORD_SIZE, MAX_READ_SIZE);
+    if (buffer.size() < wanted)
+    {
+        buffer.resize(wanted);
+    }
+
+    size_t total = 0;
+    while (total < buffer.size() && is_connected())
+    {
+        size_t length = read(buffer.data() + total, buffer.size() - total);
+        total += length;
+        // A plain recv already took everything, SSL_read returns one
+        // record at a time so keep going until what was queued has
+        // been read and OpenSSL has nothing buffered
+        if (length == 0 || !is_secure() || (total >= queued && !SSL_has_pending(ssl_handle)))
+        {
+            break;
+        }
+    }
+
+    if (receive_autotune && is_connected())
+    {
+        autotune_receive_buffer(total);
+    }
+    return total;
+}
+
+size_t ssl_socket::read(buffer_pool::buffer & buffer)
+{
+    size_t queued = available();
+    if (buffer.empty())
+    {
+        buffer = buffer_pool::acquire(queued);
+    }
+
+    size_t total = 0;
+    while (total < buffer.size() && is_connected())
+    {
+        size_t length = read(buffer.data() + total, buffer.size() - total);
+        total += length;
+        // As in read(std::vector<char>&), TLS needs a read per record
+        if (length == 0 || !is_secure() || (total >= queued && !SSL_has_pending(ssl_handle)))
+        {
+            break;
+        }
+    }
+
+    if (total == 0)
+    {
+        buffer.release();
+    } else if (receive_autotune && is_connected()) {
+        autotune_receive_buffer(total);
+    }
+    return total;
+}
+
+size_t ssl_socket::get_pending() const
+{
+    return is_secure() ? SSL_pending(ssl_handle) : 0;
+}
+
+bool ssl_socket::has_pending()
+{
+    if (!is_secure())
+    {
+        return false;
+    }
+    if (SSL_pending(ssl_handle) > 0)
+    {
+        return true;
+    }
+    if (SSL_has_pending(ssl_handle))
+    {
+        // With read ahead a whole record may already be buffered
+        // where poll can't see it, peeking decrypts it if it is
+        char next;
+        int result = SSL_peek(ssl_handle, &next, 1);
+        if (result > 0)
+        {
+            return true;
+        }
+        int ssl_error = SSL_get_error(ssl_handle, result);
+        return ssl_error != SSL_ERROR_WANT_READ && ssl_error != SSL_ERROR_WANT_WRITE;
+    }
+    return false;
+}
+
+size_t ssl_socket::available() const
+{
+    if (!is_connected())
+    {
+        return 0;
+    }
+    int queued = 0;
+    if (ioctl(connection, FIONREAD, &queued) < 0)
+    {
+        queued = 0;
+    }
+    return queued + (is_secure() ? SSL_pending(ssl_handle) : 0);
+}
+
+void ssl_socket::autotune_receive_buffer(size_t received)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    window_bytes += received;
+    if (now - window_start < AUTOTUNE_INTERVAL)
+    {
+        return;
+    }
+
+    struct tcp_info info;
+    socklen_t info_length = sizeof(info);
+    if (getsockopt(connection, IPPROTO_TCP, TCP_INFO, &info, &info_length) == 0 && info.tcpi_rtt > 0
+        && window_start != std::chrono::steady_clock::time_point())
+    {
+        // Twice the bandwidth delay product: throughput that is only
+        // limited by the window doubles the buffer every interval
+        double seconds = std::chrono::duration<double>(now - window_start).count();
+        double rtt_seconds = info.tcpi_rtt / 1e6;
+        size_t target = std::min(static_cast<size_t>(2 * window_bytes / seconds * rtt_seconds), MAX_RECEIVE_BUFFER);
+
+        int current = 0;
+        socklen_t current_length = sizeof(current);
+        getsockopt(connection, SOL_SOCKET, SO_RCVBUF, &current, &current_length);
+        // The kernel reports double what was asked for to cover its bookkeeping
+        if (target > static_cast<size_t>(current) / 2)
+        {
+            int requested = target;
+            setsockopt(connection, SOL_SOCKET, SO_RCVBUF, &requested, sizeof(requested));
+        }
+    }
+    window_bytes = 0;
+    window_start = now;
+}
+
+ssl_socket& ssl_socket::set_idle_mode(bool enabled)
+{
+    if (connection >= 0)
+    {
+        throw ssl_socket_exception("Attempting to change idle mode after socket already connected");
+    }
+    idle_mode = enabled;
+    return *this;
+}
+
+ssl_socket& ssl_socket::set_cipher_policy(cipher_policy policy)
+{
+    if (is_secure())
+    {
+        throw ssl_socket_exception("Attempting to change cipher policy after socket already secure");
+    }
+    ciphers = policy;
+    return *this;
+}
+
+ssl_socket& ssl_socket::set_adaptive_receive(bool enabled)
+{
+    if (is_secure())
+    {
+        throw ssl_socket_exception("Attempting to change adaptive receive after socket already secure");
+    }
+    adaptive_receive = enabled;
+    return *this;
+}
+
+ssl_socket& ssl_socket::set_receive_buffer_autotune(bool enabled)
+{
+    receive_autotune = enabled;
+    return *this;
+}
+
+ssl_socket& ssl_socket::set_spin_wait(std::chrono::microseconds duration)
+{
+    spin_wait = duration;
+    if (is_connected() && kernel_busy_poll)
+    {
+        apply_busy_poll();
+    }
+    return *this;
+}
+
+ssl_socket& ssl_socket::set_kernel_busy_poll(bool enabled)
+{
+    kernel_busy_poll = enabled;
+    if (is_connected())
+    {
+        apply_busy_poll();
+    }
+    return *this;
+}
+
+void ssl_socket::apply_busy_poll()
+{
+#ifdef SO_BUSY_POLL
+    int busy_poll = kernel_busy_poll ? spin_wait.count() : 0;
+    setsockopt(connection, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll));
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+    int prefer_busy_poll = kernel_busy_poll ? 1 : 0;
+    setsockopt(connection, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer_busy_poll, sizeof(prefer_busy_poll));
+#endif
+}
+
+ssl_socket& ssl_socket::set_zerocopy_threshold(size_t threshold)
+{
+    zerocopy_threshold = threshold;
+    if (is_connected() && !zerocopy_active && threshold > 0)
+    {
+        apply_zerocopy();
+    }
+    zerocopy_active = zerocopy_active && threshold > 0;
+    return *this;
+}
+
+void ssl_socket::apply_zerocopy()
+{
+#ifdef SO_ZEROCOPY
+    int zerocopy = 1;
+    zerocopy_active = setsockopt(connection, SOL_SOCKET, SO_ZEROCOPY, &zerocopy, sizeof(zerocopy)) == 0;
+    if (zerocopy_active)
+    {
+        // Pages are only released once acknowledged, so Nagle holding
+        // back the end of a write for a delayed ACK stalls the caller
+        int no_delay = 1;
+        setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        read_no_delay();
+    }
+#endif
+}
+
+bool ssl_socket::wait_zerocopy(uint32_t mark, std::chrono::milliseconds timeout)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        // Sends are numbered from 0 and the count wraps
+        if (static_cast<int32_t>(zerocopy_completed - mark) >= 0 || !is_connected())
+        {
+            return true;
+        }
+        reap_zerocopy();
+        if (static_cast<int32_t>(zerocopy_completed - mark) >= 0)
+        {
+            return true;
+        }
+
+        std::chrono::milliseconds remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        struct pollfd descriptor = {0};
+        descriptor.fd = connection;
+        descriptor.events = 0; // POLLERR is always reported
+        if (remaining.count() <= 0 || poll(&descriptor, 1, remaining.count()) <= 0 || !(descriptor.revents & POLLERR))
+        {
+            return false;
+        }
+    }
+}
+
+void ssl_socket::reap_zerocopy()
+{
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+    while (true)
+    {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) * 4];
+        struct msghdr message = {0};
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(connection, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            return; // Drained
+        }
+
+        for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+        {
+            if (!((header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR)
+                  || (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            struct sock_extended_err error;
+            memcpy(&error, CMSG_DATA(header), sizeof(error));
+            if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+
+            // Each notification covers the sends numbered ee_info to
+            // ee_data. TCP completes them in order, keep any that
+            // arrive early until the gap before them closes.
+            uint32_t count = error.ee_data - error.ee_info + 1;
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                zerocopy_copied += count;
+            }
+            zerocopy_out_of_order.emplace_back(error.ee_info, error.ee_data + 1);
+            for (bool merged = true; merged; )
+            {
+                merged = false;
+                for (size_t i = 0; i < zerocopy_out_of_order.size(); ++i)
+                {
+                    if (zerocopy_out_of_order[i].first == zerocopy_completed)
+                    {
+                        zerocopy_completed = zerocopy_out_of_order[i].second;
+                        zerocopy_out_of_order.erase(zerocopy_out_of_order.begin() + i);
+                        merged = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+#endif
+}
+
+ssl_socket& ssl_socket::set_kernel_tls(bool enabled)
+{
+    if (is_secure())
+    {
+        throw ssl_socket_exception("Attempting to change kernel TLS after socket already secure");
+    }
+    kernel_tls = enabled;
+    return *this;
+}
+
+bool ssl_socket::has_kernel_tls_send() const
+{
+#ifdef BIO_get_ktls_send
+    return is_secure() && BIO_get_ktls_send(SSL_get_wbio(ssl_handle));
+#else
+    return false;
+#endif
+}
+
+bool ssl_socket::has_kernel_tls_receive() const
+{
+#ifdef BIO_get_ktls_recv
+    return is_secure() && BIO_get_ktls_recv(SSL_get_rbio(ssl_handle));
+#else
+    return false;
+#endif
+}
+
+ssl_socket& ssl_socket::set_tuning_profile(const tuning_profile & profile)
+{
+    if (is_connected())
+    {
+        throw ssl_socket_exception("Attempting to change the tuning profile after socket already connected");
+    }
+    tuning = profile;
+    return *this;
+}
+
+void ssl_socket::rearm_quick_ack()
+{
+    if (tuning.get_quick_ack() && tuning_applied.quick_ack)
+    {
+        int quick_ack = 1;
+        setsockopt(connection, IPPROTO_TCP, TCP_QUICKACK, &quick_ack, sizeof(quick_ack));
+    }
+}
+
+ssl_socket& ssl_socket::set_server_name(const std::string & name)
+{
+    if (is_secure())
+    {
+        throw ssl_socket_exception("Attempting to change server name after socket already secure");
+    }
+    server_name = name;
+    return *this;
+}
+
+ssl_socket& ssl_socket::set_verify_peer(bool enabled)
+{
+    if (is_secure())
+    {
+        throw ssl_socket_exception("Attempting to change peer verification after socket already secure");
+    }
+    verify_peer = enabled;
+    return *this;
+}
+
+std::string ssl_socket::get_cipher() const
+{
+    if (!is_secure())
+    {
+        return "";
+    }
+    return SSL_get_cipher_name(ssl_handle);
+}
+
+ssl_socket& ssl_socket::set_dynamic_record_sizing(bool enabled)
+{
+    dynamic_record_sizing = enabled;
+    if (is_secure())
+    {
+        apply_record_sizing();
+    }
+    return *this;
+}
+
+void ssl_socket::apply_record_sizing()
+{
+    // Small records only reach the peer quickly if Nagle doesn't hold
+    // them back waiting for a delayed ACK of the previous one. Without
+    // them the tuning profile decides.
+    int no_delay = dynamic_record_sizing || tuning.get_no_delay() ? 1 : 0;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    read_no_delay();
+}
+
+void ssl_socket::read_no_delay()
+{
+    int applied = 0;
+    socklen_t length = sizeof(applied);
+    if (getsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &applied, &length) == 0)
+    {
+        tuning_applied.no_delay = applied != 0;
+    }
+}
+
+size_t ssl_socket::next_record_size() const
+{
+    if (!dynamic_record_sizing)
+    {
+        return SIZE_MAX; // Hand everything to OpenSSL and let it split the records
+    }
+    return bytes_since_idle < RECORD_GROWTH_THRESHOLD ? SMALL_RECORD_SIZE : LARGE_RECORD_SIZE;
+}
+
+ssl_socket& ssl_socket::make_secure()
+{
+    start_secure();
+    while (!continue_secure())
+    {
+        if (handshake_events != 0)
+        {
+            wait_for_ssl(connection, handshake_events == POLLOUT ? SSL_ERROR_WANT_WRITE : SSL_ERROR_WANT_READ, std::chrono::milliseconds(200));
+        } else {
+            handshake_workers->wait(*handshake);
+        }
+    }
+    return *this;
+}
+
+ssl_socket& ssl_socket::start_secure()
+{
+    if (handshaking || is_secure())
+    {
+        throw ssl_socket_exception("Attempting to start a handshake on a secure socket");
+    }
+
+    if (idle_mode || handshake_workers != nullptr)
+    {
+        // Creating a context per socket would leave much of a pooled
+        // handshake's cost on the calling thread
+        ssl_context = acquire_shared_context(ciphers, idle_mode);
+    } else {
+        ssl_context = create_context(ciphers);
+    }
+    if (ssl_context == nullptr)
+    {
+        throw ssl_socket_exception("Unable to create SSL context " + get_ssl_error());
+    }
+
+    // Create an SSL handle that we will use for reading and writing
+    ssl_handle = SSL_new(ssl_context);
+    if (ssl_handle == nullptr)
+    {
+        SSL_CTX_free(ssl_context);
+        ssl_context = nullptr;
+        throw ssl_socket_exception("Unable to create SSL handle " + get_ssl_error());
+    }
+    // A write retried from the send queue passes a copy of the same bytes
+    SSL_set_mode(ssl_handle, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    // Pair the SSL handle with the plain socket and tell it who we expect to be talking to
+    std::string peer_name = !server_name.empty() ? server_name : is_unix_address(host) ? "localhost" : host;
+    if (!SSL_set_fd(ssl_handle, connection) || !certificate_verifier::prepare(ssl_handle, peer_name, verify_peer))
+    {
+        SSL_free(ssl_handle);
+        SSL_CTX_free(ssl_context);
         ssl_handle = nullptr;
         ssl_context = nullptr;
         throw ssl_socket_exception("Unable to associate SSL and plain socket " + get_ssl_error());
     }
 
-    // Finally do the SSL handshake
-    for (int error = SSL_connect(ssl_handle); error != 1; error = SSL_connect(ssl_handle))
+#ifdef SSL_OP_ENABLE_KTLS
+    if (kernel_tls)
     {
-        switch(SSL_get_error(ssl_handle, error))
+        SSL_set_options(ssl_handle, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+
+    if (adaptive_receive && !kernel_tls)
+    {
+        // Read several records per system call, idle sockets keep
+        // the smallest buffer that still holds a whole record
+        SSL_set_read_ahead(ssl_handle, 1);
+        if (!idle_mode)
         {
-          case SSL_ERROR_WANT_READ:
-          case SSL_ERROR_WANT_WRITE:
-            std::this_thread::sleep_for(std::chrono::milliseconds(200));
-            break;
-          default:
-            SSL_free(ssl_handle);
-            SSL_CTX_free(ssl_context);
-            ssl_handle = nullptr;
-            ssl_context = nullptr;
-            throw ssl_socket_exception("Error in SSL handshake: " + get_ssl_error());
-            break;
+            SSL_set_default_read_buffer_len(ssl_handle, READ_AHEAD_SIZE);
         }
     }
- 
+
+    // The handshake itself runs in continue_secure
+    SSL_set_connect_state(ssl_handle);
+    handshaking = true;
+    if (handshake_workers != nullptr)
+    {
+        if (!handshake)
+        {
+            handshake.reset(new handshake_pool::job());
+        }
+        handshake->ssl = ssl_handle;
+        handshake_events = 0;
+        handshake_workers->submit(*handshake);
+    } else {
+        handshake_events = POLLOUT; // The client speaks first
+    }
+    return *this;
+}
+
+bool ssl_socket::continue_secure()
+{
+    if (!handshaking)
+    {
+        if (!is_secure())
+        {
+            throw ssl_socket_exception("No handshake has been started");
+        }
+        return true;
+    }
+
+    if (handshake_workers == nullptr)
+    {
+        int result = SSL_connect(ssl_handle);
+        int ssl_error = result == 1 ? SSL_ERROR_NONE : SSL_get_error(ssl_handle, result);
+        bool failed = ssl_error != SSL_ERROR_NONE && ssl_error != SSL_ERROR_WANT_READ && ssl_error != SSL_ERROR_WANT_WRITE;
+        return finish_handshake_step(result, ssl_error, failed ? get_ssl_error() : std::string());
+    }
+
+    if (handshake->is_running())
+    {
+        return false;
+    }
+    if (handshake_events == 0 && finish_handshake_step(handshake->result, handshake->ssl_error, handshake->error))
+    {
+        return true;
+    }
+
+    // Only hand the next step over once the socket is ready, a worker
+    // would otherwise just run into the same WANT_READ
+    struct pollfd descriptor = {0};
+    descriptor.fd = connection;
+    descriptor.events = handshake_events;
+    if (poll(&descriptor, 1, 0) <= 0)
+    {
+        return false;
+    }
+    handshake_events = 0;
+    handshake_workers->submit(*handshake);
+    return false;
+}
+
+bool ssl_socket::finish_handshake_step(int result, int ssl_error, const std::string & error)
+{
+    if (result == 1)
+    {
+        handshaking = false;
+        handshake_events = 0;
+        apply_record_sizing();
+        return true;
+    }
+
+    switch(ssl_error)
+    {
+      case SSL_ERROR_WANT_READ:
+        handshake_events = POLLIN;
+        return false;
+      case SSL_ERROR_WANT_WRITE:
+        handshake_events = POLLOUT;
+        return false;
+      default:
+      {
+        long verify_result = SSL_get_verify_result(ssl_handle);
+        SSL_free(ssl_handle);
+        SSL_CTX_free(ssl_context);
+        ssl_handle = nullptr;
+        ssl_context = nullptr;
+        handshaking = false;
+        handshake_events = 0;
+        if (verify_result != X509_V_OK)
+        {
+            throw ssl_socket_exception("Error verifying peer certificate: " + std::string(X509_verify_cert_error_string(verify_result)));
+        }
+        throw ssl_socket_exception("Error in SSL handshake: " + error);
+      }
+    }
+}
+
+ssl_socket& ssl_socket::set_handshake_pool(handshake_pool* pool)
+{
+    if (handshaking || is_secure())
+    {
+        throw ssl_socket_exception("The handshake pool must be set before make_secure");
+    }
+    handshake_workers = pool;
     return *this;
 }
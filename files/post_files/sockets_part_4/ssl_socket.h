@@ -15,9 +15,18 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 #pragma once
 #include <string>
+#include <chrono>
 #include <cinttypes>
+#include <functional>
+#include <memory>
 #include <tuple>
+#include <utility>
+#include <vector>
 #include <openssl/ssl.h>
+#include "buffer_pool.h"
+#include "handshake_pool.h"
+#include "send_queue.h"
+#include "tuning_profile.h"
 
 class ssl_socket_exception
 {
@@ -32,6 +41,19 @@ class ssl_socket_exception
     std::string msg;
 };
 
+/**
+ * How make_secure orders the ciphers it offers. Only AEAD suites with
+ * forward secrecy are preferred, the policy decides which of AES-GCM
+ * and ChaCha20-Poly1305 goes first.
+ */
+enum class cipher_policy
+{
+    automatic, ///< AES-GCM first if the CPU has AES-NI and PCLMUL, ChaCha20-Poly1305 first otherwise
+    prefer_aes_gcm,
+    prefer_chacha20,
+    openssl_default ///< Leave OpenSSL's default cipher list alone
+};
+
 /**
  * Unified interface for non-blocking read and blocking write, plain
  * and SSL sockets
@@ -41,7 +63,9 @@ class ssl_socket
   public:
     /**
      * Construct a socket that will eventually connect to the given
-     * host and port.
+     * host and port. The host may also be a Unix domain socket, either
+     * a path ("unix:/run/sidecar.sock") or a name in the abstract
+     * namespace ("unix:@sidecar"), in which case the port is ignored.
      * 
      * @param _host The hostname or ip address to connect to (ex: "fizz.buzz" or "208.113.196.82")
      * @param  _port The port or service name to connect to (ex: "80" or "http")
@@ -51,20 +75,68 @@ class ssl_socket
     ssl_socket(ssl_socket const&) = delete;
     ssl_socket& operator=(ssl_socket const&) = delete;
 
+    /**
+     * Take over another socket's connection and settings, leaving it
+     * disconnected. OpenSSL only knows the descriptor, so a secure
+     * connection survives the move.
+     */
+    ssl_socket(ssl_socket && other) noexcept;
+
+    /**
+     * Disconnect this socket and take over other's connection and
+     * settings, leaving other disconnected
+     */
+    ssl_socket& operator=(ssl_socket && other) noexcept;
+
     /**
      * Perform a DNS request and establish an unencrypted TCP socket
-     * to the host.
+     * to the host. "unix:" addresses skip DNS and open an AF_UNIX
+     * stream socket to the path or abstract name instead.
      * 
      * @return A reference to itself
      * @throw ssl_socket_exception if any part of the connection fails
      */
     ssl_socket& connect();
 
+    /**
+     * Start connecting without waiting on it, for event loops. DNS
+     * still blocks unless the host is an address. Call
+     * continue_connect whenever the descriptor is writable until it
+     * returns true. The descriptor changes if an address fails and
+     * the next one is tried. Don't read or write in the meantime.
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if resolving fails or no address
+     * could be tried
+     */
+    ssl_socket& start_connect();
+
+    /**
+     * Take the connection started by start_connect as far as it goes
+     * without blocking
+     *
+     * @return true once the socket is connected
+     * @throw ssl_socket_exception if every address failed
+     */
+    bool continue_connect();
+
+    /**
+     * Check to see if a connection has been started and not finished
+     */
+    bool is_connecting() const { return connecting; }
+
     /**
      * Disconnect from the host and destroy the socket
      */
     void disconnect();
 
+    /**
+     * Tell the peer nothing more will be written, with a TLS
+     * close_notify on secure sockets and then a TCP half close, while
+     * still reading whatever it sends back
+     */
+    void shutdown_write();
+
     /**
      * Blocking write of data to the socket
      * 
@@ -87,6 +159,95 @@ class ssl_socket
      */
     ssl_socket& write(const std::string & data);
 
+    /**
+     * Non-blocking write of as much as the socket will take right now,
+     * over TLS at most one record. If this returns 0 on a secure
+     * socket, OpenSSL may have kept part of a record, so the next call
+     * must pass the same data pointer with at least the same length.
+     * That call writes exactly the kept record, however long the
+     * socket stalled, since OpenSSL rejects a shorter retry.
+     *
+     * @param data pointer to raw bytes to write to socket
+     * @param length number of bytes we wish to write to the socket
+     *
+     * @return the number of bytes written, 0 if the socket is full
+     * @throw ssl_socket_exception if an error occurs other than
+     * EAGAIN/EWOULDBLOCK, or a retry passes less than the kept record
+     */
+    size_t write_some(const uint8_t* data, size_t length);
+
+    /**
+     * Non-blocking write that queues whatever the socket won't take
+     * right now, up to the send queue limit. Bytes already queued go
+     * out first. The queue drains in flush_queue, which socket_set
+     * calls whenever the socket becomes writable. Over TLS a record
+     * OpenSSL has started on is always queued whole, which can take
+     * the queue past its limit by up to one record.
+     *
+     * @param data pointer to raw bytes to write to socket
+     * @param length number of bytes we wish to write to the socket
+     *
+     * @return the number of bytes written or queued, less than length
+     * if the queue filled up
+     * @throw ssl_socket_exception if an error occurs other than EAGAIN/EWOULDBLOCK
+     */
+    size_t try_write(const uint8_t* data, size_t length);
+
+    /**
+     * Like try_write, but takes all of data or none of it
+     *
+     * @return true if data was written or queued, false if it would
+     * not fit in the send queue
+     * @throw ssl_socket_exception if an error occurs other than EAGAIN/EWOULDBLOCK
+     */
+    bool enqueue(const uint8_t* data, size_t length);
+    bool enqueue(const std::string & data);
+
+    /**
+     * Write as much of the send queue as the socket will take without
+     * blocking, calling the low watermark handler if it drains enough
+     *
+     * @return true if the queue is empty
+     * @throw ssl_socket_exception if an error occurs other than EAGAIN/EWOULDBLOCK
+     */
+    bool flush_queue();
+
+    /**
+     * The number of bytes waiting in the send queue
+     */
+    size_t get_queued() const { return outgoing.size(); }
+    bool has_queued() const { return !outgoing.empty(); }
+
+    /**
+     * The memory the send queue holds, including spare chunks
+     */
+    size_t get_send_queue_capacity() const { return outgoing.get_capacity(); }
+
+    /**
+     * Limit how many bytes try_write and enqueue may queue, 1MB by
+     * default
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_send_queue_limit(size_t bytes);
+
+    /**
+     * Call handler when the send queue grows to bytes, so producers
+     * can stop. It is called again only after the queue drained to the
+     * low watermark. 0 turns the watermarks off, the default.
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_high_watermark(size_t bytes, const std::function<void()> & handler);
+
+    /**
+     * Call handler when a send queue that reached the high watermark
+     * drains to bytes, so producers can start again
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_low_watermark(size_t bytes, const std::function<void()> & handler);
+
     /**
      * Non-blocking attempt to read from the socket
      * 
@@ -98,11 +259,58 @@ class ssl_socket
      */
     size_t read(void* buffer, size_t length);
 
+    /**
+     * Wait until a read is likely to return data (or notice that the
+     * peer closed the connection). Data OpenSSL has already decrypted
+     * counts as readable. The socket is spun on first if set_spin_wait
+     * was used, then waited on with poll.
+     *
+     * @param timeout the longest time to wait
+     *
+     * @return true if the socket became readable before the timeout
+     * @throw ssl_socket_exception if the socket isn't connected
+     */
+    bool wait_readable(std::chrono::milliseconds timeout);
+
+    /**
+     * Non-blocking read of everything that is available, sized to fit.
+     * The buffer grows to hold whatever the kernel and OpenSSL have
+     * queued (rounded up to whole TLS records, at most 4MB) and is
+     * filled with as few system calls as possible.
+     *
+     * @param buffer reused between calls, only its first bytes (the
+     * return value) hold data after the read
+     *
+     * @return The number of bytes read, 0 as for read(void*, size_t)
+     * @throw ssl_socket_exception if an error occurs other than EAGAIN/EWOULDBLOCK
+     */
+    size_t read(std::vector<char> & buffer);
+
+    /**
+     * Non-blocking read into a buffer from the shared buffer_pool. An
+     * empty buffer is filled from the pool sized for what is queued (up
+     * to 64KB), one that is already held is reused. When nothing was
+     * read the buffer goes back to the pool, so connections waiting
+     * for data hold no memory. Release it once the data is handled.
+     *
+     * @return The number of bytes read, 0 as for read(void*, size_t)
+     * @throw ssl_socket_exception if an error occurs other than EAGAIN/EWOULDBLOCK
+     */
+    size_t read(buffer_pool::buffer & buffer);
+
+    /**
+     * The number of bytes that can be read without waiting. For
+     * secure sockets this counts decrypted bytes plus the raw bytes
+     * still in the kernel, so it slightly overestimates.
+     */
+    size_t available() const;
+
     /**
      * Check to see if the socket is still connected. If the socket
      * has been disconnected on the server side and no read or write
      * has occurred then it is possible for this to return true
-     * because the disconnect has not yet been detected
+     * because the disconnect has not yet been detected. It is also
+     * true while start_connect's connection is still being set up.
      */
     bool is_connected() const { return connection >= 0; }
 
@@ -111,17 +319,419 @@ class ssl_socket
      */
     bool is_secure() const { return ssl_handle != nullptr; }
 
+    /**
+     * The underlying file descriptor, for registering with an event
+     * loop, or -1 if not connected. Readiness only covers bytes still
+     * in the kernel, so keep reading until read returns 0 before
+     * waiting on it again.
+     */
+    int get_descriptor() const { return connection; }
+
+    /**
+     * The OpenSSL handle of a secure socket, or nullptr, for code that
+     * tracks many sockets and wants their state without going through
+     * this object
+     */
+    SSL* get_handle() const { return ssl_handle; }
+
+    /**
+     * The number of decrypted bytes OpenSSL holds, which poll can't
+     * see. Unlike available this makes no system call.
+     */
+    size_t get_pending() const;
+
+    /**
+     * Check to see if a read could return data without waiting on the
+     * descriptor. With read ahead whole records can sit undecrypted in
+     * OpenSSL while get_pending is 0, those are decrypted with a peek
+     * to tell them from a partial record. That is not a plain query:
+     * the peek may read more of the record from the descriptor and
+     * decrypts it, so only call this where a read would be fine too.
+     * A peek that hits a closed or broken connection also counts, so
+     * the next read reports it.
+     */
+    bool has_pending();
+
     /**
      * Perform the SSL handshake to switch all communications over
-     * this socket from unencrypted to encrypted
+     * this socket from unencrypted to encrypted. Unless disabled with
+     * set_verify_peer the peer's certificate must chain to the trust
+     * store and match the host.
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the handshake or verification fails
      */
     ssl_socket& make_secure();
 
+    /**
+     * Start the handshake without waiting on it, for event loops. Call
+     * continue_secure until it returns true, whenever the descriptor
+     * is ready for get_handshake_events or, while that is 0, the
+     * handshake pool's descriptor is readable. Don't read or write in
+     * the meantime.
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if OpenSSL can't be set up for the socket
+     */
+    ssl_socket& start_secure();
+
+    /**
+     * Take the handshake started by start_secure as far as it goes
+     * without blocking
+     *
+     * @return true once the handshake is complete
+     * @throw ssl_socket_exception if the handshake or verification fails
+     */
+    bool continue_secure();
+
+    /**
+     * The poll events the handshake is waiting for, or 0 while one of
+     * its steps runs on the handshake pool
+     */
+    short get_handshake_events() const { return handshake_events; }
+
+    /**
+     * Check to see if a handshake has been started and not finished
+     */
+    bool is_handshaking() const { return handshaking; }
+
+    /**
+     * Run the handshake's CPU heavy steps on pool rather than on the
+     * thread calling make_secure or continue_secure, nullptr (the
+     * default) runs them inline. Sockets using a pool share one SSL
+     * context per cipher policy, so setting up the handshake stays
+     * cheap too. The pool must outlive the handshake.
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the socket is already secure
+     */
+    ssl_socket& set_handshake_pool(handshake_pool* pool);
+
+    /**
+     * Trim the memory held by this socket for connections that spend
+     * most of their life idle. The resolved addresses are released
+     * once connected, make_secure uses a context shared by every idle
+     * socket and OpenSSL is allowed to release its read and write
+     * buffers whenever they are empty. Must be set before connect.
+     *
+     * @param enabled whether idle mode should be used
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_idle_mode(bool enabled = true);
+
+    /**
+     * Check to see if this socket is in idle mode
+     */
+    bool is_idle_mode() const { return idle_mode; }
+
+    /**
+     * Enable or disable dynamic TLS record sizing (on by default). A
+     * new or recently idle connection writes records that fit in a
+     * single TCP segment so the peer can decrypt the first bytes
+     * without waiting on more packets. Once enough data has been sent
+     * the records grow to the 16KB maximum to cut per record overhead
+     * for bulk transfers. Secure sockets with dynamic records also set
+     * TCP_NODELAY so small records aren't held back by Nagle, without
+     * them TCP_NODELAY is whatever the tuning profile asked for.
+     *
+     * @param enabled whether records should be sized dynamically
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_dynamic_record_sizing(bool enabled = true);
+
+    /**
+     * Choose how ciphers are ordered in the handshake. Sockets in idle
+     * mode share one context per policy. Must be set before
+     * make_secure.
+     *
+     * @param policy the cipher policy to use
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the socket is already secure
+     */
+    ssl_socket& set_cipher_policy(cipher_policy policy);
+
+    /**
+     * Enable or disable peer certificate verification (on by
+     * default). Verified chains are cached per host, see
+     * certificate_verifier. Must be set before make_secure.
+     *
+     * @param enabled whether the peer's certificate should be verified
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the socket is already secure
+     */
+    ssl_socket& set_verify_peer(bool enabled = true);
+
+    /**
+     * Set the name sent as SNI and checked against the peer's
+     * certificate in place of the host. Unix domain sockets have no
+     * host name and use "localhost" unless this is set. Must be set
+     * before make_secure.
+     *
+     * @param name the server's name (ex: "sidecar.internal")
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the socket is already secure
+     */
+    ssl_socket& set_server_name(const std::string & name);
+
+    /**
+     * Enable or disable adaptive receiving (on by default). Secure
+     * sockets then let OpenSSL read ahead several records per system
+     * call instead of a header and a body per record. Must be set
+     * before make_secure.
+     *
+     * @param enabled whether reads should adapt to the data available
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the socket is already secure
+     */
+    ssl_socket& set_adaptive_receive(bool enabled = true);
+
+    /**
+     * Enable or disable receive buffer tuning (off by default). While
+     * reading with read(std::vector<char>&), SO_RCVBUF is raised to
+     * twice the bandwidth delay product observed from throughput and
+     * the kernel's RTT estimate. Linux already autotunes receive
+     * buffers and setting SO_RCVBUF turns that off for the socket, so
+     * this is for systems where autotuning is disabled or capped too
+     * low. The buffer is never shrunk.
+     *
+     * @param enabled whether SO_RCVBUF should follow throughput
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_receive_buffer_autotune(bool enabled = true);
+
+    /**
+     * Spin on the socket for up to the given time in wait_readable
+     * before blocking (0, the default, blocks straight away). Spinning
+     * burns a core but avoids the scheduler wakeup after a blocking
+     * wait, which dominates round trips on fast links.
+     *
+     * @param duration how long to spin before blocking
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_spin_wait(std::chrono::microseconds duration);
+
+    /**
+     * Ask the kernel to busy poll the network device queue while this
+     * socket waits (SO_BUSY_POLL for the spin wait duration and
+     * SO_PREFER_BUSY_POLL), off by default. This only helps on NICs
+     * with NAPI busy polling, not on loopback. Best effort, raising
+     * SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN.
+     *
+     * @param enabled whether the kernel should busy poll
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_kernel_busy_poll(bool enabled = true);
+
+    /**
+     * Send plain text writes of at least threshold bytes with
+     * MSG_ZEROCOPY, so the kernel transmits straight from the caller's
+     * pages instead of copying them (0, the default, always copies).
+     * The data passed to write must then stay untouched until
+     * wait_zerocopy reports its sends complete. Only TCP supports this,
+     * other sockets and TLS writes copy as usual. Pinning pages costs
+     * more than copying small writes, see bench_zerocopy for where
+     * it pays off.
+     *
+     * @param threshold the smallest write to send without copying
+     *
+     * @return a reference to itself
+     */
+    ssl_socket& set_zerocopy_threshold(size_t threshold);
+
+    /**
+     * Mark the zero copy sends made so far. Once wait_zerocopy returns
+     * true for the mark, the buffers of every write before it can be
+     * reused.
+     */
+    uint32_t get_zerocopy_mark() const { return zerocopy_sends; }
+
+    /**
+     * Wait for the kernel to release the buffers of the zero copy
+     * sends before mark, collecting completions from the socket's
+     * error queue
+     *
+     * @param mark a value from get_zerocopy_mark
+     * @param timeout the longest time to wait, 0 only checks
+     *
+     * @return true if those buffers can be reused
+     */
+    bool wait_zerocopy(uint32_t mark, std::chrono::milliseconds timeout);
+
+    /**
+     * Number of zero copy sends the kernel completed by copying after
+     * all (ex: over loopback, or on devices without scatter-gather)
+     */
+    size_t get_zerocopy_copied() const { return zerocopy_copied; }
+
+    /**
+     * Ask OpenSSL to hand the record encryption to the kernel (kTLS)
+     * after the handshake, off by default. The descriptor can then be
+     * used with sendfile and splice while the kernel encrypts and
+     * decrypts. Needs an OpenSSL built with kTLS, the kernel tls
+     * module and a cipher the kernel supports; without them the
+     * socket silently stays in user space. Turns off read ahead, which
+     * would keep records from the kernel. Must be set before
+     * make_secure.
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the socket is already secure
+     */
+    ssl_socket& set_kernel_tls(bool enabled = true);
+
+    /**
+     * Check to see if the kernel encrypts what is written to the
+     * descriptor
+     */
+    bool has_kernel_tls_send() const;
+
+    /**
+     * Check to see if the kernel decrypts what is read from the
+     * descriptor
+     */
+    bool has_kernel_tls_receive() const;
+
+    /**
+     * Transport options to apply while connecting, see tuning_profile.
+     * The default profile leaves every kernel default alone.
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the socket is already connected
+     */
+    ssl_socket& set_tuning_profile(const tuning_profile & profile);
+
+    /**
+     * The options the tuning profile actually left on the socket, as
+     * read back from the kernel during the last connect. TCP_NODELAY
+     * is read again whenever record sizing or zero copy changes it.
+     */
+    const tuning_report& get_tuning_report() const { return tuning_applied; }
+
+    /**
+     * Get the name of the cipher negotiated in the handshake, or an
+     * empty string if the socket isn't secure
+     */
+    std::string get_cipher() const;
+
   private:
+    /**
+     * Exchange everything, connection and settings, with other
+     */
+    void swap(ssl_socket & other) noexcept;
+
+    /**
+     * The number of bytes to hand to the next SSL_write call
+     */
+    size_t next_record_size() const;
+
+    /**
+     * Apply the socket options dynamic record sizing depends on,
+     * keeping the tuning report in step
+     */
+    void apply_record_sizing();
+
+    /**
+     * Read TCP_NODELAY back into the tuning report after changing it
+     */
+    void read_no_delay();
+
+    /**
+     * Account for bytes read and grow SO_RCVBUF if throughput calls for it
+     */
+    void autotune_receive_buffer(size_t received);
+
+    /**
+     * Apply the kernel busy poll options to the connected socket
+     */
+    void apply_busy_poll();
+
+    /**
+     * Set TCP_QUICKACK again after a read if the tuning profile asks
+     * for it, the kernel clears it whenever it goes back to delayed ACKs
+     */
+    void rearm_quick_ack();
+
+    /**
+     * Call a watermark handler if the send queue just crossed one
+     */
+    void check_watermarks();
+
+    /**
+     * Turn on SO_ZEROCOPY, zero copy stays off if the socket refuses it
+     */
+    void apply_zerocopy();
+
+    /**
+     * Collect zero copy completions from the error queue without blocking
+     */
+    void reap_zerocopy();
+
+    /**
+     * Act on what a handshake step returned
+     *
+     * @return true if the handshake is complete
+     * @throw ssl_socket_exception if it failed, after freeing the handle
+     */
+    bool finish_handshake_step(int result, int ssl_error, const std::string & error);
+
+    /**
+     * Start a non-blocking connect to next_address or, if that fails
+     * straight away, to the addresses after it
+     *
+     * @return false if no address was left to try
+     */
+    bool connect_next_address();
+
+
     struct addrinfo* address_info;
     SSL* ssl_handle;
     SSL_CTX* ssl_context;
     int connection;
     std::string host;
     std::string port;
+    std::string server_name;
+    bool idle_mode;
+    bool dynamic_record_sizing;
+    size_t bytes_since_idle;
+    std::chrono::steady_clock::time_point last_write;
+    cipher_policy ciphers;
+    bool verify_peer;
+    bool adaptive_receive;
+    bool receive_autotune;
+    uint64_t window_bytes;
+    std::chrono::steady_clock::time_point window_start;
+    std::chrono::microseconds spin_wait;
+    bool kernel_busy_poll;
+    size_t zerocopy_threshold;
+    bool zerocopy_active;
+    uint32_t zerocopy_sends;
+    uint32_t zerocopy_completed;
+    std::vector<std::pair<uint32_t, uint32_t>> zerocopy_out_of_order;
+    size_t zerocopy_copied;
+    bool kernel_tls;
+    tuning_profile tuning;
+    tuning_report tuning_applied;
+    send_queue outgoing;
+    size_t send_queue_limit;
+    size_t high_watermark;
+    size_t low_watermark;
+    std::function<void()> high_watermark_handler;
+    std::function<void()> low_watermark_handler;
+    bool above_high_watermark;
+    size_t write_retry_size; // The record OpenSSL expects to see again
+    struct addrinfo* next_address;
+    std::string connect_error;
+    bool connecting;
+    handshake_pool* handshake_workers;
+    std::unique_ptr<handshake_pool::job> handshake;
+    short handshake_events;
+    bool handshaking;
 };
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "threaded_sink.h"
+
+threaded_sink::threaded_sink(const sink_type & _consumer, size_t _max_queued):
+    consumer(_consumer),
+    max_queued(_max_queued),
+    finishing(false),
+    worker(&threaded_sink::run, this)
+{
+
+}
+
+threaded_sink::~threaded_sink()
+{
+    try
+    {
+        finish();
+    } catch (...) {
+        // Destructors can't report the consumer's failure, call finish to see it
+    }
+}
+
+void threaded_sink::write(const char* data, size_t length)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [this]() { return queued.size() < max_queued || failure; });
+    if (failure)
+    {
+        std::rethrow_exception(failure);
+    }
+
+    std::vector<char> block;
+    if (!free_blocks.empty())
+    {
+        block.swap(free_blocks.back());
+        free_blocks.pop_back();
+    }
+    block.assign(data, data + length);
+    queued.push_back(std::move(block));
+    changed.notify_all();
+}
+
+void threaded_sink::finish()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finishing = true;
+        changed.notify_all();
+    }
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+    if (failure)
+    {
+        std::exception_ptr error = failure;
+        failure = nullptr; // Only report it once
+        std::rethrow_exception(error);
+    }
+}
+
+void threaded_sink::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        changed.wait(guard, [this]() { return !queued.empty() || finishing; });
+        if (queued.empty())
+        {
+            return; // Finishing and everything has been consumed
+        }
+
+        std::vector<char> block = std::move(queued.front());
+        queued.pop_front();
+        changed.notify_all();
+
+        guard.unlock();
+        try
+        {
+            consumer(block.data(), block.size());
+        } catch (...) {
+            guard.lock();
+            failure = std::current_exception();
+            queued.clear();
+            changed.notify_all();
+            return;
+        }
+        guard.lock();
+        free_blocks.push_back(std::move(block));
+    }
+}
@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs a consumer on its own thread so that, for example,
+ * decompression overlaps with the socket reads feeding it. Data is
+ * copied into a small ring of reusable blocks. When the consumer falls
+ * behind and every block is queued, write blocks until one frees up,
+ * so memory stays bounded.
+ */
+class threaded_sink
+{
+  public:
+    typedef std::function<void(const char* data, size_t length)> sink_type;
+
+    /**
+     * @param _consumer called on the worker thread with each block in order
+     * @param _max_queued the number of blocks that may be waiting at once
+     */
+    explicit threaded_sink(const sink_type & _consumer, size_t _max_queued = 8);
+
+    /**
+     * Waits for the consumer to finish any queued blocks
+     */
+    ~threaded_sink();
+    threaded_sink(threaded_sink const&) = delete;
+    threaded_sink& operator=(threaded_sink const&) = delete;
+
+    /**
+     * Queue a copy of data for the consumer
+     *
+     * @throw whatever the consumer threw, if it has failed
+     */
+    void write(const char* data, size_t length);
+
+    /**
+     * Wait for the consumer to process everything queued so far and
+     * stop the worker thread
+     *
+     * @throw whatever the consumer threw, if it failed
+     */
+    void finish();
+
+  private:
+    void run();
+
+    sink_type consumer;
+    size_t max_queued;
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::vector<char>> queued;
+    std::vector<std::vector<char>> free_blocks;
+    std::exception_ptr failure;
+    bool finishing;
+    std::thread worker;
+};
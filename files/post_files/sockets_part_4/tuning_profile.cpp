@@ -0,0 +1,189 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "tuning_profile.h"
+#include "ssl_socket.h"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace
+{
+    const int BULK_BUFFER_SIZE = 4 * 1024 * 1024;
+    const int INTERACTIVE_NOTSENT_LOWAT = 16 * 1024;
+
+    /**
+     * TCP_CA_NAME_MAX, which only the kernel headers define
+     */
+    const size_t CONGESTION_NAME_SIZE = 16;
+
+    /**
+     * Set an integer option, noting a refusal in failures
+     */
+    void set_option(int descriptor, int level, int option, const char* option_name, int value, std::vector<std::string> & failures)
+    {
+        if (setsockopt(descriptor, level, option, &value, sizeof(value)) < 0)
+        {
+            failures.push_back(std::string(option_name) + ": " + strerror(errno));
+        }
+    }
+
+    int get_option(int descriptor, int level, int option)
+    {
+        int value = 0;
+        socklen_t length = sizeof(value);
+        if (getsockopt(descriptor, level, option, &value, &length) < 0)
+        {
+            return 0;
+        }
+        return value;
+    }
+}
+
+tuning_report::tuning_report():
+    send_buffer(0),
+    receive_buffer(0),
+    no_delay(false),
+    quick_ack(false),
+    notsent_lowat(0)
+{}
+
+std::string tuning_report::to_string() const
+{
+    std::ostringstream out;
+    out << profile << ':';
+    if (!congestion_control.empty())
+        out << " cc=" << congestion_control;
+    out << " sndbuf=" << send_buffer
+        << " rcvbuf=" << receive_buffer
+        << " nodelay=" << no_delay
+        << " quickack=" << quick_ack
+        << " notsent_lowat=" << notsent_lowat;
+    for (const std::string & failure : failures)
+        out << " [" << failure << ']';
+    return out.str();
+}
+
+tuning_profile::tuning_profile(const std::string & _name):
+    name(_name),
+    send_buffer(0),
+    receive_buffer(0),
+    no_delay(false),
+    quick_ack(false),
+    notsent_lowat(0)
+{}
+
+tuning_profile tuning_profile::bulk()
+{
+    tuning_profile profile("bulk");
+    profile.set_congestion_control("bbr").set_send_buffer(BULK_BUFFER_SIZE).set_receive_buffer(BULK_BUFFER_SIZE);
+    return profile;
+}
+
+tuning_profile tuning_profile::interactive()
+{
+    tuning_profile profile("interactive");
+    profile.set_no_delay().set_quick_ack().set_notsent_lowat(INTERACTIVE_NOTSENT_LOWAT);
+    return profile;
+}
+
+tuning_profile tuning_profile::named(const std::string & name)
+{
+    if (name == "default")
+        return tuning_profile();
+    if (name == "bulk")
+        return bulk();
+    if (name == "interactive")
+        return interactive();
+    throw ssl_socket_exception("Unknown tuning profile: " + name);
+}
+
+tuning_profile& tuning_profile::set_congestion_control(const std::string & algorithm)
+{
+    congestion_control = algorithm;
+    return *this;
+}
+
+tuning_profile& tuning_profile::set_send_buffer(int bytes)
+{
+    send_buffer = bytes;
+    return *this;
+}
+
+tuning_profile& tuning_profile::set_receive_buffer(int bytes)
+{
+    receive_buffer = bytes;
+    return *this;
+}
+
+tuning_profile& tuning_profile::set_no_delay(bool enabled)
+{
+    no_delay = enabled;
+    return *this;
+}
+
+tuning_profile& tuning_profile::set_quick_ack(bool enabled)
+{
+    quick_ack = enabled;
+    return *this;
+}
+
+tuning_profile& tuning_profile::set_notsent_lowat(int bytes)
+{
+    notsent_lowat = bytes;
+    return *this;
+}
+
+tuning_report tuning_profile::apply(int descriptor, bool tcp) const
+{
+    tuning_report report;
+    report.profile = name;
+    if (send_buffer > 0)
+        set_option(descriptor, SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF", send_buffer, report.failures);
+    if (receive_buffer > 0)
+        set_option(descriptor, SOL_SOCKET, SO_RCVBUF, "SO_RCVBUF", receive_buffer, report.failures);
+    report.send_buffer = get_option(descriptor, SOL_SOCKET, SO_SNDBUF);
+    report.receive_buffer = get_option(descriptor, SOL_SOCKET, SO_RCVBUF);
+    if (!tcp)
+    {
+        return report;
+    }
+
+    if (!congestion_control.empty()
+        && setsockopt(descriptor, IPPROTO_TCP, TCP_CONGESTION, congestion_control.data(), congestion_control.size()) < 0)
+    {
+        report.failures.push_back("TCP_CONGESTION " + congestion_control + ": " + strerror(errno));
+    }
+    if (no_delay)
+        set_option(descriptor, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY", 1, report.failures);
+    if (quick_ack)
+        set_option(descriptor, IPPROTO_TCP, TCP_QUICKACK, "TCP_QUICKACK", 1, report.failures);
+    if (notsent_lowat > 0)
+        set_option(descriptor, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT", notsent_lowat, report.failures);
+
+    char algorithm[CONGESTION_NAME_SIZE] = {0};
+    socklen_t length = sizeof(algorithm);
+    if (getsockopt(descriptor, IPPROTO_TCP, TCP_CONGESTION, algorithm, &length) == 0)
+    {
+        report.congestion_control.assign(algorithm, strnlen(algorithm, length));
+    }
+    report.no_delay = get_option(descriptor, IPPROTO_TCP, TCP_NODELAY) != 0;
+    report.quick_ack = get_option(descriptor, IPPROTO_TCP, TCP_QUICKACK) != 0;
+    report.notsent_lowat = get_option(descriptor, IPPROTO_TCP, TCP_NOTSENT_LOWAT);
+    return report;
+}
@@ -0,0 +1,121 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * What a tuning profile actually left on a socket, read back from the
+ * kernel after the profile was applied. The kernel clamps buffer
+ * sizes to net.core.[rw]mem_max and reports twice what it kept to
+ * cover its own bookkeeping.
+ */
+struct tuning_report
+{
+    std::string profile;
+    std::string congestion_control; ///< Empty for Unix domain sockets
+    int send_buffer;
+    int receive_buffer;
+    bool no_delay;
+    bool quick_ack;
+    int notsent_lowat; ///< 0 means no limit
+    std::vector<std::string> failures; ///< Options the kernel refused, with the reason
+
+    tuning_report();
+
+    /**
+     * A one line summary, ex: "bulk: cc=bbr sndbuf=8388608 ..."
+     */
+    std::string to_string() const;
+};
+
+/**
+ * A named set of transport options applied to a socket while it
+ * connects. Options that are never set keep the kernel default, so the
+ * default profile changes nothing. Options the kernel refuses don't
+ * fail the connection, they are listed in the report instead.
+ */
+class tuning_profile
+{
+  public:
+    explicit tuning_profile(const std::string & _name = "default");
+
+    /**
+     * Large transfers: BBR congestion control and 4MB buffers. Fixing
+     * the buffer sizes turns off the kernel's own buffer autotuning,
+     * so this suits long fat paths more than short transfers.
+     */
+    static tuning_profile bulk();
+
+    /**
+     * Small requests and responses: Nagle off, immediate ACKs and a
+     * 16KB limit on unsent data so the send buffer doesn't queue up
+     * stale writes ahead of new ones.
+     */
+    static tuning_profile interactive();
+
+    /**
+     * Look up a built in profile by name
+     *
+     * @throw ssl_socket_exception if there is no profile by that name
+     */
+    static tuning_profile named(const std::string & name);
+
+    /**
+     * @param algorithm a name from net.ipv4.tcp_available_congestion_control
+     */
+    tuning_profile& set_congestion_control(const std::string & algorithm);
+    tuning_profile& set_send_buffer(int bytes);
+    tuning_profile& set_receive_buffer(int bytes);
+    tuning_profile& set_no_delay(bool enabled = true);
+
+    /**
+     * The kernel drops back to delayed ACKs on its own, so sockets
+     * using this profile set it again after every read
+     */
+    tuning_profile& set_quick_ack(bool enabled = true);
+
+    /**
+     * Limit how many unsent bytes may sit in the send buffer before
+     * the socket stops being writable
+     */
+    tuning_profile& set_notsent_lowat(int bytes);
+
+    const std::string& get_name() const { return name; }
+    bool get_no_delay() const { return no_delay; }
+    bool get_quick_ack() const { return quick_ack; }
+
+    /**
+     * Apply the profile to a socket. TCP sockets should get it before
+     * they connect, the receive buffer size decides the window scale
+     * sent with the SYN.
+     *
+     * @param tcp false for Unix domain sockets, which only take the
+     * buffer sizes
+     *
+     * @return the options in effect afterwards
+     */
+    tuning_report apply(int descriptor, bool tcp) const;
+
+  private:
+    std::string name;
+    std::string congestion_control;
+    int send_buffer;
+    int receive_buffer;
+    bool no_delay;
+    bool quick_ack;
+    int notsent_lowat;
+};
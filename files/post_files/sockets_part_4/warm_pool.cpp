@@ -0,0 +1,306 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "warm_pool.h"
+#include <algorithm>
+
+namespace
+{
+    /**
+     * The window counted as one burst until a setup has been timed
+     */
+    const std::chrono::microseconds DEFAULT_SETUP_TIME(100000);
+
+    /**
+     * How long demand has to stay below its peak before the target halves
+     */
+    const std::chrono::seconds COOL_DOWN(30);
+
+    /**
+     * Background connections that fail are retried after a delay that
+     * doubles up to the maximum
+     */
+    const std::chrono::milliseconds MIN_RETRY_DELAY(100);
+    const std::chrono::milliseconds MAX_RETRY_DELAY(5000);
+
+    /**
+     * Check that a warm connection can still carry a request. Reading
+     * consumes anything OpenSSL handles itself, like TLS 1.3 session
+     * tickets; application data or a close leave it unusable.
+     */
+    bool is_usable(ssl_socket & s)
+    {
+        char unexpected;
+        try
+        {
+            return s.read(&unexpected, 1) == 0 && s.is_connected();
+        } catch (const ssl_socket_exception &) {
+            return false;
+        }
+    }
+}
+
+warm_pool::warm_pool(const std::string & _host, const std::string & _port):
+    host(_host),
+    port(_port),
+    secure(true),
+    minimum_target(1),
+    maximum_target(16),
+    configure(),
+    probe_interval(1000),
+    max_age(30000),
+    refill_concurrency(4),
+    stopping(false),
+    connecting(0),
+    demand(0),
+    setup_time(0),
+    hits(0),
+    misses(0),
+    discarded(0),
+    failures(0)
+{
+
+}
+
+warm_pool::~warm_pool()
+{
+    stop();
+}
+
+warm_pool& warm_pool::set_secure(bool enabled)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    secure = enabled;
+    return *this;
+}
+
+warm_pool& warm_pool::set_target(size_t minimum, size_t maximum)
+{
+    if (maximum < minimum)
+    {
+        throw ssl_socket_exception("The maximum warm target is below the minimum");
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    minimum_target = minimum;
+    maximum_target = maximum;
+    return *this;
+}
+
+warm_pool& warm_pool::set_configure(const configure_handler & handler)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    configure = handler;
+    return *this;
+}
+
+warm_pool& warm_pool::set_probe_interval(std::chrono::milliseconds interval)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    probe_interval = interval;
+    return *this;
+}
+
+warm_pool& warm_pool::set_max_age(std::chrono::milliseconds age)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    max_age = age;
+    return *this;
+}
+
+warm_pool& warm_pool::set_refill_concurrency(size_t count)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!workers.empty())
+    {
+        throw ssl_socket_exception("Attempting to change refill concurrency after the warm pool started");
+    }
+    refill_concurrency = std::max<size_t>(1, count);
+    return *this;
+}
+
+void warm_pool::start()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!workers.empty())
+    {
+        throw ssl_socket_exception("The warm pool is already started");
+    }
+    stopping = false;
+    last_sweep = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < refill_concurrency; ++i)
+    {
+        workers.emplace_back(&warm_pool::refill, this);
+    }
+}
+
+void warm_pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread & worker : workers)
+    {
+        worker.join();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    workers.clear();
+    warm.clear();
+}
+
+ssl_socket warm_pool::acquire()
+{
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        record_demand(now);
+        // The newest connection is the furthest from the server's idle timeout
+        while (!warm.empty())
+        {
+            warm_connection candidate = std::move(warm.back());
+            warm.pop_back();
+            if (now - candidate.established <= max_age && is_usable(candidate.socket))
+            {
+                ++hits;
+                guard.unlock();
+                wake.notify_all();
+                return std::move(candidate.socket);
+            }
+            ++discarded;
+        }
+        ++misses;
+    }
+    wake.notify_all();
+    return make_connection();
+}
+
+warm_pool::statistics warm_pool::get_statistics() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return {warm.size(), connecting, get_target(), hits, misses, discarded, failures, setup_time, last_error};
+}
+
+ssl_socket warm_pool::make_connection()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    ssl_socket s(host, port);
+    configure_handler current_configure = configure;
+    bool current_secure = secure;
+    guard.unlock();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (current_configure)
+        current_configure(s);
+    s.connect();
+    if (current_secure)
+        s.make_secure();
+    std::chrono::microseconds elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    guard.lock();
+    setup_time = setup_time.count() == 0 ? elapsed : (setup_time * 7 + elapsed) / 8;
+    return s;
+}
+
+void warm_pool::record_demand(std::chrono::steady_clock::time_point now)
+{
+    // Only the last maximum_target acquisitions can change the target
+    recent.push_back(now);
+    while (recent.size() > maximum_target)
+    {
+        recent.pop_front();
+    }
+
+    std::chrono::microseconds window = setup_time.count() > 0 ? setup_time : DEFAULT_SETUP_TIME;
+    size_t burst = 0;
+    for (auto i = recent.rbegin(); i != recent.rend() && now - *i <= window; ++i)
+    {
+        ++burst;
+    }
+    if (burst >= demand)
+    {
+        demand = burst;
+        last_peak = now;
+    }
+}
+
+void warm_pool::sweep(std::chrono::steady_clock::time_point now)
+{
+    last_sweep = now;
+    if (now - last_peak > COOL_DOWN && demand > minimum_target)
+    {
+        demand = std::max(minimum_target, demand / 2);
+        last_peak = now;
+    }
+
+    for (size_t i = warm.size(); i-- > 0; )
+    {
+        if (now - warm[i].established > max_age || !is_usable(warm[i].socket))
+        {
+            warm.erase(warm.begin() + i);
+            ++discarded;
+        }
+    }
+    // Oldest first, once the target has come down
+    size_t target = get_target();
+    if (warm.size() > target)
+    {
+        warm.erase(warm.begin(), warm.begin() + (warm.size() - target));
+    }
+}
+
+size_t warm_pool::get_target() const
+{
+    return std::min(maximum_target, std::max(minimum_target, demand));
+}
+
+void warm_pool::refill()
+{
+    std::chrono::milliseconds retry_delay(0);
+    std::chrono::steady_clock::time_point retry_at;
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stopping)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - last_sweep >= probe_interval)
+        {
+            sweep(now);
+        }
+        if (now < retry_at || warm.size() + connecting >= get_target())
+        {
+            std::chrono::steady_clock::time_point until = last_sweep + probe_interval;
+            wake.wait_until(guard, now < retry_at ? std::min(until, retry_at) : until);
+            continue;
+        }
+
+        ++connecting;
+        guard.unlock();
+        try
+        {
+            ssl_socket s = make_connection();
+            guard.lock();
+            warm.push_back({std::move(s), std::chrono::steady_clock::now()});
+            retry_delay = std::chrono::milliseconds(0);
+        } catch (const ssl_socket_exception & e) {
+            guard.lock();
+            ++failures;
+            last_error = e.to_string();
+            retry_delay = std::min(MAX_RETRY_DELAY, std::max(MIN_RETRY_DELAY, retry_delay * 2));
+            retry_at = std::chrono::steady_clock::now() + retry_delay;
+        }
+        --connecting;
+    }
+}
@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ssl_socket.h"
+
+/**
+ * Keeps connections to one host resolved, connected and (optionally)
+ * through the TLS handshake ahead of demand, so a burst of requests
+ * doesn't pay DNS, TCP and TLS setup in series before its first byte.
+ *
+ * Background threads top the pool up to a target that follows the
+ * requests: it grows to the largest number of acquisitions seen within
+ * one connection setup time, since those are the requests a refill
+ * can't catch up with, and halves again after a quiet spell. Warm
+ * connections are checked every probe interval, and again when handed
+ * out, and retired once they reach the maximum age, before the server
+ * would close them as idle.
+ */
+class warm_pool
+{
+  public:
+    typedef std::function<void(ssl_socket & s)> configure_handler;
+
+    struct statistics
+    {
+        size_t warm; ///< Connections ready to hand out
+        size_t connecting; ///< Connections being set up in the background
+        size_t target; ///< How many warm connections the pool aims for
+        uint64_t hits; ///< Acquisitions served by a warm connection
+        uint64_t misses; ///< Acquisitions that had to connect on the spot
+        uint64_t discarded; ///< Warm connections found closed, or retired by age
+        uint64_t failures; ///< Background connections that failed
+        std::chrono::microseconds setup_time; ///< Average time to connect and handshake
+        std::string last_error; ///< Why the last background connection failed
+    };
+
+    warm_pool(const std::string & _host, const std::string & _port);
+    ~warm_pool();
+    warm_pool(warm_pool const&) = delete;
+    warm_pool& operator=(warm_pool const&) = delete;
+
+    /**
+     * Whether to complete the TLS handshake too (the default) or only
+     * connect
+     *
+     * @return a reference to itself
+     */
+    warm_pool& set_secure(bool enabled = true);
+
+    /**
+     * Bound the warm target, 1 to 16 by default. The pool keeps at
+     * least minimum connections warm even when idle.
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if maximum is less than minimum
+     */
+    warm_pool& set_target(size_t minimum, size_t maximum);
+
+    /**
+     * Called on every new socket before it connects, to set options
+     * like set_verify_peer or set_tuning_profile
+     *
+     * @return a reference to itself
+     */
+    warm_pool& set_configure(const configure_handler & handler);
+
+    /**
+     * How often warm connections are checked (1 second by default)
+     *
+     * @return a reference to itself
+     */
+    warm_pool& set_probe_interval(std::chrono::milliseconds interval);
+
+    /**
+     * How long a connection may stay warm before it is replaced (30
+     * seconds by default), keep it under the server's idle timeout
+     *
+     * @return a reference to itself
+     */
+    warm_pool& set_max_age(std::chrono::milliseconds age);
+
+    /**
+     * The number of connections set up in the background at once (4
+     * by default)
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the pool has been started
+     */
+    warm_pool& set_refill_concurrency(size_t count);
+
+    /**
+     * Start warming connections in the background
+     *
+     * @throw ssl_socket_exception if it is already started
+     */
+    void start();
+
+    /**
+     * Stop the background threads and close the warm connections,
+     * connections already handed out are not affected
+     */
+    void stop();
+
+    /**
+     * Take a connection, a warm one if one is ready or else a new one
+     * set up on the calling thread. Safe to call from any thread.
+     *
+     * @throw ssl_socket_exception if a new connection fails
+     */
+    ssl_socket acquire();
+
+    statistics get_statistics() const;
+
+  private:
+    struct warm_connection
+    {
+        ssl_socket socket;
+        std::chrono::steady_clock::time_point established;
+    };
+
+    /**
+     * Set up a connection with the current settings, timing it
+     */
+    ssl_socket make_connection();
+
+    /**
+     * Account for an acquisition in the demand estimate, call with the lock held
+     */
+    void record_demand(std::chrono::steady_clock::time_point now);
+
+    /**
+     * Close warm connections that are dead or too old, call with the lock held
+     */
+    void sweep(std::chrono::steady_clock::time_point now);
+
+    size_t get_target() const;
+    void refill();
+
+    std::string host;
+    std::string port;
+    bool secure;
+    size_t minimum_target;
+    size_t maximum_target;
+    configure_handler configure;
+    std::chrono::milliseconds probe_interval;
+    std::chrono::milliseconds max_age;
+    size_t refill_concurrency;
+
+    mutable std::mutex lock;
+    std::condition_variable wake;
+    std::vector<std::thread> workers;
+    bool stopping;
+    std::vector<warm_connection> warm;
+    size_t connecting;
+    std::deque<std::chrono::steady_clock::time_point> recent;
+    size_t demand;
+    std::chrono::steady_clock::time_point last_peak;
+    std::chrono::steady_clock::time_point last_sweep;
+    std::chrono::microseconds setup_time;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t discarded;
+    uint64_t failures;
+    std::string last_error;
+};
@@ -0,0 +1,339 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "websocket_client.h"
+#include "http_response_decoder.h"
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+namespace
+{
+    const size_t DEFAULT_MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+    const size_t MAX_HANDSHAKE_SIZE = 64 * 1024;
+    const std::chrono::seconds HANDSHAKE_TIMEOUT(10);
+    const size_t KEY_SIZE = 16;
+
+    /**
+     * Masking keys are drawn from this many random bytes at a time so
+     * small messages don't pay for a call into OpenSSL's RNG each
+     */
+    const size_t RANDOM_POOL_SIZE = 4096;
+
+    /**
+     * Only the payload of a ping or close may be echoed, both fit in
+     * a control frame
+     */
+    const size_t MAX_CONTROL_PAYLOAD = 125;
+
+    std::string base64(const uint8_t* data, size_t length)
+    {
+        std::vector<unsigned char> encoded(4 * ((length + 2) / 3) + 1);
+        int encoded_length = EVP_EncodeBlock(encoded.data(), data, length);
+        return std::string(reinterpret_cast<char*>(encoded.data()), encoded_length);
+    }
+
+    bool contains_token(const std::string & value, const char* token)
+    {
+        for (size_t start = 0; start + strlen(token) <= value.size(); ++start)
+        {
+            if (strncasecmp(value.c_str() + start, token, strlen(token)) == 0)
+                return true;
+        }
+        return false;
+    }
+}
+
+websocket_client::websocket_client(const std::string & _host, const std::string & _port, const std::string & _path):
+    socket(_host, _port),
+    host(_host),
+    port(_port),
+    path(_path),
+    secure(true),
+    max_message_size(DEFAULT_MAX_MESSAGE_SIZE),
+    input_start(0),
+    random_position(RANDOM_POOL_SIZE),
+    in_fragmented_message(false),
+    close_sent(false)
+{
+
+}
+
+websocket_client& websocket_client::set_secure(bool enabled)
+{
+    secure = enabled;
+    return *this;
+}
+
+websocket_client& websocket_client::set_verify_peer(bool enabled)
+{
+    socket.set_verify_peer(enabled);
+    return *this;
+}
+
+websocket_client& websocket_client::set_max_message_size(size_t size)
+{
+    max_message_size = size;
+    return *this;
+}
+
+websocket_client& websocket_client::connect()
+{
+    socket.connect();
+    if (secure)
+    {
+        socket.make_secure();
+    }
+    close_sent = false;
+    in_fragmented_message = false;
+    input.clear();
+    input_start = 0;
+
+    uint8_t key_bytes[KEY_SIZE];
+    if (RAND_bytes(key_bytes, sizeof(key_bytes)) != 1)
+    {
+        throw ssl_socket_exception("Unable to generate WebSocket key");
+    }
+    std::string key = base64(key_bytes, sizeof(key_bytes));
+    bool default_port = port == (secure ? "443" : "80") || port == (secure ? "https" : "http");
+    socket.write("GET " + path + " HTTP/1.1\r\n"
+                 "Host: " + host + (default_port ? "" : ":" + port) + "\r\n"
+                 "Upgrade: websocket\r\n"
+                 "Connection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: " + key + "\r\n"
+                 "Sec-WebSocket-Version: 13\r\n\r\n");
+
+    // Frames may follow the response in the same read, so only the
+    // headers go to the decoder and the rest stays in the input
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + HANDSHAKE_TIMEOUT;
+    const char header_end[] = "\r\n\r\n";
+    std::vector<char>::iterator end;
+    while ((end = std::search(input.begin(), input.end(), header_end, header_end + 4)) == input.end())
+    {
+        std::chrono::milliseconds remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (input.size() > MAX_HANDSHAKE_SIZE || remaining.count() <= 0 || (!fill_input(remaining) && !socket.is_connected()))
+        {
+            socket.disconnect();
+            throw ssl_socket_exception("No WebSocket handshake response");
+        }
+    }
+    input_start = end - input.begin() + 4;
+
+    http_response_decoder response([](const char*, size_t) {}, false);
+    response.feed(input.data(), input_start);
+    if (response.get_status() != 101 || !contains_token(response.get_header("Upgrade"), "websocket")
+        || response.get_header("Sec-WebSocket-Accept") != websocket_accept_key(key))
+    {
+        socket.disconnect();
+        throw ssl_socket_exception("WebSocket upgrade refused: " + response.get_headers().substr(0, response.get_headers().find("\r\n")));
+    }
+    return *this;
+}
+
+websocket_client& websocket_client::send_text(const std::string & message)
+{
+    send_frame(websocket_opcode::text, message.data(), message.size());
+    return *this;
+}
+
+websocket_client& websocket_client::send_binary(const void* data, size_t length)
+{
+    send_frame(websocket_opcode::binary, data, length);
+    return *this;
+}
+
+websocket_client& websocket_client::ping(const std::string & payload)
+{
+    send_frame(websocket_opcode::ping, payload.data(), std::min(payload.size(), MAX_CONTROL_PAYLOAD));
+    return *this;
+}
+
+bool websocket_client::receive(websocket_message & message, std::chrono::milliseconds timeout)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        if (process_frames(message))
+        {
+            return true;
+        }
+        if (!socket.is_connected())
+        {
+            return false;
+        }
+        std::chrono::milliseconds remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (!fill_input(std::max(remaining, std::chrono::milliseconds(0))) && remaining.count() <= 0)
+        {
+            return false;
+        }
+    }
+}
+
+void websocket_client::close(uint16_t code, std::chrono::milliseconds timeout)
+{
+    if (!socket.is_connected())
+    {
+        return;
+    }
+    if (!close_sent)
+    {
+        uint8_t payload[2] = {static_cast<uint8_t>(code >> 8), static_cast<uint8_t>(code)};
+        send_frame(websocket_opcode::close, payload, sizeof(payload));
+        close_sent = true;
+    }
+
+    // Anything still arriving is dropped until the server's close
+    websocket_message discarded;
+    while (receive(discarded, timeout))
+    {
+    }
+    socket.disconnect();
+}
+
+void websocket_client::send_frame(websocket_opcode opcode, const void* data, size_t length)
+{
+    if (!socket.is_connected() || close_sent)
+    {
+        throw ssl_socket_exception("WebSocket is not open");
+    }
+
+    const uint8_t* key = next_mask_key();
+    output.resize(MAX_FRAME_HEADER_SIZE + length);
+    size_t header_size = encode_frame_header(output.data(), opcode, true, length, key);
+    memcpy(output.data() + header_size, data, length);
+    websocket_mask(output.data() + header_size, length, key);
+    socket.write(output.data(), header_size + length);
+}
+
+const uint8_t* websocket_client::next_mask_key()
+{
+    if (random_position + 4 > random_pool.size())
+    {
+        random_pool.resize(RANDOM_POOL_SIZE);
+        if (RAND_bytes(random_pool.data(), random_pool.size()) != 1)
+        {
+            throw ssl_socket_exception("Unable to generate WebSocket masking key");
+        }
+        random_position = 0;
+    }
+    const uint8_t* key = random_pool.data() + random_position;
+    random_position += 4;
+    return key;
+}
+
+bool websocket_client::process_frames(websocket_message & message)
+{
+    while (true)
+    {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(input.data()) + input_start;
+        size_t length = input.size() - input_start;
+        websocket_frame_header header;
+        if (!decode_frame_header(data, length, header))
+        {
+            return false;
+        }
+        if (header.masked)
+        {
+            throw ssl_socket_exception("WebSocket server sent a masked frame");
+        }
+        if (header.length > max_message_size || (in_fragmented_message && fragments.data.size() + header.length > max_message_size))
+        {
+            throw ssl_socket_exception("WebSocket message too large");
+        }
+        if (length - header.header_size < header.length)
+        {
+            return false; // Wait for the rest of the payload
+        }
+
+        const char* payload = reinterpret_cast<const char*>(data) + header.header_size;
+        size_t payload_size = header.length;
+        input_start += header.header_size + payload_size; // fill_input drops parsed bytes
+
+        switch (header.opcode)
+        {
+          case websocket_opcode::text:
+          case websocket_opcode::binary:
+            if (in_fragmented_message)
+            {
+                throw ssl_socket_exception("WebSocket message started inside a fragmented message");
+            }
+            if (header.final)
+            {
+                message.opcode = header.opcode;
+                message.data.assign(payload, payload_size);
+                return true;
+            }
+            in_fragmented_message = true;
+            fragments.opcode = header.opcode;
+            fragments.data.assign(payload, payload_size);
+            break;
+          case websocket_opcode::continuation:
+            if (!in_fragmented_message)
+            {
+                throw ssl_socket_exception("WebSocket continuation without a message");
+            }
+            fragments.data.append(payload, payload_size);
+            if (header.final)
+            {
+                in_fragmented_message = false;
+                message.opcode = fragments.opcode;
+                message.data.swap(fragments.data);
+                return true;
+            }
+            break;
+          case websocket_opcode::ping:
+            if (!close_sent)
+            {
+                send_frame(websocket_opcode::pong, payload, payload_size);
+            }
+            break;
+          case websocket_opcode::pong:
+            last_pong = std::chrono::steady_clock::now();
+            break;
+          case websocket_opcode::close:
+            if (!close_sent)
+            {
+                // Answer with the same status code
+                send_frame(websocket_opcode::close, payload, std::min<size_t>(payload_size, 2));
+                close_sent = true;
+            }
+            socket.disconnect();
+            return false;
+          default:
+            throw ssl_socket_exception("Unknown WebSocket opcode");
+        }
+    }
+}
+
+bool websocket_client::fill_input(std::chrono::milliseconds timeout)
+{
+    if (input_start > 0 && input_start >= input.size() / 2)
+    {
+        // Drop what has been parsed before it grows the buffer
+        input.erase(input.begin(), input.begin() + input_start);
+        input_start = 0;
+    }
+
+    size_t length = socket.read(read_buffer);
+    if (length == 0 && socket.is_connected() && timeout.count() > 0)
+    {
+        socket.wait_readable(timeout);
+        length = socket.read(read_buffer);
+    }
+    input.insert(input.end(), read_buffer.begin(), read_buffer.begin() + length);
+    return length > 0;
+}
@@ -0,0 +1,182 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <chrono>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include "ssl_socket.h"
+#include "websocket_frame.h"
+
+/**
+ * A complete message received over a WebSocket, reassembled from its
+ * fragments
+ */
+struct websocket_message
+{
+    websocket_opcode opcode; ///< text or binary
+    std::string data;
+};
+
+/**
+ * A WebSocket (RFC 6455) client on top of ssl_socket. connect does
+ * the HTTP upgrade, after which messages are sent as single frames
+ * and received with frames parsed as bytes arrive. Pings are answered
+ * inside receive. Every frame a client sends has to be masked, which
+ * uses the widest vector instructions the CPU has.
+ */
+class websocket_client
+{
+  public:
+    /**
+     * @param _host The hostname or ip address to connect to (ex: "fizz.buzz")
+     * @param _port The port or service name to connect to (ex: "443" or "https")
+     * @param _path The resource to upgrade (ex: "/feed")
+     */
+    websocket_client(const std::string & _host, const std::string & _port, const std::string & _path);
+    websocket_client(websocket_client const&) = delete;
+    websocket_client& operator=(websocket_client const&) = delete;
+
+    /**
+     * Enable or disable TLS (on by default)
+     *
+     * @return a reference to itself
+     */
+    websocket_client& set_secure(bool enabled = true);
+
+    /**
+     * Enable or disable peer certificate verification (on by default)
+     *
+     * @return a reference to itself
+     */
+    websocket_client& set_verify_peer(bool enabled = true);
+
+    /**
+     * Set the largest message receive will reassemble (16MB by default)
+     *
+     * @return a reference to itself
+     */
+    websocket_client& set_max_message_size(size_t size);
+
+    /**
+     * Connect, make the connection secure if enabled and perform the
+     * upgrade handshake
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the connection fails or the server
+     * refuses the upgrade
+     */
+    websocket_client& connect();
+
+    /**
+     * Send a text message
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the connection isn't open
+     */
+    websocket_client& send_text(const std::string & message);
+
+    /**
+     * Send a binary message
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the connection isn't open
+     */
+    websocket_client& send_binary(const void* data, size_t length);
+
+    /**
+     * Send a ping, the pong is consumed by receive
+     *
+     * @param payload at most 125 bytes echoed back by the server
+     *
+     * @return a reference to itself
+     * @throw ssl_socket_exception if the connection isn't open
+     */
+    websocket_client& ping(const std::string & payload = std::string());
+
+    /**
+     * Wait for the next complete text or binary message, answering
+     * pings and recording pongs along the way. A close from the
+     * server is answered and ends the connection.
+     *
+     * @param message filled in with the message
+     * @param timeout the longest time to wait
+     *
+     * @return true if a message arrived, false on timeout or if the
+     * connection closed (check is_open)
+     * @throw ssl_socket_exception on a protocol error or a message
+     * larger than the maximum
+     */
+    bool receive(websocket_message & message, std::chrono::milliseconds timeout);
+
+    /**
+     * Start the closing handshake, wait up to timeout for the server
+     * to answer and disconnect
+     *
+     * @param code the status code to send (1000 is a normal closure)
+     */
+    void close(uint16_t code = 1000, std::chrono::milliseconds timeout = std::chrono::seconds(1));
+
+    /**
+     * Check to see if the connection is open and not closing
+     */
+    bool is_open() const { return socket.is_connected() && !close_sent; }
+
+    /**
+     * When the last pong arrived, or the epoch if none has
+     */
+    std::chrono::steady_clock::time_point get_last_pong() const { return last_pong; }
+
+  private:
+    void send_frame(websocket_opcode opcode, const void* data, size_t length);
+
+    /**
+     * Take the next masking key from a pool of random bytes
+     */
+    const uint8_t* next_mask_key();
+
+    /**
+     * Handle every complete frame in the input buffer
+     *
+     * @return true when a message has been completed into message
+     */
+    bool process_frames(websocket_message & message);
+
+    /**
+     * Read whatever has arrived into the input buffer, waiting up to
+     * timeout if nothing has
+     *
+     * @return false if nothing arrived
+     */
+    bool fill_input(std::chrono::milliseconds timeout);
+
+    ssl_socket socket;
+    std::string host;
+    std::string port;
+    std::string path;
+    bool secure;
+    size_t max_message_size;
+    std::vector<char> input;
+    size_t input_start;
+    std::vector<char> read_buffer;
+    std::vector<uint8_t> output;
+    std::vector<uint8_t> random_pool;
+    size_t random_position;
+    bool in_fragmented_message;
+    websocket_message fragments;
+    bool close_sent;
+    std::chrono::steady_clock::time_point last_pong;
+};
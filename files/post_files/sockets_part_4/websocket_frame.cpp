@@ -0,0 +1,239 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "websocket_frame.h"
+#include "cpu_features.h"
+#include "ssl_socket.h"
+#include <cstring>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    const char HANDSHAKE_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    /**
+     * Bit 7 of the first byte ends a message, bits 4 to 6 are reserved
+     * for extensions
+     */
+    const uint8_t FINAL_BIT = 0x80;
+    const uint8_t RESERVED_BITS = 0x70;
+    const uint8_t OPCODE_BITS = 0x0F;
+    const uint8_t MASK_BIT = 0x80;
+    const uint8_t LENGTH_BITS = 0x7F;
+    const uint8_t LENGTH_16 = 126;
+    const uint8_t LENGTH_64 = 127;
+
+    /**
+     * The key as one 32 bit word, rotated so its first byte lines up
+     * with data at the given payload offset
+     */
+    uint32_t rotated_key(const uint8_t* key, uint64_t offset)
+    {
+        uint8_t rotated[4];
+        for (size_t i = 0; i < 4; ++i)
+        {
+            rotated[i] = key[(offset + i) % 4];
+        }
+        uint32_t word;
+        memcpy(&word, rotated, sizeof(word));
+        return word;
+    }
+
+    /**
+     * Eight bytes at a time, then one at a time. Every step is a
+     * multiple of 4 bytes so the key never needs rotating again.
+     */
+    void mask_scalar(uint8_t* data, size_t length, uint32_t key)
+    {
+        uint64_t wide_key = (static_cast<uint64_t>(key) << 32) | key;
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            word ^= wide_key;
+            memcpy(data + i, &word, sizeof(word));
+        }
+        uint8_t key_bytes[4];
+        memcpy(key_bytes, &key, sizeof(key_bytes));
+        for (; i < length; ++i)
+        {
+            data[i] ^= key_bytes[i % 4];
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("sse2")))
+    void mask_sse2(uint8_t* data, size_t length, uint32_t key)
+    {
+        __m128i wide_key = _mm_set1_epi32(static_cast<int>(key));
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(block, wide_key));
+        }
+        mask_scalar(data + i, length - i, key);
+    }
+
+    __attribute__((target("avx2")))
+    void mask_avx2(uint8_t* data, size_t length, uint32_t key)
+    {
+        __m256i wide_key = _mm256_set1_epi32(static_cast<int>(key));
+        size_t i = 0;
+        // Two vectors per iteration keep both load ports busy
+        for (; i + 64 <= length; i += 64)
+        {
+            __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(first, wide_key));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i + 32), _mm256_xor_si256(second, wide_key));
+        }
+        for (; i + 32 <= length; i += 32)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(block, wide_key));
+        }
+        mask_sse2(data + i, length - i, key);
+    }
+#endif
+
+    mask_implementation fastest_mask()
+    {
+        const cpu_features & features = cpu_features::get();
+        return features.avx2 ? mask_implementation::avx2 : features.sse2 ? mask_implementation::sse2 : mask_implementation::scalar;
+    }
+}
+
+bool is_mask_supported(mask_implementation implementation)
+{
+    switch (implementation)
+    {
+      case mask_implementation::avx2:
+        return cpu_features::get().avx2;
+      case mask_implementation::sse2:
+        return cpu_features::get().sse2;
+      default:
+        return true;
+    }
+}
+
+void websocket_mask(uint8_t* data, size_t length, const uint8_t* key, uint64_t offset, mask_implementation implementation)
+{
+    static const mask_implementation fastest = fastest_mask();
+    if (implementation == mask_implementation::automatic || !is_mask_supported(implementation))
+    {
+        implementation = fastest;
+    }
+
+    uint32_t word = rotated_key(key, offset);
+    switch (implementation)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      case mask_implementation::avx2:
+        mask_avx2(data, length, word);
+        break;
+      case mask_implementation::sse2:
+        mask_sse2(data, length, word);
+        break;
+#endif
+      default:
+        mask_scalar(data, length, word);
+        break;
+    }
+}
+
+size_t encode_frame_header(uint8_t* header, websocket_opcode opcode, bool final, uint64_t length, const uint8_t* mask_key)
+{
+    size_t size = 0;
+    header[size++] = (final ? FINAL_BIT : 0) | static_cast<uint8_t>(opcode);
+    uint8_t mask_bit = mask_key != nullptr ? MASK_BIT : 0;
+    if (length < LENGTH_16)
+    {
+        header[size++] = mask_bit | static_cast<uint8_t>(length);
+    } else if (length <= UINT16_MAX) {
+        header[size++] = mask_bit | LENGTH_16;
+        header[size++] = static_cast<uint8_t>(length >> 8);
+        header[size++] = static_cast<uint8_t>(length);
+    } else {
+        header[size++] = mask_bit | LENGTH_64;
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            header[size++] = static_cast<uint8_t>(length >> shift);
+        }
+    }
+    if (mask_key != nullptr)
+    {
+        memcpy(header + size, mask_key, 4);
+        size += 4;
+    }
+    return size;
+}
+
+bool decode_frame_header(const uint8_t* data, size_t length, websocket_frame_header & header)
+{
+    if (length < 2)
+    {
+        return false;
+    }
+    if (data[0] & RESERVED_BITS)
+    {
+        throw ssl_socket_exception("WebSocket frame uses an extension that wasn't negotiated");
+    }
+    header.final = (data[0] & FINAL_BIT) != 0;
+    header.opcode = static_cast<websocket_opcode>(data[0] & OPCODE_BITS);
+    header.masked = (data[1] & MASK_BIT) != 0;
+
+    size_t size = 2;
+    uint8_t short_length = data[1] & LENGTH_BITS;
+    size_t extended_size = short_length == LENGTH_16 ? 2 : short_length == LENGTH_64 ? 8 : 0;
+    if (length < size + extended_size + (header.masked ? 4 : 0))
+    {
+        return false;
+    }
+    header.length = extended_size == 0 ? short_length : 0;
+    for (size_t i = 0; i < extended_size; ++i)
+    {
+        header.length = (header.length << 8) | data[size++];
+    }
+    if (header.masked)
+    {
+        memcpy(header.mask_key, data + size, 4);
+        size += 4;
+    }
+    header.header_size = size;
+
+    bool control = static_cast<uint8_t>(header.opcode) & 0x8;
+    if (control && (!header.final || header.length > 125))
+    {
+        throw ssl_socket_exception("Malformed WebSocket control frame");
+    }
+    return true;
+}
+
+std::string websocket_accept_key(const std::string & key)
+{
+    std::string input = key + HANDSHAKE_GUID;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(), digest);
+    unsigned char encoded[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+    int encoded_length = EVP_EncodeBlock(encoded, digest, SHA_DIGEST_LENGTH);
+    return std::string(reinterpret_cast<char*>(encoded), encoded_length);
+}
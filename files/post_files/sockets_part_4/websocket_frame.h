@@ -0,0 +1,106 @@
+/*
+Copyright (c) 2014, Tom Alexander <tom@fizz.buzz>
+
+Permission to use, copy, modify, and/or distribute this software for any
+purpose with or without fee is hereby granted, provided that the above
+copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#pragma once
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+
+/**
+ * Frame types from RFC 6455, continuation frames carry the rest of a
+ * fragmented text or binary message
+ */
+enum class websocket_opcode : uint8_t
+{
+    continuation = 0x0,
+    text = 0x1,
+    binary = 0x2,
+    close = 0x8,
+    ping = 0x9,
+    pong = 0xA
+};
+
+/**
+ * Which code websocket_mask uses. Automatic picks the widest vectors
+ * the CPU supports, the others exist for benchmarks and comparisons.
+ */
+enum class mask_implementation
+{
+    automatic,
+    scalar,
+    sse2,
+    avx2
+};
+
+/**
+ * The fixed part of a frame, as decoded from the wire
+ */
+struct websocket_frame_header
+{
+    bool final;
+    websocket_opcode opcode;
+    bool masked;
+    uint8_t mask_key[4];
+    uint64_t length;
+    size_t header_size; ///< Bytes before the payload, 2 to 14
+};
+
+/**
+ * The longest a frame header can be
+ */
+const size_t MAX_FRAME_HEADER_SIZE = 14;
+
+/**
+ * XOR data with the repeating 4 byte masking key. Masking and
+ * unmasking are the same operation.
+ *
+ * @param data the payload, masked in place
+ * @param length number of bytes to mask
+ * @param key the 4 byte masking key
+ * @param offset position of data within the payload, so a payload
+ * can be masked in pieces
+ * @param implementation the code to use, automatic unless comparing
+ */
+void websocket_mask(uint8_t* data, size_t length, const uint8_t* key, uint64_t offset = 0,
+                    mask_implementation implementation = mask_implementation::automatic);
+
+/**
+ * Check to see if an implementation can run on this CPU
+ */
+bool is_mask_supported(mask_implementation implementation);
+
+/**
+ * Write a frame header
+ *
+ * @param header room for at least MAX_FRAME_HEADER_SIZE bytes
+ * @param mask_key the masking key, or nullptr for an unmasked frame
+ *
+ * @return the number of bytes written
+ */
+size_t encode_frame_header(uint8_t* header, websocket_opcode opcode, bool final, uint64_t length, const uint8_t* mask_key);
+
+/**
+ * Decode a frame header from the start of data
+ *
+ * @return false if more bytes are needed to decode it
+ * @throw ssl_socket_exception if the header is malformed
+ */
+bool decode_frame_header(const uint8_t* data, size_t length, websocket_frame_header & header);
+
+/**
+ * The Sec-WebSocket-Accept value a server answers a handshake's
+ * Sec-WebSocket-Key with
+ */
+std::string websocket_accept_key(const std::string & key);